@@ -2,6 +2,8 @@
 #define PVAHELPER_H
 
 #include <deque>
+#include <map>
+#include <vector>
 
 #include <epicsGuard.h>
 
@@ -58,6 +60,48 @@ struct BaseChannel : public epics::pvAccess::Channel
     }
 };
 
+/**
+ * Immutable copy of the complete PVStructure of some source, shared by all
+ * BaseMonitors connect()ed with it, so that each post() need not copy into a queue element.
+ * The source must call invalidate() whenever the complete structure is changed.
+ * Guarded by the BaseMonitor lock.
+ */
+struct BaseSnapshot
+{
+    //! current value as an immutable structure.  Copied on first use after invalidate()
+    const epics::pvData::PVStructurePtr& get(const epics::pvData::PVStructurePtr& complete)
+    {
+        if(!snap) {
+            // shallow, array values are shared with complete
+            epics::pvData::PVStructurePtr temp(epics::pvData::getPVDataCreate()->createPVStructure(complete->getStructure()));
+            temp->copyUnchecked(*complete);
+            temp->setImmutable();
+            snap = temp;
+        }
+        return snap;
+    }
+
+    inline void invalidate() { snap.reset(); }
+
+private:
+    epics::pvData::PVStructurePtr snap;
+};
+
+/**
+ * Source of MonitorElements for BaseMonitor queues, which may keep
+ * elements returned by one BaseMonitor for re-use by another.
+ * Called with the BaseMonitor lock held.
+ */
+struct BaseElementPool
+{
+    virtual ~BaseElementPool() {}
+
+    //! an element with a PVStructure of this type, whose values are unspecified
+    virtual epics::pvAccess::MonitorElementPtr get(const epics::pvData::StructureConstPtr& type) =0;
+    //! return an element no longer referenced elsewhere
+    virtual void put(const epics::pvAccess::MonitorElementPtr& elem) =0;
+};
+
 /**
  * Helper which implements a Monitor queue.
  * connect()s to a complete copy of a PVStructure.
@@ -65,6 +109,9 @@ struct BaseChannel : public epics::pvAccess::Channel
  *
  * Derived class may use onStart(), onStop(), and requestUpdate()
  * to react to subscriber events.
+ *
+ * The queue holds record._options.queueSize elements (at least 2), which are
+ * allocated only when the queue has grown to need them.
  */
 struct BaseMonitor : public epics::pvAccess::Monitor
 {
@@ -82,23 +129,64 @@ private:
     const requester_t::weak_pointer requester;
 
     epics::pvData::PVStructurePtr complete;
+    // when set, queue elements hold shared snapshots of complete, and free elements are NULL
+    BaseSnapshot *snapshot;
+    // when set, elements are taken from, and returned on destroy() to, this pool
+    BaseElementPool *pool;
     epics::pvData::BitSet changed, overflow;
 
     typedef std::deque<epics::pvAccess::MonitorElementPtr> buffer_t;
+    // when !snapshot, fills are numbered.  For each element, the # of its last fill.
+    // For each field of complete (by offset), the # of the first fill after its last change.
+    // So an element need only copy those fields with a # greater than its own.
+    typedef std::map<const epics::pvAccess::MonitorElement*, size_t> filled_t;
+    filled_t filled;
+    std::vector<size_t> fieldfill;
+    size_t nfills;
+    epics::pvData::BitSet stale; // scratch, fields to copy
     bool inoverflow;
     bool running;
-    size_t nbuffers;
+    const size_t nbuffers;
+    size_t nallocated, // # of elements in empty, inuse, or held by the requester
+           nhighwater; // max. # of elements in inuse or held by the requester
     buffer_t inuse, empty;
 
+    static size_t queueSize(const epics::pvData::PVStructure::shared_pointer& pvReq, size_t limit)
+    {
+        size_t ret = 2u; // pvAccess default
+        if(pvReq) {
+            try {
+                getS<epics::pvData::uint32>(pvReq, "record._options.queueSize", ret);
+            } catch(std::exception&) {
+                // not a number, use default
+            }
+        }
+        if(ret>limit)
+            ret = limit;
+        if(ret<2u)
+            ret = 2u;
+        return ret;
+    }
+
+    //! no element is free, or may be allocated
+    inline bool full() const { return empty.empty() && nallocated>=nbuffers; }
+
 public:
+    //! @param maxQueueSize upper bound on record._options.queueSize from pvReq
     BaseMonitor(epicsMutex& lock,
                 const requester_t::weak_pointer& requester,
-                const epics::pvData::PVStructure::shared_pointer& pvReq)
+                const epics::pvData::PVStructure::shared_pointer& pvReq,
+                size_t maxQueueSize = 2u)
         :lock(lock)
         ,requester(requester)
+        ,snapshot(NULL)
+        ,pool(NULL)
+        ,nfills(0u)
         ,inoverflow(false)
         ,running(false)
-        ,nbuffers(2)
+        ,nbuffers(queueSize(pvReq, maxQueueSize))
+        ,nallocated(0u)
+        ,nhighwater(0u)
     {}
 
     virtual ~BaseMonitor() {destroy();}
@@ -107,21 +195,23 @@ public:
 
     //! Must call before first post().  Sets .complete and calls monitorConnect()
     //! @note that value will never by accessed except by post() and requestUpdate()
-    void connect(guard_t& guard, const epics::pvData::PVStructurePtr& value)
+    //! @param snap if not NULL, share snap->get(value) instead of copying value for each update
+    //! @param elems if not NULL, and !snap, take queue elements from this pool
+    void connect(guard_t& guard, const epics::pvData::PVStructurePtr& value, BaseSnapshot *snap = NULL,
+                 BaseElementPool *elems = NULL)
     {
         guard.assertIdenticalMutex(lock);
         epics::pvData::StructureConstPtr dtype(value->getStructure());
-        epics::pvData::PVDataCreatePtr create(epics::pvData::getPVDataCreate());
         BaseMonitor::shared_pointer self(shared_from_this());
         requester_t::shared_pointer req(requester.lock());
 
         assert(!complete); // can't call twice
 
         complete = value;
-        empty.resize(nbuffers);
-        for(size_t i=0; i<empty.size(); i++) {
-            empty[i].reset(new epics::pvAccess::MonitorElement(create->createPVStructure(dtype)));
-        }
+        snapshot = snap;
+        pool = snap ? NULL : elems;
+        if(!snap)
+            fieldfill.resize(value->getNumberFields(), 0u);
 
         if(req) {
             unguard_t U(guard);
@@ -142,7 +232,7 @@ public:
 
         changed |= updated;
 
-        if(empty.empty()) return false;
+        if(full()) return false;
 
         if(p_postone())
             req = requester.lock();
@@ -164,7 +254,7 @@ public:
 
         if(!complete || !running) return false;
 
-        if(empty.empty()) {
+        if(full()) {
             oflow = inoverflow = true;
 
         } else {
@@ -192,7 +282,7 @@ public:
 
         if(!complete || !running) return false;
 
-        if(empty.empty()) {
+        if(full()) {
             oflow = inoverflow = true;
             overflow |= overflowed;
             overflow.or_and(updated, changed);
@@ -220,7 +310,7 @@ public:
 
         if(!complete || !running) return false;
 
-        if(empty.empty()) {
+        if(full()) {
             oflow = inoverflow = true;
             overflow.or_and(updated, changed);
             changed |= updated;
@@ -245,11 +335,47 @@ private:
     {
         bool ret;
         // assume lock is held
-        assert(!empty.empty());
+        assert(!full());
+
+        if(empty.empty()) {
+            // grow the queue
+            epics::pvAccess::MonitorElementPtr elem;
+            if(pool)
+                elem = pool->get(complete->getStructure());
+            else if(!snapshot)
+                elem.reset(new epics::pvAccess::MonitorElement(epics::pvData::getPVDataCreate()->createPVStructure(complete->getStructure())));
+            if(elem)
+                filled[elem.get()] = 0u; // never filled
+            empty.push_back(elem);
+            nallocated++;
+        }
 
         epics::pvAccess::MonitorElementPtr& elem = empty.front();
 
-        elem->pvStructurePtr->copyUnchecked(*complete);
+        if(snapshot) {
+            // only the bit masks are private to this monitor
+            elem.reset(new epics::pvAccess::MonitorElement(snapshot->get(complete)));
+        } else {
+            // copy only those fields which have changed since elem was last filled.
+            // Cost is proportional to the # of fields, not the queue size.
+            nfills++;
+            for(epics::pvData::int32 i=changed.nextSetBit(0); i>=0; i=changed.nextSetBit(i+1))
+                fieldfill[i] = nfills;
+
+            filled_t::iterator it(filled.find(elem.get()));
+            if(it==filled.end() || it->second==0u) { // not one of ours?  or new
+                elem->pvStructurePtr->copyUnchecked(*complete);
+            } else {
+                stale.clear();
+                for(size_t i=0; i<fieldfill.size(); i++) {
+                    if(fieldfill[i] > it->second)
+                        stale.set(i);
+                }
+                elem->pvStructurePtr->copyUnchecked(*complete, stale);
+            }
+            if(it!=filled.end())
+                it->second = nfills;
+        }
         *elem->changedBitSet = changed;
         *elem->overrunBitSet = overflow;
 
@@ -259,6 +385,8 @@ private:
         ret = inuse.empty();
         inuse.push_back(elem);
         empty.pop_front();
+        if(nhighwater < nallocated - empty.size())
+            nhighwater = nallocated - empty.size();
         return ret;
     }
 public:
@@ -273,6 +401,23 @@ public:
     virtual void destroy()
     {
         stop();
+        if(pool) {
+            // return those elements not held by the requester
+            guard_t G(lock);
+            p_return(empty);
+            p_return(inuse);
+            filled.clear();
+            pool = NULL;
+        }
+    }
+
+private:
+    void p_return(buffer_t& elems)
+    {
+        for(buffer_t::const_iterator it(elems.begin()), end(elems.end()); it!=end; ++it)
+            pool->put(*it);
+        nallocated -= elems.size();
+        elems.clear();
     }
 
 private:
@@ -286,15 +431,12 @@ private:
             if(running) return ret;
             running = true;
             if(!complete) return ret; // haveType() not called (error?)
-            inoverflow = empty.empty();
-            if(!inoverflow) {
-
-                // post complete event
-                overflow.clear();
-                changed.clear();
-                changed.set(0);
-                notify = true;
-            }
+            // the next update is complete, even if delayed until an element is release()d
+            overflow.clear();
+            changed.clear();
+            changed.set(0);
+            inoverflow = full();
+            notify = !inoverflow;
         }
         if(notify) onStart(); // may result in post()
         return ret;
@@ -330,7 +472,10 @@ private:
         BaseMonitor::shared_pointer self;
         {
             guard_t G(lock);
-            empty.push_back(elem);
+            if(snapshot)
+                empty.push_back(epics::pvAccess::MonitorElementPtr()); // don't hold a reference to the released snapshot
+            else
+                empty.push_back(elem);
             if(inoverflow)
                 self = weakself.lock(); //TODO: concurrent release?
         }
@@ -341,10 +486,26 @@ public:
     virtual void getStats(Stats& s) const
     {
         guard_t G(lock);
-        s.nempty = empty.size();
+        s.nempty = nbuffers - nallocated + empty.size();
         s.nfilled = inuse.size();
         s.noutstanding = nbuffers - s.nempty - s.nfilled;
     }
+
+    struct QueueStats : public Stats
+    {
+        size_t nbuffers,   // queueSize
+               nallocated, // elements allocated so far
+               nhighwater; // max. of nfilled+noutstanding
+    };
+
+    void getStats(QueueStats& s) const
+    {
+        guard_t G(lock);
+        getStats(static_cast<Stats&>(s));
+        s.nbuffers = nbuffers;
+        s.nallocated = nallocated;
+        s.nhighwater = nhighwater;
+    }
 };
 
 template<class CP>
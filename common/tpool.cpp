@@ -76,14 +76,14 @@ void WorkQueue::close()
     }
 }
 
-void WorkQueue::add(const value_type& work)
+bool WorkQueue::add(const value_type& work)
 {
     bool empty;
 
     {
         Guard G(mutex);
         if(state!=Active)
-            return;
+            return false;
 
         empty = queue.empty();
 
@@ -93,6 +93,7 @@ void WorkQueue::add(const value_type& work)
     if(empty) {
         wakeup.signal();
     }
+    return true;
 }
 
 void WorkQueue::run()
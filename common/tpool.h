@@ -43,7 +43,8 @@ public:
     void start(unsigned nworkers=1, unsigned prio = epicsThreadPriorityLow);
     void close();
 
-    void add(const value_type& work);
+    //! @returns false, and does not queue, unless started and not closed
+    bool add(const value_type& work);
 
 private:
     virtual void run();
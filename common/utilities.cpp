@@ -18,6 +18,11 @@ typedef epicsGuardRelease<epicsMutex> UnGuard;
 namespace pvd = epics::pvData;
 namespace pva = epics::pvAccess;
 
+int testProviderQuiet;
+
+// testDiag() unless testProviderQuiet.  Arguments are not evaluated when quiet
+#define TRACE(ARGS) do { if(!testProviderQuiet) testDiag ARGS; } while(0)
+
 static size_t countTestChannelRequester;
 
 TestChannelRequester::TestChannelRequester()
@@ -34,7 +39,7 @@ TestChannelRequester::~TestChannelRequester()
 
 void TestChannelRequester::channelCreated(const pvd::Status& status, pva::Channel::shared_pointer const & channel)
 {
-    testDiag("channelCreated %s", channel ? channel->getChannelName().c_str() : "<fails>");
+    TRACE(("channelCreated %s", channel ? channel->getChannelName().c_str() : "<fails>"));
     Guard G(lock);
     laststate = pva::Channel::CONNECTED;
     this->status = status;
@@ -45,7 +50,7 @@ void TestChannelRequester::channelCreated(const pvd::Status& status, pva::Channe
 void TestChannelRequester::channelStateChange(pva::Channel::shared_pointer const & channel,
                                               pva::Channel::ConnectionState connectionState)
 {
-    testDiag("channelStateChange %s %d", channel->getChannelName().c_str(), (int)connectionState);
+    TRACE(("channelStateChange %s %d", channel->getChannelName().c_str(), (int)connectionState));
     Guard G(lock);
     laststate = connectionState;
     wait.trigger();
@@ -170,7 +175,7 @@ void TestChannelMonitorRequester::monitorConnect(pvd::Status const & status,
                                                  pvd::MonitorPtr const & monitor,
                                                  pvd::StructureConstPtr const & structure)
 {
-    testDiag("monitorConnect %p %d", monitor.get(), (int)status.isSuccess());
+    TRACE(("monitorConnect %p %d", monitor.get(), (int)status.isSuccess()));
     Guard G(lock);
     connectStatus = status;
     dtype = structure;
@@ -180,7 +185,7 @@ void TestChannelMonitorRequester::monitorConnect(pvd::Status const & status,
 
 void TestChannelMonitorRequester::monitorEvent(pvd::MonitorPtr const & monitor)
 {
-    testDiag("monitorEvent %p", monitor.get());
+    TRACE(("monitorEvent %p", monitor.get()));
     mon = monitor;
     eventCnt++;
     wait.trigger();
@@ -188,7 +193,7 @@ void TestChannelMonitorRequester::monitorEvent(pvd::MonitorPtr const & monitor)
 
 void TestChannelMonitorRequester::unlisten(pvd::MonitorPtr const & monitor)
 {
-    testDiag("unlisten %p", monitor.get());
+    TRACE(("unlisten %p", monitor.get()));
     Guard G(lock);
     unlistend = true;
     wait.trigger();
@@ -257,11 +262,114 @@ TestPVChannel::createMonitor(
         monitors.insert(ret);
         static_cast<TestPVMonitor*>(ret.get())->weakself = ret; // save wrapped weak ref
     }
-    testDiag("TestPVChannel::createMonitor %s %p", pv->name.c_str(), ret.get());
+    TRACE(("TestPVChannel::createMonitor %s %p", pv->name.c_str(), ret.get()));
     requester->monitorConnect(pvd::Status(), ret, pv->dtype);
     return ret;
 }
 
+pva::ChannelGet::shared_pointer
+TestPVChannel::createChannelGet(
+        pva::ChannelGetRequester::shared_pointer const & requester,
+        pvd::PVStructure::shared_pointer const & pvRequest)
+{
+    shared_pointer self(weakself);
+    TestPVGet::shared_pointer ret(new TestPVGet(self, requester));
+    ret->weakself = ret;
+    requester->channelGetConnect(pvd::Status(), ret, pv->dtype);
+    return ret;
+}
+
+pva::ChannelPut::shared_pointer
+TestPVChannel::createChannelPut(
+        pva::ChannelPutRequester::shared_pointer const & requester,
+        pvd::PVStructure::shared_pointer const & pvRequest)
+{
+    shared_pointer self(weakself);
+    TestPVPut::shared_pointer ret(new TestPVPut(self, requester));
+    ret->weakself = ret;
+    requester->channelPutConnect(pvd::Status(), ret, pv->dtype);
+    return ret;
+}
+
+static size_t countTestPVGet;
+
+TestPVGet::TestPVGet(const TestPVChannel::shared_pointer& ch,
+                     const pva::ChannelGetRequester::shared_pointer& req)
+    :channel(ch)
+    ,requester(req)
+{
+    epicsAtomicIncrSizeT(&countTestPVGet);
+}
+
+TestPVGet::~TestPVGet()
+{
+    epicsAtomicDecrSizeT(&countTestPVGet);
+}
+
+void TestPVGet::get()
+{
+    pvd::PVStructurePtr value(pvd::getPVDataCreate()->createPVStructure(channel->pv->dtype));
+    pvd::BitSet::shared_pointer changed(new pvd::BitSet);
+    changed->set(0);
+    {
+        Guard G(channel->pv->lock);
+        value->copyUnchecked(*channel->pv->value);
+        channel->pv->ngets++;
+        if(!channel->pv->getChanged.isEmpty())
+            *changed = channel->pv->getChanged;
+    }
+    pva::ChannelGetRequester::shared_pointer req(requester.lock());
+    if(req)
+        req->getDone(pvd::Status(), shared_pointer(weakself), value, changed);
+}
+
+static size_t countTestPVPut;
+
+TestPVPut::TestPVPut(const TestPVChannel::shared_pointer& ch,
+                     const pva::ChannelPutRequester::shared_pointer& req)
+    :channel(ch)
+    ,requester(req)
+{
+    epicsAtomicIncrSizeT(&countTestPVPut);
+}
+
+TestPVPut::~TestPVPut()
+{
+    epicsAtomicDecrSizeT(&countTestPVPut);
+}
+
+void TestPVPut::put(pvd::PVStructure::shared_pointer const & pvPutStructure,
+                    pvd::BitSet::shared_pointer const & putBitSet)
+{
+    TRACE(("TestPVPut::put %s changed '%s'", channel->pv->name.c_str(), toString(*putBitSet).c_str()));
+    {
+        Guard G(channel->pv->lock);
+        channel->pv->value->copyUnchecked(*pvPutStructure, *putBitSet);
+        channel->pv->nputs++;
+        if(channel->pv->holdPuts) {
+            channel->pv->heldPuts.push_back(weakself);
+            return;
+        }
+    }
+    pva::ChannelPutRequester::shared_pointer req(requester.lock());
+    if(req)
+        req->putDone(pvd::Status(), shared_pointer(weakself));
+}
+
+void TestPVPut::get()
+{
+    pvd::PVStructurePtr value(pvd::getPVDataCreate()->createPVStructure(channel->pv->dtype));
+    pvd::BitSet::shared_pointer changed(new pvd::BitSet);
+    changed->set(0);
+    {
+        Guard G(channel->pv->lock);
+        value->copyUnchecked(*channel->pv->value);
+    }
+    pva::ChannelPutRequester::shared_pointer req(requester.lock());
+    if(req)
+        req->getDone(pvd::Status(), shared_pointer(weakself), value, changed);
+}
+
 static size_t countTestPVMonitor;
 
 TestPVMonitor::TestPVMonitor(const TestPVChannel::shared_pointer& ch,
@@ -299,7 +407,7 @@ void TestPVMonitor::destroy()
 
 pvd::Status TestPVMonitor::start()
 {
-    testDiag("TestPVMonitor::start %p", this);
+    TRACE(("TestPVMonitor::start %p", this));
 
     Guard G(channel->pv->lock);
     if(finalize && buffer.empty())
@@ -314,7 +422,7 @@ pvd::Status TestPVMonitor::start()
 
     if(this->buffer.empty()) {
         needWakeup = true;
-        testDiag(" need wakeup");
+        TRACE((" need wakeup"));
     }
 
     if(!this->free.empty()) {
@@ -333,13 +441,13 @@ pvd::Status TestPVMonitor::start()
 
         buffer.push_back(monitorElement);
         this->free.pop_front();
-        testDiag(" push current");
+        TRACE((" push current"));
 
     } else {
         inoverflow = true;
         overflow->changedBitSet->clear();
         overflow->changedBitSet->set(0);
-        testDiag(" push overflow");
+        TRACE((" push overflow"));
     }
 
     return pvd::Status();
@@ -347,7 +455,7 @@ pvd::Status TestPVMonitor::start()
 
 pvd::Status TestPVMonitor::stop()
 {
-    testDiag("TestPVMonitor::stop %p", this);
+    TRACE(("TestPVMonitor::stop %p", this));
     Guard G(channel->pv->lock);
     running = false;
     return pvd::Status();
@@ -361,14 +469,14 @@ pva::MonitorElementPtr TestPVMonitor::poll()
         ret = buffer.front();
         buffer.pop_front();
     }
-    testDiag("TestPVMonitor::poll %p %p", this, ret.get());
+    TRACE(("TestPVMonitor::poll %p %p", this, ret.get()));
     return ret;
 }
 
 void TestPVMonitor::release(pva::MonitorElementPtr const & monitorElement)
 {
     Guard G(channel->pv->lock);
-    testDiag("TestPVMonitor::release %p %p", this, monitorElement.get());
+    TRACE(("TestPVMonitor::release %p %p", this, monitorElement.get()));
 
     if(inoverflow) {
         // buffer.empty() may be true if all elements poll()d by user
@@ -382,7 +490,7 @@ void TestPVMonitor::release(pva::MonitorElementPtr const & monitorElement)
         overflow->overrunBitSet->clear();
 
         buffer.push_back(monitorElement);
-        testDiag("TestPVMonitor::release overflow resume %p %p", this, monitorElement.get());
+        TRACE(("TestPVMonitor::release overflow resume %p %p", this, monitorElement.get()));
         inoverflow = false;
     } else {
         this->free.push_back(monitorElement);
@@ -399,6 +507,9 @@ TestPV::TestPV(const std::string& name,
     ,factory(pvd::PVDataCreate::getPVDataCreate())
     ,dtype(dtype)
     ,value(factory->createPVStructure(dtype))
+    ,ngets(0u)
+    ,nputs(0u)
+    ,holdPuts(false)
 {
     epicsAtomicIncrSizeT(&countTestPV);
 }
@@ -408,6 +519,26 @@ TestPV::~TestPV()
     epicsAtomicDecrSizeT(&countTestPV);
 }
 
+void TestPV::completePuts()
+{
+    std::vector<std::tr1::weak_ptr<TestPVPut> > held;
+    {
+        Guard G(lock);
+        held.swap(heldPuts);
+    }
+    TRACE(("complete %u puts to %s", (unsigned)held.size(), name.c_str()));
+
+    FOREACH(std::vector<std::tr1::weak_ptr<TestPVPut> >::const_iterator, it, end, held)
+    {
+        TestPVPut::shared_pointer put(it->lock());
+        if(!put)
+            continue;
+        pva::ChannelPutRequester::shared_pointer req(put->requester.lock());
+        if(req)
+            req->putDone(pvd::Status(), put);
+    }
+}
+
 void TestPV::post(bool notify)
 {
     pvd::BitSet changed;
@@ -417,7 +548,7 @@ void TestPV::post(bool notify)
 
 void TestPV::post(const pvd::BitSet& changed, bool notify)
 {
-    testDiag("post %s %d changed '%s'", name.c_str(), (int)notify, toString(changed).c_str());
+    TRACE(("post %s %d changed '%s'", name.c_str(), (int)notify, toString(changed).c_str()));
     Guard G(lock);
 
     channels_t::vector_type toupdate(channels.lock_vector());
@@ -440,9 +571,9 @@ void TestPV::post(const pvd::BitSet& changed, bool notify)
                 mon->inoverflow = true;
                 mon->overflow->overrunBitSet->or_and(*mon->overflow->changedBitSet, changed); // oflow |= prev_changed & new_changed
                 *mon->overflow->changedBitSet |= changed;
-                testDiag("overflow changed '%s' overrun '%s'",
+                TRACE(("overflow changed '%s' overrun '%s'",
                          toString(*mon->overflow->changedBitSet).c_str(),
-                         toString(*mon->overflow->overrunBitSet).c_str());
+                         toString(*mon->overflow->overrunBitSet).c_str()));
 
             } else {
                 assert(!mon->inoverflow);
@@ -459,13 +590,13 @@ void TestPV::post(const pvd::BitSet& changed, bool notify)
 
                 mon->buffer.push_back(elem);
                 mon->free.pop_front();
-                testDiag("push %p changed '%s' overflow '%s'", elem.get(),
+                TRACE(("push %p changed '%s' overflow '%s'", elem.get(),
                          toString(*elem->changedBitSet).c_str(),
-                         toString(*elem->overrunBitSet).c_str());
+                         toString(*elem->overrunBitSet).c_str()));
             }
 
             if(mon->needWakeup && notify) {
-                testDiag(" wakeup");
+                TRACE((" wakeup"));
                 mon->needWakeup = false;
                 pva::MonitorRequester::shared_pointer req(mon->requester.lock());
                 UnGuard U(G);
@@ -565,7 +696,7 @@ TestProvider::createChannel(std::string const & channelName,
     } else {
         requester->channelCreated(pvd::Status(pvd::Status::STATUSTYPE_ERROR, "PV not found"), ret);
     }
-    testDiag("createChannel %s %p", channelName.c_str(), ret.get());
+    TRACE(("createChannel %s %p", channelName.c_str(), ret.get()));
     return ret;
 }
 
@@ -581,7 +712,7 @@ TestProvider::addPV(const std::string& name, const pvd::StructureConstPtr& tdef)
 void TestProvider::dispatch()
 {
     Guard G(lock);
-    testDiag("TestProvider::dispatch");
+    TRACE(("TestProvider::dispatch"));
 
     pvs_t::lock_vector_type allpvs(pvs.lock_vector());
     FOREACH(pvs_t::lock_vector_type::const_iterator, pvit, pvend, allpvs)
@@ -605,7 +736,7 @@ void TestProvider::dispatch()
                     continue;
 
                 if(mon->needWakeup) {
-                    testDiag("  wakeup monitor %p", mon);
+                    TRACE(("  wakeup monitor %p", mon));
                     mon->needWakeup = false;
                     pva::MonitorRequester::shared_pointer req(mon->requester.lock());
                     UnGuard U(G);
@@ -628,6 +759,8 @@ void TestProvider::testCounts()
     TESTC(TestPV);
     TESTC(TestPVChannel);
     TESTC(TestPVMonitor);
+    TESTC(TestPVGet);
+    TESTC(TestPVPut);
 #undef TESTC
     testOk(ok, "All instances free'd");
 }
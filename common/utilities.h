@@ -19,8 +19,13 @@
 struct TestPV;
 struct TestPVChannel;
 struct TestPVMonitor;
+struct TestPVGet;
+struct TestPVPut;
 struct TestProvider;
 
+// set non-zero to silence the testDiag() trace of TestProvider and friends, eg. for benchmarks
+extern int testProviderQuiet;
+
 // minimally useful boilerplate which must appear *everywhere*
 #define DUMBREQUESTER(NAME) \
     virtual std::string getRequesterName() OVERRIDE { return #NAME; }
@@ -200,11 +205,60 @@ struct TestPVChannel : public BaseChannel
 
     virtual void getField(epics::pvAccess::GetFieldRequester::shared_pointer const & requester,std::string const & subField);
 
+    virtual epics::pvAccess::ChannelGet::shared_pointer createChannelGet(
+            epics::pvAccess::ChannelGetRequester::shared_pointer const & channelGetRequester,
+            epics::pvData::PVStructure::shared_pointer const & pvRequest);
+
+    virtual epics::pvAccess::ChannelPut::shared_pointer createChannelPut(
+            epics::pvAccess::ChannelPutRequester::shared_pointer const & channelPutRequester,
+            epics::pvData::PVStructure::shared_pointer const & pvRequest);
+
     virtual epics::pvData::Monitor::shared_pointer createMonitor(
             epics::pvData::MonitorRequester::shared_pointer const & monitorRequester,
             epics::pvData::PVStructure::shared_pointer const & pvRequest);
 };
 
+// get() completes immediately with a copy of TestPV::value
+struct TestPVGet : public epics::pvAccess::ChannelGet
+{
+    POINTER_DEFINITIONS(TestPVGet);
+    std::tr1::weak_ptr<TestPVGet> weakself;
+
+    const std::tr1::shared_ptr<TestPVChannel> channel;
+    const epics::pvAccess::ChannelGetRequester::weak_pointer requester;
+
+    TestPVGet(const std::tr1::shared_ptr<TestPVChannel>& ch,
+              const epics::pvAccess::ChannelGetRequester::shared_pointer& req);
+    virtual ~TestPVGet();
+
+    virtual std::tr1::shared_ptr<epics::pvAccess::Channel> getChannel() { return channel; }
+    virtual void cancel() {}
+    virtual void lastRequest() {}
+    virtual void get();
+};
+
+// put() is applied to TestPV::value immediately.
+// putDone() is delayed until TestPV::completePuts() while TestPV::holdPuts is set
+struct TestPVPut : public epics::pvAccess::ChannelPut
+{
+    POINTER_DEFINITIONS(TestPVPut);
+    std::tr1::weak_ptr<TestPVPut> weakself;
+
+    const std::tr1::shared_ptr<TestPVChannel> channel;
+    const epics::pvAccess::ChannelPutRequester::weak_pointer requester;
+
+    TestPVPut(const std::tr1::shared_ptr<TestPVChannel>& ch,
+              const epics::pvAccess::ChannelPutRequester::shared_pointer& req);
+    virtual ~TestPVPut();
+
+    virtual std::tr1::shared_ptr<epics::pvAccess::Channel> getChannel() { return channel; }
+    virtual void cancel() {}
+    virtual void lastRequest() {}
+    virtual void put(epics::pvData::PVStructure::shared_pointer const & pvPutStructure,
+                     epics::pvData::BitSet::shared_pointer const & putBitSet);
+    virtual void get();
+};
+
 struct TestPVMonitor : public epics::pvData::Monitor
 {
     POINTER_DEFINITIONS(TestPVMonitor);
@@ -247,6 +301,14 @@ struct TestPV
     const epics::pvData::StructureConstPtr dtype;
     epics::pvData::PVStructurePtr value;
 
+    size_t ngets; // # of TestPVGet::get() calls
+    // passed to getDone() by TestPVGet::get() when not empty.  Otherwise all changed
+    epics::pvData::BitSet getChanged;
+    size_t nputs; // # of TestPVPut::put() calls
+
+    bool holdPuts;
+    std::vector<std::tr1::weak_ptr<TestPVPut> > heldPuts;
+
     TestPV(const std::string& name,
            const std::tr1::shared_ptr<TestProvider>& provider,
            const epics::pvData::StructureConstPtr& dtype);
@@ -257,6 +319,9 @@ struct TestPV
 
     void disconnect();
 
+    // call putDone() for all held puts
+    void completePuts();
+
     mutable epicsMutex lock;
 
     typedef weak_set<TestPVChannel> channels_t;
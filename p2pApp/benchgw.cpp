@@ -0,0 +1,283 @@
+/* Load generator for the gateway, in process, with no network.
+ *
+ * Posts updates to TestPVs of a TestProvider, through a GWServerChannelProvider,
+ * to a number of subscribers per PV, and prints one line of JSON, eg.
+ *
+ *   {"pvs":100,"subscribers":10,...,"updates_per_sec":1.2e+06,"copies_per_sec":...,
+ *    "latency_p50_sec":...,"latency_p99_sec":...,"peak_rss_kb":...}
+ *
+ * Latency is from TestPV::post() until the subscriber poll()s the update.
+ */
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <stdlib.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#  include <sys/resource.h>
+#  define HAVE_RUSAGE
+#endif
+
+#include <epicsAtomic.h>
+#include <epicsGetopt.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include <pv/pvAccess.h>
+
+#include "server.h"
+#include "stats.h"
+
+#include "utilities.h"
+
+namespace pvd = epics::pvData;
+namespace pva = epics::pvAccess;
+
+typedef epicsGuard<epicsMutex> Guard;
+
+namespace {
+
+struct Options {
+    size_t npvs, nsubs, nelements, nfields, queueSize;
+    unsigned nworkers;
+    double rate, duration;
+    bool snapshot;
+
+    Options() :npvs(100u), nsubs(10u), nelements(16u), nfields(0u), queueSize(4u)
+      ,nworkers(0u), rate(0.0), duration(5.0), snapshot(false)
+    {}
+} opts;
+
+epicsTime start;
+
+// totals of all Subscribers
+size_t nreceived;
+LatencyHistogram latency;
+
+struct Subscriber : public pvd::MonitorRequester
+{
+    POINTER_DEFINITIONS(Subscriber);
+
+    pvd::MonitorPtr mon;
+
+    virtual ~Subscriber() {}
+
+    virtual std::string getRequesterName() { return "Subscriber"; }
+
+    virtual void monitorConnect(pvd::Status const & status,
+                                pvd::MonitorPtr const & monitor,
+                                pvd::StructureConstPtr const & structure)
+    {
+        if(!status.isSuccess())
+            std::cerr<<"monitorConnect() fails: "<<status.getMessage()<<"\n";
+    }
+
+    virtual void monitorEvent(pvd::MonitorPtr const & monitor)
+    {
+        pvd::MonitorElementPtr elem;
+        while(!!(elem=monitor->poll())) {
+            double posted = elem->pvStructurePtr->getSubFieldT<pvd::PVDouble>("t")->get();
+            if(posted>0.0) { // not the initial update
+                latency.record((epicsTime::getCurrent() - start) - posted);
+                epicsAtomicIncrSizeT(&nreceived);
+            }
+            monitor->release(elem);
+        }
+    }
+
+    virtual void unlisten(pvd::MonitorPtr const & monitor) {}
+};
+
+pvd::PVStructurePtr makeRequest(size_t bsize)
+{
+    pvd::PVStructurePtr ret(pvd::getPVDataCreate()->createPVStructure(pvd::getFieldCreate()->createFieldBuilder()
+                                 ->addNestedStructure("record")
+                                    ->addNestedStructure("_options")
+                                        ->add("queueSize", pvd::pvString)
+                                    ->endNested()
+                                 ->endNested()
+                                 ->createStructure()));
+    ret->getSubFieldT<pvd::PVScalar>("record._options.queueSize")->putFrom<pvd::uint32>(bsize);
+    return ret;
+}
+
+size_t peakRSS()
+{
+#ifdef HAVE_RUSAGE
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage)==0) {
+#  ifdef __APPLE__
+        return usage.ru_maxrss/1024u; // bytes
+#  else
+        return usage.ru_maxrss; // KB
+#  endif
+    }
+#endif
+    return 0u;
+}
+
+void usage(const char *me)
+{
+    std::cerr<<"Usage: "<<me<<" [-p #PVs] [-s #subscribers per PV] [-r updates/sec per PV (0 unlimited)]\n"
+               "       [-n #array elements] [-f #scalar fields] [-t seconds] [-q queueSize]\n"
+               "       [-w #notify workers] [-S (snapshotMonitors)]\n";
+}
+
+void getargs(int argc, char *argv[])
+{
+    int opt;
+    while( (opt=getopt(argc, argv, "p:s:r:n:f:t:q:w:Sh"))!=-1)
+    {
+        switch(opt) {
+        case 'p': opts.npvs = strtoul(optarg, NULL, 0); break;
+        case 's': opts.nsubs = strtoul(optarg, NULL, 0); break;
+        case 'r': opts.rate = strtod(optarg, NULL); break;
+        case 'n': opts.nelements = strtoul(optarg, NULL, 0); break;
+        case 'f': opts.nfields = strtoul(optarg, NULL, 0); break;
+        case 't': opts.duration = strtod(optarg, NULL); break;
+        case 'q': opts.queueSize = strtoul(optarg, NULL, 0); break;
+        case 'w': opts.nworkers = strtoul(optarg, NULL, 0); break;
+        case 'S': opts.snapshot = true; break;
+        default:
+            usage(argv[0]);
+            exit(opt=='h' ? 0 : 1);
+        }
+    }
+    if(!opts.npvs || !opts.nsubs || !opts.queueSize || opts.duration<=0.0) {
+        usage(argv[0]);
+        exit(1);
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    getargs(argc, argv);
+    testProviderQuiet = 1;
+
+    pvd::FieldBuilderPtr builder(pvd::getFieldCreate()->createFieldBuilder()
+                                 ->add("x", pvd::pvULong)
+                                 ->add("t", pvd::pvDouble)
+                                 ->addArray("value", pvd::pvDouble));
+    for(size_t i=0; i<opts.nfields; i++) {
+        std::ostringstream strm;
+        strm<<"f"<<i;
+        builder = builder->add(strm.str(), pvd::pvDouble);
+    }
+    pvd::StructureConstPtr type(builder->createStructure());
+
+    pvd::PVDoubleArray::const_svector payload;
+    {
+        pvd::PVDoubleArray::svector temp(opts.nelements, 1.0);
+        payload = pvd::freeze(temp);
+    }
+
+    TestProvider::shared_pointer upstream(new TestProvider());
+    std::vector<TestPV::shared_pointer> pvs(opts.npvs);
+    pvd::BitSet changed;
+    for(size_t i=0; i<opts.npvs; i++) {
+        std::ostringstream strm;
+        strm<<"bench:"<<i;
+        pvs[i] = upstream->addPV(strm.str(), type);
+        pvs[i]->value->getSubFieldT<pvd::PVDoubleArray>("value")->replace(payload);
+    }
+    changed.set(pvs[0]->value->getSubFieldT<pvd::PVField>("x")->getFieldOffset());
+    changed.set(pvs[0]->value->getSubFieldT<pvd::PVField>("t")->getFieldOffset());
+    changed.set(pvs[0]->value->getSubFieldT<pvd::PVField>("value")->getFieldOffset());
+
+    GWServerChannelProvider::shared_pointer gateway(new GWServerChannelProvider(upstream, ChannelCache::createInline));
+    gateway->cache.snapshotMonitors = opts.snapshot;
+    if(opts.nworkers)
+        gateway->cache.notifier.start(opts.nworkers);
+
+    std::vector<pva::Channel::shared_pointer> channels(opts.npvs);
+    std::vector<Subscriber::shared_pointer> subs;
+    subs.reserve(opts.npvs*opts.nsubs);
+    pvd::PVStructurePtr request(makeRequest(opts.queueSize));
+
+    for(size_t i=0; i<opts.npvs; i++) {
+        TestChannelRequester::shared_pointer creq(new TestChannelRequester);
+        channels[i] = gateway->createChannel(pvs[i]->name, creq);
+        if(!channels[i]) {
+            std::cerr<<"Failed to create channel "<<pvs[i]->name<<"\n";
+            return 1;
+        }
+        for(size_t j=0; j<opts.nsubs; j++) {
+            Subscriber::shared_pointer sub(new Subscriber);
+            sub->mon = channels[i]->createMonitor(sub, request);
+            if(!sub->mon || !sub->mon->start().isSuccess()) {
+                std::cerr<<"Failed to start monitor of "<<pvs[i]->name<<"\n";
+                return 1;
+            }
+            subs.push_back(sub);
+        }
+    }
+    upstream->dispatch(); // initial updates
+
+    start = epicsTime::getCurrent();
+    size_t rounds = 0u;
+    double elapsed;
+
+    while((elapsed = epicsTime::getCurrent() - start) < opts.duration) {
+        for(size_t i=0; i<opts.npvs; i++) {
+            TestPV& pv = *pvs[i];
+            {
+                Guard G(pv.lock);
+                pv.value->getSubFieldT<pvd::PVULong>("x")->put(rounds);
+                pv.value->getSubFieldT<pvd::PVDouble>("t")->put(epicsTime::getCurrent() - start);
+            }
+            pv.post(changed);
+        }
+        rounds++;
+
+        if(opts.rate>0.0) {
+            double wait = rounds/opts.rate - (epicsTime::getCurrent() - start);
+            if(wait>0.0)
+                epicsThreadSleep(wait);
+        }
+    }
+
+    // wait for notify workers to finish delivery
+    for(size_t prev = (size_t)-1, cur; (cur = epicsAtomicGetSizeT(&nreceived))!=prev; prev = cur)
+        epicsThreadSleep(0.1);
+
+    const CacheStats& stats = gateway->cache.stats;
+    size_t posted = rounds*opts.npvs,
+           received = epicsAtomicGetSizeT(&nreceived),
+           // into MonitorCacheEntry::lastelem, then each MonitorUser queue unless shared snapshots
+           copies = stats.upstreamEvents.get() + (opts.snapshot ? 0u : stats.downstreamEvents.get());
+
+    std::cout<<"{\"pvs\":"<<opts.npvs
+             <<",\"subscribers\":"<<opts.nsubs
+             <<",\"rate\":"<<opts.rate
+             <<",\"elements\":"<<opts.nelements
+             <<",\"fields\":"<<opts.nfields
+             <<",\"queue_size\":"<<opts.queueSize
+             <<",\"workers\":"<<opts.nworkers
+             <<",\"snapshot\":"<<(opts.snapshot ? "true" : "false")
+             <<",\"seconds\":"<<elapsed
+             <<",\"posted\":"<<posted
+             <<",\"received\":"<<received
+             <<",\"drops\":"<<stats.downstreamDrops.get()
+             <<",\"copies\":"<<copies
+             <<",\"updates_per_sec\":"<<received/elapsed
+             <<",\"copies_per_sec\":"<<copies/elapsed
+             <<",\"latency_p50_sec\":"<<latency.quantile(0.5)
+             <<",\"latency_p99_sec\":"<<latency.quantile(0.99)
+             <<",\"latency_max_sec\":"<<latency.max()
+             <<",\"gateway_latency_p50_sec\":"<<stats.latency.quantile(0.5)
+             <<",\"gateway_latency_p99_sec\":"<<stats.latency.quantile(0.99)
+             <<",\"peak_rss_kb\":"<<peakRSS()
+             <<"}\n";
+
+    for(size_t i=0; i<subs.size(); i++)
+        subs[i]->mon->destroy();
+    subs.clear();
+    for(size_t i=0; i<channels.size(); i++)
+        channels[i]->destroy();
+    channels.clear();
+    gateway.reset();
+
+    return 0;
+}
@@ -1,6 +1,9 @@
 #include <stdio.h>
 
+#include <algorithm>
+
 #include <epicsAtomic.h>
+#include <epicsString.h>
 #include <errlog.h>
 
 #include <epicsMutex.h>
@@ -22,14 +25,16 @@ namespace pva = epics::pvAccess;
 size_t ChannelCacheEntry::num_instances;
 
 ChannelCacheEntry::ChannelCacheEntry(ChannelCache* c, const std::string& n)
-    :channelName(n), cache(c), dropPoke(true)
+    :channelName(n), cache(c), connected(false)
+    ,lruPrev(0), lruNext(0)
+    ,fieldgen(0u), nfieldhits(0u), nfieldmisses(0u)
 {
     epicsAtomicIncrSizeT(&num_instances);
 }
 
 ChannelCacheEntry::~ChannelCacheEntry()
 {
-    // Should *not* be holding cache->cacheLock
+    // Should *not* be holding cache->shardOf(channelName).mutex
     if(channel.get())
         channel->destroy(); // calls channelStateChange() w/ DESTROY
     epicsAtomicDecrSizeT(&num_instances);
@@ -69,140 +74,504 @@ ChannelCacheEntry::CRequester::channelStateChange(pva::Channel::shared_pointer c
         return;
 
     {
-        Guard G(chan->cache->cacheLock);
+        ChannelCache::Shard& shard = chan->cache->shardOf(chan->channelName);
+        ChannelCache::Shard::guard_type G(shard);
 
-        assert(chan->channel.get()==channel.get());
+        // may be called before createChannel() returns
+        assert(!chan->channel || chan->channel.get()==channel.get());
 
         switch(connectionState)
         {
+        case pva::Channel::CONNECTED:
+            chan->connected = true;
+            break;
         case pva::Channel::DISCONNECTED:
         case pva::Channel::DESTROYED:
-            // Drop from cache
-            chan->cache->entries.erase(chan->channelName);
-            // keep 'chan' as a reference so that actual destruction doesn't happen which cacheLock is held
+        {
+            chan->connected = false;
+            // Drop from cache, unless already replaced
+            ChannelCache::entries_t::iterator it(shard.entries.find(chan->channelName));
+            if(it!=shard.entries.end() && it->second==chan)
+                shard.erase(it);
+            // keep 'chan' as a reference so that actual destruction doesn't happen while shard is locked
+        }
             break;
         default:
             break;
         }
     }
 
+    {
+        // type may change on reconnect
+        Guard G(chan->mutex());
+        chan->fieldtype.reset();
+        chan->fieldgen++;
+    }
+
     // fanout notification
-    ChannelCacheEntry::interested_t::vector_type interested(chan->interested.lock_vector()); // Copy
+    ChannelCacheEntry::interested_t::snapshot_pointer interested(chan->interested.snapshot()); // shared, not copied
 
-    FOREACH(ChannelCacheEntry::interested_t::vector_type::const_iterator, it, end, interested)
+    FOREACH(ChannelCacheEntry::interested_t::snapshot_type::const_iterator, it, end, *interested)
     {
-        GWChannel *chan = it->get();
+        GWChannel::shared_pointer chan(it->lock());
+        if(!chan)
+            continue;
         pva::ChannelRequester::shared_pointer req(chan->requester.lock());
         if(req)
-            req->channelStateChange(*it, connectionState);
+            req->channelStateChange(chan, connectionState);
     }
 }
 
 
+void
+ChannelCache::Shard::add(const ChannelCacheEntry::shared_pointer& ent, const epicsTime& now)
+{
+    entries[ent->channelName] = ent;
+    ent->lastUsed = now;
+    ent->lruPrev = lruTail;
+    ent->lruNext = 0;
+    if(lruTail)
+        lruTail->lruNext = ent.get();
+    else
+        lruHead = ent.get();
+    lruTail = ent.get();
+}
+
+void
+ChannelCache::Shard::unlink(ChannelCacheEntry *ent)
+{
+    if(ent->lruPrev)
+        ent->lruPrev->lruNext = ent->lruNext;
+    else
+        lruHead = ent->lruNext;
+    if(ent->lruNext)
+        ent->lruNext->lruPrev = ent->lruPrev;
+    else
+        lruTail = ent->lruPrev;
+    ent->lruPrev = ent->lruNext = 0;
+}
+
+void
+ChannelCache::Shard::erase(entries_t::iterator it)
+{
+    unlink(it->second.get());
+    entries.erase(it);
+}
+
+void
+ChannelCache::Shard::touch(ChannelCacheEntry *ent, const epicsTime& now)
+{
+    ent->lastUsed = now;
+    if(ent==lruTail)
+        return;
+    unlink(ent);
+    ent->lruPrev = lruTail;
+    lruTail->lruNext = ent;
+    lruTail = ent;
+}
+
+// Closes a bounded number of idle entries once per second,
+// so that neither shard locks, nor upstream destroy()s, come in bursts.
 struct ChannelCache::cacheClean : public epicsTimerNotify
 {
     ChannelCache *cache;
     cacheClean(ChannelCache *c) : cache(c) {}
     epicsTimerNotify::expireStatus expire(const epicsTime &currentTime)
     {
-        // keep a reference to any cache entrys being removed so they
-        // aren't destroyed while cacheLock is held
-        std::set<ChannelCacheEntry::shared_pointer> cleaned;
+        cache->clean(currentTime);
+        return epicsTimerNotify::expireStatus(epicsTimerNotify::restart, 1.0);
+    }
+};
+
+// Takes batches of new entries and calls createChannel() for each.
+// Runs on a createQueue worker, so that searches are not delayed by a slow provider.
+struct ChannelCache::Creator : public epicsThreadRunable
+{
+    ChannelCache * const cache;
+
+    epicsMutex mutex;
+    // guarded by mutex
+    bool queued; // added to createQueue
+    typedef std::deque<ChannelCacheEntry::weak_pointer> pending_t;
+    pending_t pending;
+
+    size_t ncreated; // atomic
+    size_t nbatches; // atomic
+
+    enum {maxBatch = 32};
+
+    Creator(ChannelCache *c) :cache(c), queued(false), ncreated(0), nbatches(0) {}
+    virtual ~Creator() {}
 
+    void add(const ChannelCacheEntry::shared_pointer& ent)
+    {
+        bool wakeup;
         {
-            Guard G(cache->cacheLock);
-            cache->cleanerRuns++;
-
-            ChannelCache::entries_t::iterator cur=cache->entries.begin(), next, end=cache->entries.end();
-            while(cur!=end) {
-                next = cur;
-                ++next;
-
-                if(!cur->second->dropPoke && cur->second->interested.empty()) {
-                    cleaned.insert(cur->second);
-                    cache->entries.erase(cur);
-                    cache->cleanerDust++;
-                } else {
-                    cur->second->dropPoke = false;
-                }
+            Guard G(mutex);
+            pending.push_back(ent);
+            wakeup = !queued;
+            queued = true;
+        }
+        if(wakeup)
+            cache->createQueue.add(cache->creator);
+    }
 
-                cur = next;
+    virtual void run()
+    {
+        std::vector<ChannelCacheEntry::shared_pointer> batch;
+        bool again;
+        {
+            Guard G(mutex);
+            batch.reserve(std::min(pending.size(), size_t(maxBatch)));
+            while(!pending.empty() && batch.size()<maxBatch) {
+                ChannelCacheEntry::shared_pointer ent(pending.front().lock());
+                pending.pop_front();
+                if(ent) // skip if cleaned before we got to it
+                    batch.push_back(ent);
+            }
+            queued = again = !pending.empty();
+        }
+
+        if(again) // let another worker take the next batch
+            cache->createQueue.add(cache->creator);
+
+        for(size_t i=0; i<batch.size(); i++) {
+            try {
+                cache->create(batch[i]);
+                epicsAtomicIncrSizeT(&ncreated);
+            }catch(std::exception& e){
+                // entry remains unconnected until cleaned
+                cache->negative.add(batch[i]->channelName);
+                errlogPrintf("p2p: Error creating upstream channel '%s' : %s\n",
+                             batch[i]->channelName.c_str(), e.what());
             }
         }
-        return epicsTimerNotify::expireStatus(epicsTimerNotify::restart, 30.0);
+        epicsAtomicIncrSizeT(&nbatches);
     }
 };
 
-ChannelCache::ChannelCache(const pva::ChannelProvider::shared_pointer& prov)
-    :provider(prov)
+unsigned ChannelCache::creatorThreads(int ncreators)
+{
+    if(ncreators==0)
+        return defaultCreators;
+    return ncreators<0 ? 0u : unsigned(ncreators);
+}
+
+ChannelCache::ChannelCache(const pva::ChannelProvider::shared_pointer& prov,
+                           int ncreators,
+                           size_t nshards)
+    :nshards(nshards ? nshards : 1u)
+    ,shards(new Shard[this->nshards])
+    ,providers(1u, prov)
     ,timerQueue(&epicsTimerQueueActive::allocate(1, epicsThreadPriorityCAServerLow-2))
     ,cleaner(new cacheClean(this))
     ,cleanerRuns(0)
     ,cleanerDust(0)
+    ,idleTimeout(30.0)
+    ,cleanSlice(1000u)
+    ,nextClean(0u)
+    ,fieldHits(0)
+    ,fieldMisses(0)
+    ,createQueue("p2pCreate")
+    ,snapshotMonitors(false)
+    ,monitorFlowControl(false)
 {
-    if(!provider)
+    if(!prov) {
+        delete[] shards;
         throw std::logic_error("Missing 'pva' provider");
+    }
     assert(timerQueue);
     cleanTimer = &timerQueue->createTimer();
-    cleanTimer->start(*cleaner, 30.0);
+    cleanTimer->start(*cleaner, 1.0);
+
+    unsigned nthreads = creatorThreads(ncreators);
+    if(nthreads) {
+        creator.reset(new Creator(this));
+        createQueue.start(nthreads, epicsThreadPriorityCAServerLow);
+    }
 }
 
 ChannelCache::~ChannelCache()
 {
-    entries_t E;
-    {
-        Guard G(cacheLock);
+    notifier.close(); // joins workers
+    flusher.close();
 
-        cleanTimer->destroy();
-        timerQueue->release();
-        delete cleaner;
+    createQueue.close(); // joins workers
+    creator.reset();
 
+    cleanTimer->destroy();
+    timerQueue->release();
+    delete cleaner;
+
+    for(size_t i=0; i<nshards; i++) {
         entries_t E;
-        E.swap(entries);
+        {
+            Shard::guard_type G(shards[i]);
+            E.swap(shards[i].entries);
+            shards[i].lruHead = shards[i].lruTail = 0;
+        }
+        // destroy entries w/o holding the shard lock
+    }
+
+    delete[] shards;
+}
+
+ChannelCache::Shard&
+ChannelCache::shardOf(const std::string& name)
+{
+    return shards[epicsMemHash(name.c_str(), name.size(), 0) % nshards];
+}
+
+void
+ChannelCache::addProvider(const pva::ChannelProvider::shared_pointer& prov)
+{
+    if(!prov)
+        throw std::logic_error("Missing provider");
+    providers.push_back(prov);
+}
+
+size_t
+ChannelCache::providerIndex(const std::string& name) const
+{
+    if(providers.size()==1u)
+        return 0u;
+    // different seed than shardOf() so that the shards of each context are not correlated
+    return epicsMemHash(name.c_str(), name.size(), 0x5a5a5a5a) % providers.size();
+}
+
+bool
+ChannelCache::create(const ChannelCacheEntry::shared_pointer& ent)
+{
+    pva::Channel::shared_pointer M(providers[providerIndex(ent->channelName)]->createChannel(ent->channelName, ent->requester));
+    if(!M)
+        THROW_EXCEPTION2(std::runtime_error, "Failed to createChannel");
+
+    bool conn = M->isConnected();
+
+    Shard::guard_type G(shardOf(ent->channelName));
+    ent->channel = M;
+    ent->connected |= conn;
+    return ent->connected;
+}
+
+size_t
+ChannelCache::clean(const epicsTime& now)
+{
+    // keep a reference to any cache entrys being removed so they
+    // aren't destroyed while the shard is locked
+    std::vector<ChannelCacheEntry::shared_pointer> cleaned;
+
+    {
+        Guard C(cleanMutex);
+
+        size_t budget = cleanSlice;
+
+        // start where the last slice ran out, so that no shard is starved
+        for(size_t n=0; n<nshards && budget; n++) {
+            Shard& shard = shards[nextClean];
+            nextClean = (nextClean+1u)%nshards;
+
+            Shard::guard_type G(shard);
+
+            // least recently used first, so stop at the first entry which isn't idle
+            while(budget && shard.lruHead && now - shard.lruHead->lastUsed >= idleTimeout) {
+                ChannelCacheEntry *ent = shard.lruHead;
+                budget--;
+
+                if(!ent->interested.empty()) {
+                    shard.touch(ent, now);
+                    continue;
+                }
+
+                entries_t::iterator it(shard.entries.find(ent->channelName));
+                assert(it!=shard.entries.end() && it->second.get()==ent);
+
+                if(!ent->connected)
+                    negative.add(ent->channelName);
+                cleaned.push_back(it->second);
+                shard.erase(it);
+            }
+        }
+    }
+
+    epicsAtomicAddSizeT(&cleanerDust, cleaned.size());
+    epicsAtomicIncrSizeT(&cleanerRuns);
+    limiter.prune();
+
+    return cleaned.size();
+}
+
+void
+ChannelCache::createStats(size_t& npending, size_t& ncreated, size_t& nbatches)
+{
+    npending = ncreated = nbatches = 0u;
+    if(creator) {
+        {
+            Guard G(creator->mutex);
+            npending = creator->pending.size();
+        }
+        ncreated = epicsAtomicGetSizeT(&creator->ncreated);
+        nbatches = epicsAtomicGetSizeT(&creator->nbatches);
+    }
+}
+
+bool
+ChannelCache::NegativeCache::test(const std::string& name)
+{
+    if(!capacity)
+        return false;
+
+    Guard G(mutex);
+
+    index_t::iterator it(index.find(name));
+    if(it==index.end()) {
+        nmisses++;
+        return false;
+
+    } else if(it->second->second < epicsTime::getCurrent()) {
+        // expired
+        lru.erase(it->second);
+        index.erase(it);
+        nmisses++;
+        return false;
+
+    } else {
+        // move to most recently used
+        lru.splice(lru.end(), lru, it->second);
+        nhits++;
+        return true;
+    }
+}
+
+void
+ChannelCache::NegativeCache::add(const std::string& name)
+{
+    if(!capacity)
+        return;
+
+    epicsTime expire(epicsTime::getCurrent() + ttl);
+
+    Guard G(mutex);
+
+    index_t::iterator it(index.find(name));
+    if(it!=index.end()) {
+        it->second->second = expire;
+        lru.splice(lru.end(), lru, it->second);
+        return;
+    }
+
+    while(index.size()>=capacity) {
+        // evict least recently used
+        index.erase(lru.front().first);
+        lru.pop_front();
+    }
+
+    lru.push_back(std::make_pair(name, expire));
+    index[name] = --lru.end();
+}
+
+bool
+ChannelCache::SearchLimiter::allow(const std::string& peer)
+{
+    if(rate<=0.0)
+        return true;
+
+    // ignore port, which varies with each client process
+    std::string host(peer.substr(0, peer.find_last_of(':')));
+    epicsTime now(epicsTime::getCurrent());
+
+    Guard G(mutex);
+
+    buckets_t::iterator it(buckets.find(host));
+    if(it==buckets.end()) {
+        Bucket B;
+        B.tokens = burst;
+        B.last = now;
+        it = buckets.insert(std::make_pair(host, B)).first;
+
+    } else {
+        Bucket& B = it->second;
+        B.tokens = std::min(burst, B.tokens + rate*(now - B.last));
+        B.last = now;
+    }
+
+    if(it->second.tokens >= 1.0) {
+        it->second.tokens -= 1.0;
+        return true;
+    } else {
+        ndropped++;
+        return false;
+    }
+}
+
+void
+ChannelCache::SearchLimiter::prune()
+{
+    if(rate<=0.0)
+        return;
+
+    epicsTime now(epicsTime::getCurrent());
+
+    Guard G(mutex);
+
+    buckets_t::iterator it(buckets.begin()), end(buckets.end());
+    while(it!=end) {
+        buckets_t::iterator cur(it++);
+        if(cur->second.tokens + rate*(now - cur->second.last) >= burst)
+            buckets.erase(cur);
     }
 }
 
 ChannelCacheEntry::shared_pointer
-ChannelCache::lookup(const std::string& newName)
+ChannelCache::lookup(const std::string& newName, const std::string& peer)
 {
     ChannelCacheEntry::shared_pointer ret;
 
-    Guard G(cacheLock);
+    Shard& shard = shardOf(newName);
+    Shard::guard_type G(shard);
+
+    entries_t::const_iterator it = shard.entries.find(newName);
 
-    entries_t::const_iterator it = entries.find(newName);
+    if(it==shard.entries.end()) {
+        if(negative.test(newName))
+            return ret; // recently not found
+
+        if(!peer.empty() && !limiter.allow(peer))
+            return ret; // this client is searching for too many new names
 
-    if(it==entries.end()) {
         // first request, create ChannelCacheEntry
-        //TODO: async lookup
 
         ChannelCacheEntry::shared_pointer ent(new ChannelCacheEntry(this, newName));
         ent->requester.reset(new ChannelCacheEntry::CRequester(ent));
 
-        entries[newName] = ent;
+        shard.add(ent, epicsTime::getCurrent());
 
-        pva::Channel::shared_pointer M;
-        {
-            // unlock to call createChannel()
-            epicsGuardRelease<epicsMutex> U(G);
+        if(creator) {
+            // a worker will createChannel(), and a later search will find it connected
+            creator->add(ent);
 
-            M = provider->createChannel(newName, ent->requester);
-            if(!M)
-                THROW_EXCEPTION2(std::runtime_error, "Failed to createChannel");
-        }
-        ent->channel = M;
+        } else {
+            bool conn;
+            {
+                // unlock to call createChannel()
+                Shard::release_type U(G);
+
+                conn = create(ent);
+            }
 
-        if(M->isConnected())
-            ret = ent; // immediate connect, mostly for unit-tests (thus delayed connect not covered)
+            if(conn)
+                ret = ent; // immediate connect, mostly for unit-tests (thus delayed connect not covered)
+        }
 
-    } else if(it->second->channel && it->second->channel->isConnected()) {
+    } else if(it->second->connected && it->second->channel) {
         // another request, and hey we're connected this time
 
         ret = it->second;
-        it->second->dropPoke = true;
+        shard.touch(it->second.get(), epicsTime::getCurrent());
 
     } else {
         // not connected yet, but a client is still interested
-        it->second->dropPoke = true;
+        shard.touch(it->second.get(), epicsTime::getCurrent());
     }
 
     return ret;
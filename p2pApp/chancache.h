@@ -4,7 +4,9 @@
 #include <string>
 #include <map>
 #include <set>
+#include <list>
 #include <deque>
+#include <vector>
 
 #include <epicsMutex.h>
 #include <epicsTimer.h>
@@ -13,40 +15,198 @@
 
 #include "weakmap.h"
 #include "weakset.h"
+#include "tpool.h"
+#include "stats.h"
 
 struct ChannelCache;
 struct ChannelCacheEntry;
 struct MonitorUser;
+struct GetUser;
 struct GWChannel;
 
-struct MonitorCacheEntry : public epics::pvData::MonitorRequester
+//! Totals for all channels of a ChannelCache, which outlive individual monitors.
+struct CacheStats
+{
+    StatCounter upstreamWakeups;   // MonitorCacheEntry::monitorEvent() calls
+    StatCounter upstreamEvents;    // updates poll()'d from upstream
+    StatCounter downstreamEvents;  // updates queued to MonitorUsers
+    StatCounter downstreamWakeups; // MonitorRequester::monitorEvent() calls
+    StatCounter downstreamDrops;   // updates squashed or discarded
+    StatCounter suppressed;        // updates inside deadband
+    StatCounter decimated;         // updates held back by rate limit
+    LatencyHistogram latency;      // from upstream monitorEvent() to downstream poll()
+    ByteHistogram bytes;           // updateBytes() of updates poll()'d from upstream
+};
+
+/** Delivers MonitorUser wakeups (MonitorRequester::monitorEvent())
+ * from worker threads, so that a slow downstream does not delay
+ * the upstream client RX thread.
+ */
+struct MonitorNotifier
+{
+    WorkQueue queue;
+
+    epicsMutex mutex;
+    // guarded by mutex
+    bool active; // between start() and close()
+    size_t depth, maxDepth; // # of wakeups queued
+    size_t nqueued;    // total # of wakeups queued
+    size_t ncoalesced; // # of wakeups merged into one already queued
+    double maxLatency; // longest time (sec.) from queue to delivery
+
+    MonitorNotifier();
+
+    //! Start worker threads.  Until called, wakeups are delivered
+    //! from the thread which queues an update.
+    void start(unsigned nworkers);
+    void close();
+
+    //! @returns false if not active, when the caller must deliver the wakeup itself
+    bool add(const WorkQueue::value_type& usr);
+};
+
+/** Delivers updates held back by MonitorPolicy::maxRate when they become due.
+ *
+ * A timer wheel of nslots slots, each 'tick' seconds long, turned by a worker
+ * thread which is started by the first add(), and only wakes while something is pending.
+ * Waits longer than one turn of the wheel are re-checked on each turn.
+ */
+struct MonitorFlusher : private epicsThreadRunable
+{
+    static const double tick;
+    enum {nslots = 64};
+
+    epicsMutex mutex;
+    // guarded by mutex
+    typedef std::vector<std::pair<epicsTime, std::tr1::weak_ptr<MonitorUser> > > slot_t;
+    slot_t slots[nslots];
+    const epicsTime epoch; // start of tick zero
+    size_t lastTick; // last tick processed
+    size_t pending;  // # of entries in all slots
+    bool stopping;
+    size_t nflushed; // total # of flush()es
+
+    MonitorFlusher();
+    virtual ~MonitorFlusher();
+
+    //! Stop worker.  Pending flush()es are forgotten
+    void close();
+
+    //! Call usr->flush() at, or soon after, due
+    void add(const std::tr1::shared_ptr<MonitorUser>& usr, const epicsTime& due);
+
+private:
+    epicsEvent wakeup;
+    epicsThread *worker;
+
+    size_t tickOf(const epicsTime& t) const;
+    virtual void run();
+};
+
+/** Deadband filter on the 'value' field of a subscription.
+ *
+ * An update is suppressed when the only fields it changes are 'value',
+ * by no more than the larger of 'abs' and 'rel' times the last delivered value,
+ * and 'alarm' or 'timeStamp' which are not passed.
+ */
+struct Deadband
+{
+    double abs; // absolute deadband in units of value.  zero to disable
+    double rel; // relative deadband as a fraction of the last delivered value.  zero to disable
+    bool passAlarm; // alarm changes are delivered
+    bool passTimeStamp; // timeStamp changes are delivered
+
+    Deadband() :abs(0.0), rel(0.0), passAlarm(true), passTimeStamp(false) {}
+
+    inline bool enabled() const { return abs>0.0 || rel>0.0; }
+
+    //! Set passAlarm and passTimeStamp from "alarm" (or ""), "all", or "none"
+    //! @returns false if pass is not recognized
+    bool parsePass(const std::string& pass);
+};
+
+/** Server side settings for the downstream subscriptions of a server
+ * which match a channel name and client address.
+ */
+struct MonitorPolicy
+{
+    POINTER_DEFINITIONS(MonitorPolicy);
+
+    std::string name;
+    std::string channel; // glob pattern of channel name.  empty matches all
+    std::string client;  // glob pattern of client host:port.  empty matches all
+    size_t queueSize;    // zero to use record._options.queueSize
+    bool dropOldest;     // when the queue is full discard the oldest update.  Otherwise squash into the newest
+    double maxRate;      // max. updates per second to each subscription.  zero for no limit
+    Deadband deadband;   // unless the pvRequest gives one
+
+    // atomic
+    size_t nusers;     // # of subscriptions created with this policy
+    size_t nsquashed;  // # of updates squashed into the newest
+    size_t ndropped;   // # of oldest updates discarded
+    size_t ndecimated; // # of updates held back by maxRate
+    size_t nsuppressed; // # of updates inside deadband
+
+    MonitorPolicy() :queueSize(0u), dropOldest(false), maxRate(0.0), nusers(0u), nsquashed(0u), ndropped(0u), ndecimated(0u), nsuppressed(0u) {}
+
+    bool match(const std::string& channelName, const std::string& peer) const;
+};
+
+struct MonitorCacheEntry : public epics::pvData::MonitorRequester,
+                           public epicsThreadRunable
 {
     POINTER_DEFINITIONS(MonitorCacheEntry);
     static size_t num_instances;
     weak_pointer weakref;
 
     ChannelCacheEntry * const chan;
+    MonitorNotifier * const notifier;
+    MonitorFlusher * const flusher;
+    CacheStats * const stats;
 
     const size_t bufferSize; // DS requested buffer size
+    // When set, all MonitorUsers share one immutable copy of each update.
+    // Otherwise each MonitorUser has private copies.
+    const bool snapshot;
+    // When set, stop poll()ing upstream while no MonitorUser has a free element
+    const bool flowControl;
 
     // to avoid yet another mutex borrow interested.mutex() for our members
     inline epicsMutex& mutex() const { return interested.mutex(); }
 
     typedef std::vector<epicsUInt8> pvrequest_t;
 
+    //! Serialized "field" of a pvRequest, the selection of fields.  Empty when all are selected
+    static pvrequest_t fieldRequest(const epics::pvData::PVStructurePtr& pvRequest);
+    const pvrequest_t fieldreq; // fieldRequest() of upstream pvRequest
+
     bool havedata; // set when initial update is received
     bool done;     // set when unlisten() is received
     size_t nwakeups; // # of upstream monitorEvent() calls
     size_t nevents;  // # of upstream events poll()'d
+    size_t nblocked; // # of times flow control stopped poll()ing
+    bool resumeQueued; // resume() has queued run() to the MonitorNotifier
+    epicsTime ingestTime; // when lastelem was last updated
+    LatencyHistogram latency; // from monitorEvent() to MonitorUser::poll()
+    ByteHistogram bytes;      // updateBytes() of upstream updates
 
     epics::pvData::StructureConstPtr typedesc;
     /** value of upstream monitor (accumulation of all deltas)
      *  changed/overflow bit masks of last delta
      */
     epics::pvData::MonitorElement::shared_pointer lastelem;
+    // immutable copy of lastelem->pvStructurePtr.  created on demand when snapshot==true
+    epics::pvData::PVStructurePtr lastsnap;
     epics::pvData::MonitorPtr mon;
+    // flow control.  Monitor passed to monitorEvent() while we are not poll()ing it
+    epics::pvData::MonitorPtr blocked;
     epics::pvData::Status startresult;
 
+    // for Deadband.  set by monitorConnect() when 'value' is a numeric scalar.  Field of lastelem
+    epics::pvData::PVScalarPtr valueField;
+    // field offsets of alarm and timeStamp as [begin, end).  empty if not present
+    size_t alarmBegin, alarmEnd, timeBegin, timeEnd;
+
     typedef weak_set<MonitorUser> interested_t;
     interested_t interested;
 
@@ -60,9 +220,140 @@ struct MonitorCacheEntry : public epics::pvData::MonitorRequester
     virtual void unlisten(epics::pvData::MonitorPtr const & monitor);
 
     virtual std::string getRequesterName();
+
+    //! flow control.  poll() upstream again if blocked.  Call with no locks held.
+    //! When the MonitorNotifier is active, this is done by a worker, not by the caller
+    void resume();
+    //! from MonitorNotifier worker
+    virtual void run();
+
+    //! current value as an immutable structure, which may be shared
+    //! @pre mutex() is locked, lastelem!=NULL
+    const epics::pvData::PVStructurePtr& getSnapshot();
 };
 
-struct MonitorUser : public epics::pvData::Monitor
+/** Fixed capacity queue of MonitorElements.
+ *
+ * Each element is held by a numbered slot, and the slot is either free,
+ * filled (waiting for poll()), or out (poll()'d but not release()'d).
+ * Out and filled slot #s are kept in one ring, in the order they were filled.
+ * Out slots are at the head, followed by filled slots.
+ * Downstream normally release()s in the order it poll()s,
+ * so all operations are O(1) and do not allocate.
+ *
+ * Not thread safe.  Guarded by MonitorUser::mutex()
+ */
+struct MonitorSlots
+{
+    static const size_t npos = (size_t)-1;
+
+private:
+    std::vector<epics::pvData::MonitorElementPtr> slots;
+    std::vector<epicsTime> stamps; // ingest time of each filled slot
+    std::vector<size_t> freelist; // stack of free slot #s
+    std::vector<size_t> ring;     // out slot #s, then filled slot #s
+    size_t head, nout, nfilled;
+
+    inline size_t& at(size_t n) { return ring[(head+n)%ring.size()]; }
+    inline size_t at(size_t n) const { return ring[(head+n)%ring.size()]; }
+public:
+    MonitorSlots() :head(0u), nout(0u), nfilled(0u) {}
+
+    //! Allocate n (initially free and NULL) slots.  Only call once.
+    void resize(size_t n) {
+        slots.resize(n);
+        stamps.resize(n);
+        ring.resize(n);
+        freelist.reserve(n);
+        for(size_t i=n; i; i--)
+            freelist.push_back(i-1);
+    }
+
+    inline size_t capacity() const { return slots.size(); }
+    inline size_t numFree() const { return freelist.size(); }
+    inline size_t numFilled() const { return nfilled; }
+    inline size_t numOut() const { return nout; }
+
+    inline epics::pvData::MonitorElementPtr& operator[](size_t i) { return slots[i]; }
+    //! ingest time of the (oldest) update in slot i.  Set when filled
+    inline epicsTime& stamp(size_t i) { return stamps[i]; }
+
+    //! slot # which fill() will fill next.  @pre numFree()>0
+    inline size_t nextFree() const { return freelist.back(); }
+
+    //! Move nextFree() to the end of the filled ring
+    void fill() {
+        at(nout+nfilled) = freelist.back();
+        freelist.pop_back();
+        nfilled++;
+    }
+
+    //! Take the oldest filled element, or NULL.  Its stamp() is stored in *when
+    epics::pvData::MonitorElementPtr poll(epicsTime *when = 0) {
+        epics::pvData::MonitorElementPtr ret;
+        if(nfilled) {
+            ret = slots[at(nout)];
+            if(when)
+                *when = stamps[at(nout)];
+            nout++;
+            nfilled--;
+        }
+        return ret;
+    }
+
+    //! @returns the slot # of an element which is out, or npos if elem isn't one of ours
+    size_t find(const epics::pvData::MonitorElementPtr& elem) const {
+        for(size_t n=0; n<nout; n++) { // first iteration matches when release()d in order
+            if(slots[at(n)]==elem)
+                return at(n);
+        }
+        return npos;
+    }
+
+    //! Return slot i, which is out, to the free list
+    void release(size_t i) {
+        remove(i);
+        freelist.push_back(i);
+    }
+
+    //! Move slot i, which is out, to the end of the filled ring
+    void refill(size_t i) {
+        remove(i);
+        at(nout+nfilled) = i;
+        nfilled++;
+    }
+
+    //! Move the oldest filled slot to the end of the filled ring, to be filled again.
+    //! O(numFilled()), only used to discard the oldest update from a full queue.
+    //! @pre numFilled()>0
+    //! @returns the slot #
+    size_t recycle() {
+        size_t i = at(nout);
+        for(size_t n=nout+1u; n<nout+nfilled; n++)
+            at(n-1u) = at(n);
+        at(nout+nfilled-1u) = i;
+        return i;
+    }
+
+    //! The oldest filled element.  @pre numFilled()>0
+    inline epics::pvData::MonitorElementPtr& oldest() { return slots[at(nout)]; }
+    inline epicsTime& oldestStamp() { return stamps[at(nout)]; }
+
+private:
+    void remove(size_t i) {
+        size_t n=0;
+        while(at(n)!=i)
+            n++;
+        // close the gap.  no-op when i is the oldest.
+        for(; n; n--)
+            at(n) = at(n-1);
+        head = (head+1)%ring.size();
+        nout--;
+    }
+};
+
+struct MonitorUser : public epics::pvData::Monitor,
+                     public epicsThreadRunable
 {
     POINTER_DEFINITIONS(MonitorUser);
     static size_t num_instances;
@@ -81,13 +372,40 @@ struct MonitorUser : public epics::pvData::Monitor
     size_t nwakeups; // # of monitorEvent() calls to req
     size_t nevents;  // total # events queued
     size_t ndropped; // # of events drop because our queue was full
-
-    std::deque<epics::pvData::MonitorElementPtr> filled, empty;
+    bool notifyQueued; // wakeup waiting in notifier
+    epicsTime notifyTime; // when notifyQueued was set
+
+    // may be NULL
+    const MonitorPolicy::shared_pointer policy;
+    // rate limit from policy or record._options.maxRate.  seconds between updates, or zero
+    const double minInterval;
+    // updates are being held back in overflowElement, until MonitorFlusher calls flush()
+    bool held;
+    bool flushScheduled; // added to MonitorFlusher
+    epicsTime lastSent; // when last update was queued
+
+    const Deadband deadband;
+    bool haveLastValue;
+    double lastValue; // last delivered value, for deadband
+    size_t nsuppressed; // # of updates inside deadband
+
+    // when entry->snapshot, free slots are NULL
+    MonitorSlots queue;
+#ifdef P2P_TRACK_INUSE
     std::set<epics::pvData::MonitorElementPtr> inuse;
+#endif
 
     epics::pvData::MonitorElementPtr overflowElement;
-
-    MonitorUser(const MonitorCacheEntry::shared_pointer&);
+    epicsTime overflowStamp; // ingest time of the oldest update accumulated in overflowElement
+    // when entry->snapshot, private elements (former overflowElements) release()d by downstream.
+    // re-used as overflowElement.  At most one per slot
+    std::vector<epics::pvData::MonitorElementPtr> spares;
+
+    //! @param maxRate from the downstream pvRequest.  The lower of this and policy->maxRate applies
+    MonitorUser(const MonitorCacheEntry::shared_pointer&,
+                const MonitorPolicy::shared_pointer& policy = MonitorPolicy::shared_pointer(),
+                double maxRate = 0.0,
+                const Deadband& deadband = Deadband());
     virtual ~MonitorUser();
 
     virtual void destroy();
@@ -98,6 +416,185 @@ struct MonitorUser : public epics::pvData::Monitor
     virtual void release(epics::pvData::MonitorElementPtr const & monitorElement);
 
     virtual std::string getRequesterName();
+
+    //! Tell downstream that our queue is not empty.  Call with no locks held.
+    void notify();
+    //! Queue an update held back by the rate limit.  Call with no locks held.
+    void flush();
+    //! Merge an update into overflowElement.  Call with mutex() locked
+    void accumulate(const epics::pvData::MonitorElement& update);
+    //! After overflowElement is swapped into the queue, make the element swapped out ready to accumulate.
+    //! Call with mutex() locked
+    void resetOverflow();
+    //! Apply deadband to entry->lastelem, and remember the value if it passes.  Call with mutex() locked
+    //! @returns true if the update should be suppressed
+    bool suppress();
+    // for MonitorNotifier
+    virtual void run();
+};
+
+/** One upstream ChannelGet shared by all downstream ChannelGets (GetUser)
+ * of a ChannelCacheEntry with the same pvRequest.
+ */
+struct GetCacheEntry : public epics::pvAccess::ChannelGetRequester
+{
+    POINTER_DEFINITIONS(GetCacheEntry);
+    static size_t num_instances;
+    weak_pointer weakref;
+
+    ChannelCacheEntry * const chan;
+
+    // to avoid yet another mutex borrow interested.mutex() for our members
+    inline epicsMutex& mutex() const { return interested.mutex(); }
+
+    const MonitorCacheEntry::pvrequest_t fieldreq; // MonitorCacheEntry::fieldRequest() of pvRequest
+
+    epics::pvAccess::ChannelGet::shared_pointer op; // upstream
+    epics::pvData::Status connectresult;
+    epics::pvData::StructureConstPtr typedesc; // set by channelGetConnect()
+
+    bool inprog; // upstream get() in progress
+    epicsTime lastget; // when lastvalue was received
+    // result of last successful upstream get().  Shared with downstream, never modified
+    epics::pvData::PVStructurePtr lastvalue;
+    epics::pvData::BitSet::shared_pointer lastchanged;
+
+    // downstream waiting for the get() in progress
+    std::vector<std::tr1::shared_ptr<GetUser> > waiting;
+
+    size_t nupstream; // # of upstream get()s
+    size_t nshared;   // # of downstream get()s answered w/o an upstream get() of their own
+    size_t nmonitor;  // # of downstream get()s answered from the value of a MonitorCacheEntry
+
+    typedef weak_set<GetUser> interested_t;
+    interested_t interested;
+
+    GetCacheEntry(ChannelCacheEntry *ent, const epics::pvData::PVStructurePtr& pvRequest);
+    virtual ~GetCacheEntry();
+
+    void get(const std::tr1::shared_ptr<GetUser>& usr);
+
+    virtual std::string getRequesterName();
+    virtual void channelGetConnect(const epics::pvData::Status& status,
+                                   epics::pvAccess::ChannelGet::shared_pointer const & channelGet,
+                                   epics::pvData::StructureConstPtr const & structure);
+    virtual void getDone(const epics::pvData::Status& status,
+                         epics::pvAccess::ChannelGet::shared_pointer const & channelGet,
+                         epics::pvData::PVStructurePtr const & pvStructure,
+                         epics::pvData::BitSet::shared_pointer const & bitSet);
+};
+
+struct GetUser : public epics::pvAccess::ChannelGet
+{
+    POINTER_DEFINITIONS(GetUser);
+    static size_t num_instances;
+    weak_pointer weakref;
+
+    GetCacheEntry::shared_pointer entry;
+    epics::pvAccess::ChannelGetRequester::weak_pointer req;
+    std::tr1::weak_ptr<GWChannel> srvchan;
+    // accept the result of an upstream get() completed up to this many seconds ago
+    const double holdoff;
+    // accept the current value of a running upstream monitor with the same fields.
+    // Never set for a pvRequest with record options
+    const bool fromMonitor;
+
+    // guarded by entry->mutex()
+    bool destroyed;
+
+    GetUser(const GetCacheEntry::shared_pointer& e, double holdoff, bool fromMonitor);
+    virtual ~GetUser();
+
+    virtual void destroy();
+    virtual std::tr1::shared_ptr<epics::pvAccess::Channel> getChannel();
+    virtual void cancel();
+    virtual void lastRequest();
+    virtual void get();
+};
+
+struct PutUser;
+
+/** One upstream ChannelPut shared by downstream non-blocking puts.
+ *
+ * put()s which arrive while an upstream put() is in progress are merged,
+ * the last value of each field wins, and sent with the next upstream put().
+ */
+struct PutCacheEntry : public epics::pvAccess::ChannelPutRequester
+{
+    POINTER_DEFINITIONS(PutCacheEntry);
+    static size_t num_instances;
+    weak_pointer weakref;
+
+    ChannelCacheEntry * const chan;
+
+    // to avoid yet another mutex borrow interested.mutex() for our members
+    inline epicsMutex& mutex() const { return interested.mutex(); }
+
+    epics::pvAccess::ChannelPut::shared_pointer op; // upstream
+    epics::pvData::Status connectresult;
+    epics::pvData::StructureConstPtr typedesc; // set by channelPutConnect()
+
+    bool inprog; // upstream put() or get() in progress
+    // downstream put()s sent with the upstream put() in progress
+    std::vector<std::tr1::shared_ptr<PutUser> > inflight;
+    // merge of put()s waiting for the next upstream put()
+    epics::pvData::PVStructurePtr pending;
+    epics::pvData::BitSet::shared_pointer pendingChanged;
+    std::vector<std::tr1::shared_ptr<PutUser> > pendingUsers;
+    // downstream get()s waiting for, or in, an upstream get()
+    std::vector<std::tr1::shared_ptr<PutUser> > getwaiting, getting;
+
+    size_t nupstream; // # of upstream put()s
+    size_t nabsorbed; // # of downstream put()s merged into another
+
+    typedef weak_set<PutUser> interested_t;
+    interested_t interested;
+
+    PutCacheEntry(ChannelCacheEntry *ent);
+    virtual ~PutCacheEntry();
+
+    void put(const std::tr1::shared_ptr<PutUser>& usr,
+             const epics::pvData::PVStructurePtr& value,
+             const epics::pvData::BitSet::shared_pointer& changed);
+    void get(const std::tr1::shared_ptr<PutUser>& usr);
+
+    virtual std::string getRequesterName();
+    virtual void channelPutConnect(const epics::pvData::Status& status,
+                                   epics::pvAccess::ChannelPut::shared_pointer const & channelPut,
+                                   epics::pvData::StructureConstPtr const & structure);
+    virtual void putDone(const epics::pvData::Status& status,
+                         epics::pvAccess::ChannelPut::shared_pointer const & channelPut);
+    virtual void getDone(const epics::pvData::Status& status,
+                         epics::pvAccess::ChannelPut::shared_pointer const & channelPut,
+                         epics::pvData::PVStructurePtr const & pvStructure,
+                         epics::pvData::BitSet::shared_pointer const & bitSet);
+private:
+    void next(epicsGuard<epicsMutex>& G);
+};
+
+struct PutUser : public epics::pvAccess::ChannelPut
+{
+    POINTER_DEFINITIONS(PutUser);
+    static size_t num_instances;
+    weak_pointer weakref;
+
+    PutCacheEntry::shared_pointer entry;
+    epics::pvAccess::ChannelPutRequester::weak_pointer req;
+    std::tr1::weak_ptr<GWChannel> srvchan;
+
+    // guarded by entry->mutex()
+    bool destroyed;
+
+    PutUser(const PutCacheEntry::shared_pointer& e);
+    virtual ~PutUser();
+
+    virtual void destroy();
+    virtual std::tr1::shared_ptr<epics::pvAccess::Channel> getChannel();
+    virtual void cancel();
+    virtual void lastRequest();
+    virtual void put(epics::pvData::PVStructure::shared_pointer const & pvPutStructure,
+                     epics::pvData::BitSet::shared_pointer const & putBitSet);
+    virtual void get();
 };
 
 struct ChannelCacheEntry
@@ -115,7 +612,16 @@ struct ChannelCacheEntry
     epics::pvAccess::Channel::shared_pointer channel;
     epics::pvAccess::ChannelRequester::shared_pointer requester;
 
-    bool dropPoke;
+    bool connected; // last state reported to requester.  guarded by shard mutex
+
+    // position in ChannelCache::Shard LRU list.  guarded by shard mutex
+    ChannelCacheEntry *lruPrev, *lruNext;
+    epicsTime lastUsed; // last search, or last time the cleaner found downstream channels
+
+    // getField() cache.  guarded by mutex()
+    epics::pvData::FieldConstPtr fieldtype; // top level type, or NULL if not known
+    size_t fieldgen; // incremented when fieldtype is invalidated
+    size_t nfieldhits, nfieldmisses;
 
     typedef weak_set<GWChannel> interested_t;
     interested_t interested;
@@ -124,6 +630,12 @@ struct ChannelCacheEntry
     typedef weak_value_map<pvrequest_t, MonitorCacheEntry> mon_entries_t;
     mon_entries_t mon_entries;
 
+    typedef weak_value_map<pvrequest_t, GetCacheEntry> get_entries_t;
+    get_entries_t get_entries;
+
+    typedef weak_value_map<pvrequest_t, PutCacheEntry> put_entries_t;
+    put_entries_t put_entries;
+
     ChannelCacheEntry(ChannelCache*, const std::string& n);
     virtual ~ChannelCacheEntry();
 
@@ -147,29 +659,180 @@ struct ChannelCacheEntry
 };
 
 /** Holds the set of channels the GW is searching for, or has found.
+ *
+ * Entries are spread across a fixed number of Shards by hash of channel name.
+ * Each Shard has its own lock, so that concurrent searches for different
+ * names seldom contend with each other, or with the cleaner.
  */
 struct ChannelCache
 {
     typedef std::map<std::string, ChannelCacheEntry::shared_pointer > entries_t;
 
-    // cacheLock should not be held while calling *Requester methods
-    epicsMutex cacheLock;
+    struct Shard {
+        // mutex should not be held while calling *Requester methods
+        epicsMutex mutex;
+
+        entries_t entries;
+
+        // guarded by mutex
+        size_t nlocks;     // # of times lock()'d
+        size_t ncontended; // # of times lock() had to wait
+
+        // intrusive list of all entries, least recently used first.  guarded by mutex
+        ChannelCacheEntry *lruHead, *lruTail;
+
+        typedef epicsGuard<Shard> guard_type;
+        typedef epicsGuardRelease<Shard> release_type;
+
+        Shard() :nlocks(0), ncontended(0), lruHead(0), lruTail(0) {}
+
+        // Call with mutex locked.  Always use these to add/remove entries so that the LRU list stays complete.
+        void add(const ChannelCacheEntry::shared_pointer& ent, const epicsTime& now);
+        void erase(entries_t::iterator it);
+        //! move to most recently used
+        void touch(ChannelCacheEntry *ent, const epicsTime& now);
+
+        // for use by guard_type
+        void lock() {
+            if(!mutex.tryLock()) {
+                mutex.lock();
+                ncontended++;
+            }
+            nlocks++;
+        }
+        void unlock() { mutex.unlock(); }
+    private:
+        void unlink(ChannelCacheEntry *ent);
+        Shard(const Shard&);
+        Shard& operator=(const Shard&);
+    };
 
-    entries_t entries;
+    const size_t nshards;
+    Shard * const shards;
 
-    epics::pvAccess::ChannelProvider::shared_pointer provider; // client Provider
+    // client Providers (upstream contexts).  Each name is always created through providers[providerIndex(name)]
+    typedef std::vector<epics::pvAccess::ChannelProvider::shared_pointer> providers_t;
+    providers_t providers;
 
     epicsTimerQueueActive *timerQueue;
     epicsTimer *cleanTimer;
     struct cacheClean;
     cacheClean *cleaner;
-    size_t cleanerRuns;
-    size_t cleanerDust;
-
-    ChannelCache(const epics::pvAccess::ChannelProvider::shared_pointer& prov);
+    size_t cleanerRuns; // atomic
+    size_t cleanerDust; // atomic
+
+    // Cleaner configuration.  Set before first lookup()
+    double idleTimeout; // seconds w/o search or downstream channel before an entry is closed
+    size_t cleanSlice;  // max. # of idle entries examined on each cleaner tick, once per second
+
+    epicsMutex cleanMutex;
+    size_t nextClean; // guarded by cleanMutex.  first shard of next clean()
+    size_t fieldHits;   // atomic.  getField() answered from ChannelCacheEntry::fieldtype
+    size_t fieldMisses; // atomic.  getField() forwarded upstream
+
+    // when !!creator, createChannel() is called from createQueue workers
+    WorkQueue createQueue;
+    struct Creator;
+    std::tr1::shared_ptr<Creator> creator;
+
+    MonitorNotifier notifier;
+    MonitorFlusher flusher;
+    CacheStats stats;
+
+    // New MonitorCacheEntry will share immutable snapshots among MonitorUsers.
+    // Set before first lookup()
+    bool snapshotMonitors;
+    // New MonitorCacheEntry will stop poll()ing upstream while all MonitorUsers are full.
+    // Set before first lookup()
+    bool monitorFlowControl;
+
+    //! Remembers names which were never found upstream, so that
+    //! repeated searches for them don't create new entries.
+    struct NegativeCache {
+        // configuration.  Set before first lookup()
+        size_t capacity; // max. # of names.  zero disables
+        double ttl;      // seconds a name is remembered
+
+        epicsMutex mutex;
+        // guarded by mutex
+        typedef std::list<std::pair<std::string, epicsTime> > lru_t; // (name, expiration).  least recently used first
+        typedef std::map<std::string, lru_t::iterator> index_t;
+        lru_t lru;
+        index_t index;
+        size_t nhits, nmisses;
+
+        NegativeCache() :capacity(0u), ttl(0.0), nhits(0u), nmisses(0u) {}
+
+        //! @returns true if name is known to be missing
+        bool test(const std::string& name);
+        void add(const std::string& name);
+    } negative;
+
+    //! Token bucket per client host, limits the rate at which
+    //! searches may create new entries.
+    struct SearchLimiter {
+        // configuration.  Set before first lookup()
+        double rate;  // tokens per second.  zero disables
+        double burst; // bucket capacity
+
+        epicsMutex mutex;
+        // guarded by mutex
+        struct Bucket {
+            double tokens;
+            epicsTime last;
+        };
+        typedef std::map<std::string, Bucket> buckets_t;
+        buckets_t buckets;
+        size_t ndropped;
+
+        SearchLimiter() :rate(0.0), burst(0.0), ndropped(0u) {}
+
+        //! take a token for this peer
+        //! @returns false if the bucket is empty
+        bool allow(const std::string& peer);
+        //! forget about peers with full buckets
+        void prune();
+    } limiter;
+
+    //! ncreators of ChannelCache(), as also given by the "createWorkers" config key.
+    //! Zero (or unset) selects defaultCreators.  createInline calls createChannel() from lookup()
+    enum {defaultCreators = 2, createInline = -1};
+    //! # of createQueue workers for ncreators
+    static unsigned creatorThreads(int ncreators);
+
+    ChannelCache(const epics::pvAccess::ChannelProvider::shared_pointer& prov,
+                 int ncreators = 0,
+                 size_t nshards = 16u);
     ~ChannelCache();
 
-    ChannelCacheEntry::shared_pointer lookup(const std::string& name);
+    //! The Shard which does, or would, hold the named channel
+    Shard& shardOf(const std::string& name);
+
+    //! Add another independent upstream context.  Call before first lookup()
+    void addProvider(const epics::pvAccess::ChannelProvider::shared_pointer& prov);
+
+    //! index in providers of the context which does, or would, hold the named channel
+    size_t providerIndex(const std::string& name) const;
+
+    //! Call provider->createChannel() for a new entry.
+    //! Must be called w/o the shard mutex held.
+    //! @returns true if the new channel is already connected
+    bool create(const ChannelCacheEntry::shared_pointer& ent);
+
+    //! Close up to cleanSlice entries idle for more than idleTimeout.
+    //! Called by the cleaner timer.
+    //! @returns # of entries closed
+    size_t clean(const epicsTime& now);
+
+    //! (# of channels waiting for createChannel(), # created, # of batches)
+    void createStats(size_t& npending, size_t& ncreated, size_t& nbatches);
+
+    //! Find, or begin searching for, the named channel
+    //! @param name Channel name
+    //! @param peer Address of the requesting client.  If empty, the SearchLimiter is bypassed.
+    //! @returns a connected entry, or NULL
+    ChannelCacheEntry::shared_pointer lookup(const std::string& name,
+                                             const std::string& peer = std::string());
 };
 
 #endif // CHANCACHE_H
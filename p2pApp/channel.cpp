@@ -25,13 +25,17 @@ size_t GWChannel::num_instances;
 GWChannel::GWChannel(const ChannelCacheEntry::shared_pointer& e,
                      const epics::pvAccess::ChannelProvider::weak_pointer& srvprov,
                      const epics::pvAccess::ChannelRequester::weak_pointer &r,
-                     const std::string& addr)
+                     const std::string& addr,
+                     const GWServerOptions& options)
     :entry(e)
     ,requester(r)
     ,address(addr)
     ,server_provder(srvprov)
+    ,options(options)
 {
     epicsAtomicIncrSizeT(&num_instances);
+    if(options.stats)
+        options.stats->channels.add();
 }
 
 GWChannel::~GWChannel()
@@ -81,12 +85,79 @@ GWChannel::getChannelRequester()
 }
 
 
+namespace {
+// remember the top level type when upstream replies
+struct FieldCacher : public pva::GetFieldRequester
+{
+    const ChannelCacheEntry::weak_pointer entry;
+    const size_t fieldgen;
+    const pva::GetFieldRequester::shared_pointer requester;
+
+    FieldCacher(const ChannelCacheEntry::shared_pointer& entry,
+                size_t fieldgen,
+                const pva::GetFieldRequester::shared_pointer& requester)
+        :entry(entry), fieldgen(fieldgen), requester(requester)
+    {}
+    virtual ~FieldCacher() {}
+
+    virtual std::string getRequesterName() { return requester->getRequesterName(); }
+
+    virtual void getDone(const pvd::Status& status, pvd::FieldConstPtr const & field)
+    {
+        ChannelCacheEntry::shared_pointer E(entry.lock());
+        if(E && status.isSuccess() && field) {
+            Guard G(E->mutex());
+            if(E->fieldgen==fieldgen) // ignore reply to a request made before a disconnect
+                E->fieldtype = field;
+        }
+        requester->getDone(status, field);
+    }
+};
+}
+
 void
 GWChannel::getField(pva::GetFieldRequester::shared_pointer const & requester,
                             std::string const & subField)
 {
-    //TODO: cache for top level field?
-    entry->channel->getField(requester, subField);
+    pvd::FieldConstPtr type;
+    size_t fieldgen;
+    {
+        Guard G(entry->mutex());
+        type = entry->fieldtype;
+        fieldgen = entry->fieldgen;
+        if(type)
+            entry->nfieldhits++;
+        else
+            entry->nfieldmisses++;
+    }
+
+    if(!type) {
+        epicsAtomicIncrSizeT(&entry->cache->fieldMisses);
+        if(subField.empty()) {
+            pva::GetFieldRequester::shared_pointer cacher(new FieldCacher(entry, fieldgen, requester));
+            entry->channel->getField(cacher, subField);
+        } else {
+            entry->channel->getField(requester, subField);
+        }
+        return;
+    }
+
+    epicsAtomicIncrSizeT(&entry->cache->fieldHits);
+
+    // Structure::getField() does not split "a.b", so walk the path one component at a time
+    for(size_t pos=0u; type && pos<subField.size(); ) {
+        size_t sep = subField.find('.', pos);
+        if(sep==std::string::npos)
+            sep = subField.size();
+        pvd::StructureConstPtr parent(std::tr1::dynamic_pointer_cast<const pvd::Structure>(type));
+        type = parent ? parent->getField(subField.substr(pos, sep-pos)) : pvd::FieldConstPtr();
+        pos = sep+1u;
+    }
+
+    if(type)
+        requester->getDone(pvd::Status(), type);
+    else
+        requester->getDone(pvd::Status(pvd::Status::STATUSTYPE_ERROR, "No such field"), type);
 }
 
 pva::AccessRights
@@ -111,7 +182,90 @@ GWChannel::createChannelGet(
         pva::ChannelGetRequester::shared_pointer const & channelGetRequester,
         pvd::PVStructure::shared_pointer const & pvRequest)
 {
-    return entry->channel->createChannelGet(channelGetRequester, pvRequest);
+    if(options.stats)
+        options.stats->gets.add();
+
+    // record options (eg. process=true) may change the result.  queueSize is only for monitors
+    bool recordOptions = false, process = false;
+    {
+        pvd::PVStructurePtr opts(pvRequest->getSubField<pvd::PVStructure>("record._options"));
+        if(opts) {
+            const pvd::StringArray& names(opts->getStructure()->getFieldNames());
+            for(size_t i=0; i<names.size(); i++)
+                recordOptions |= names[i]!="queueSize";
+
+            pvd::PVScalarPtr proc(opts->getSubField<pvd::PVScalar>("process"));
+            try {
+                process = proc && proc->getAs<pvd::boolean>();
+            } catch(std::runtime_error&) {
+                process = true; // not understood, let upstream decide
+            }
+        }
+    }
+    const bool fromMonitor = options.getFromMonitor && !recordOptions;
+
+    // a get() which processes is never shared
+    if(process || (options.getHoldoff<=0.0 && !fromMonitor))
+        return entry->channel->createChannelGet(channelGetRequester, pvRequest);
+
+    ChannelCacheEntry::pvrequest_t ser;
+    // serialize request struct to string using host byte order (only used for local comparison)
+    pvd::serializeToVector(pvRequest.get(), EPICS_BYTE_ORDER, ser);
+
+    GetCacheEntry::shared_pointer gent;
+    GetUser::shared_pointer op;
+
+    pvd::Status connectresult;
+    pvd::StructureConstPtr typedesc;
+
+    try {
+        {
+            Guard G(entry->mutex());
+
+            gent = entry->get_entries.find(ser);
+            if(!gent) {
+                gent.reset(new GetCacheEntry(entry.get(), pvRequest));
+                entry->get_entries[ser] = gent; // ref. wrapped
+                gent->weakref = gent;
+
+                pva::ChannelGet::shared_pointer O;
+                {
+                    UnGuard U(G);
+
+                    O = entry->channel->createChannelGet(gent, pvRequest);
+                }
+                Guard G2(gent->mutex());
+                if(!gent->op)
+                    gent->op = O;
+            }
+        }
+
+        Guard G(gent->mutex());
+
+        op.reset(new GetUser(gent, options.getHoldoff, fromMonitor));
+        gent->interested.insert(op);
+        op->weakref = op;
+        op->srvchan = shared_pointer(weakref);
+        op->req = channelGetRequester;
+
+        typedesc = gent->typedesc;
+        connectresult = gent->connectresult;
+
+    } catch(std::exception& e) {
+        op.reset();
+        std::cerr<<"Exception in GWChannel::createChannelGet()\n"
+                   "is "<<e.what()<<"\n";
+        connectresult = pvd::Status(pvd::Status::STATUSTYPE_FATAL, "Error during GWChannel setup");
+    }
+
+    // unlock for callback
+
+    if(typedesc || !connectresult.isSuccess()) {
+        // upstream get already connected, or never will be.
+        channelGetRequester->channelGetConnect(connectresult, op, typedesc);
+    }
+
+    return op;
 }
 
 pva::ChannelPut::shared_pointer
@@ -119,11 +273,81 @@ GWChannel::createChannelPut(
         pva::ChannelPutRequester::shared_pointer const & channelPutRequester,
         pvd::PVStructure::shared_pointer const & pvRequest)
 {
-    //TODO: allow ChannelPut::get()
-    if(!p2pReadOnly)
-        return entry->channel->createChannelPut(channelPutRequester, pvRequest);
-    else
+    if(p2pReadOnly)
         return Channel::createChannelPut(channelPutRequester, pvRequest);
+
+    if(options.stats)
+        options.stats->puts.add();
+
+    bool block = true;
+    try {
+        block = pvRequest->getSubFieldT<pvd::PVScalar>("record._options.block")->getAs<pvd::boolean>();
+    } catch(std::runtime_error& e) {
+        // not specified
+    }
+
+    // downstream waiting for completion of its own put() can't be combined
+    if(!options.combinePuts || block)
+        return entry->channel->createChannelPut(channelPutRequester, pvRequest);
+
+    ChannelCacheEntry::pvrequest_t ser;
+    // serialize request struct to string using host byte order (only used for local comparison)
+    pvd::serializeToVector(pvRequest.get(), EPICS_BYTE_ORDER, ser);
+
+    PutCacheEntry::shared_pointer pent;
+    PutUser::shared_pointer op;
+
+    pvd::Status connectresult;
+    pvd::StructureConstPtr typedesc;
+
+    try {
+        {
+            Guard G(entry->mutex());
+
+            pent = entry->put_entries.find(ser);
+            if(!pent) {
+                pent.reset(new PutCacheEntry(entry.get()));
+                entry->put_entries[ser] = pent; // ref. wrapped
+                pent->weakref = pent;
+
+                pva::ChannelPut::shared_pointer O;
+                {
+                    UnGuard U(G);
+
+                    O = entry->channel->createChannelPut(pent, pvRequest);
+                }
+                Guard G2(pent->mutex());
+                if(!pent->op)
+                    pent->op = O;
+            }
+        }
+
+        Guard G(pent->mutex());
+
+        op.reset(new PutUser(pent));
+        pent->interested.insert(op);
+        op->weakref = op;
+        op->srvchan = shared_pointer(weakref);
+        op->req = channelPutRequester;
+
+        typedesc = pent->typedesc;
+        connectresult = pent->connectresult;
+
+    } catch(std::exception& e) {
+        op.reset();
+        std::cerr<<"Exception in GWChannel::createChannelPut()\n"
+                   "is "<<e.what()<<"\n";
+        connectresult = pvd::Status(pvd::Status::STATUSTYPE_FATAL, "Error during GWChannel setup");
+    }
+
+    // unlock for callback
+
+    if(typedesc || !connectresult.isSuccess()) {
+        // upstream put already connected, or never will be.
+        channelPutRequester->channelPutConnect(connectresult, op, typedesc);
+    }
+
+    return op;
 }
 
 pva::ChannelPutGet::shared_pointer
@@ -152,6 +376,32 @@ namespace {
 struct noclean {
     void operator()(MonitorCacheEntry *) {}
 };
+
+// parse a numeric record._options field, if present.  A bad value is reported, and val left unchanged
+bool monitorOption(const pvd::PVScalarPtr& fld, double& val, const pvd::MonitorRequester::shared_pointer& requester)
+{
+    if(!fld)
+        return false;
+    try {
+        val = fld->getAs<double>();
+        return true;
+    } catch(std::runtime_error& e) {
+        requester->message("Ignoring record._options."+fld->getFieldName()+": "+e.what(), pvd::warningMessage);
+        return false;
+    }
+}
+
+// set an option of the upstream pvRequest to a neutral value of its type, if present
+void clearOption(const pvd::PVStructurePtr& opts, const char *name)
+{
+    pvd::PVScalarPtr fld(opts->getSubField<pvd::PVScalar>(name));
+    if(!fld)
+        return;
+    else if(fld->getScalar()->getScalarType()==pvd::pvString)
+        static_cast<pvd::PVString&>(*fld).put("");
+    else
+        fld->putFrom<pvd::int32>(0); // never fails for a number or boolean
+}
 }
 
 pvd::Monitor::shared_pointer
@@ -159,9 +409,65 @@ GWChannel::createMonitor(
         pvd::MonitorRequester::shared_pointer const & monitorRequester,
         pvd::PVStructure::shared_pointer const & pvRequest)
 {
+    if(options.stats)
+        options.stats->monitors.add();
+
+    MonitorPolicy::shared_pointer policy(options.monitorPolicy(entry->channelName, address));
+
+    // rate limit and deadband are applied by each MonitorUser
+    double maxRate = 0.0;
+    Deadband deadband;
+    if(policy)
+        deadband = policy->deadband;
+
+    pvd::PVStructurePtr upRequest(pvRequest);
+    {
+        pvd::PVStructurePtr opts(pvRequest->getSubField<pvd::PVStructure>("record._options"));
+        pvd::PVScalarPtr rate, abs, rel, pass;
+        if(opts) {
+            rate = opts->getSubField<pvd::PVScalar>("maxRate");
+            abs = opts->getSubField<pvd::PVScalar>("deadband");
+            rel = opts->getSubField<pvd::PVScalar>("relDeadband");
+            pass = opts->getSubField<pvd::PVScalar>("deadbandPass");
+        }
+        // each option is parsed on its own, so that one bad value does not discard the others
+        monitorOption(rate, maxRate, monitorRequester);
+
+        double absval = 0.0, relval = 0.0;
+        bool haveAbs = monitorOption(abs, absval, monitorRequester),
+             haveRel = monitorOption(rel, relval, monitorRequester);
+        if(haveAbs || haveRel) { // replaces any deadband from policy
+            deadband = Deadband();
+            deadband.abs = absval;
+            deadband.rel = relval;
+        }
+
+        if(pass && !deadband.parsePass(pass->getAs<std::string>()))
+            monitorRequester->message("Ignoring record._options.deadbandPass=\""+pass->getAs<std::string>()
+                               +"\", expected alarm, all, or none", pvd::warningMessage);
+
+        if(rate || abs || rel || pass) {
+            // so that subscriptions which differ only by these options share an upstream monitor
+            try {
+                upRequest = pvd::getPVDataCreate()->createPVStructure(pvRequest->getStructure());
+                upRequest->copyUnchecked(*pvRequest);
+                pvd::PVStructurePtr upopts(upRequest->getSubFieldT<pvd::PVStructure>("record._options"));
+                clearOption(upopts, "maxRate");
+                clearOption(upopts, "deadband");
+                clearOption(upopts, "relDeadband");
+                clearOption(upopts, "deadbandPass");
+            } catch(std::exception& e) {
+                monitorRequester->message(std::string("Error in record._options: ")+e.what(), pvd::errorMessage);
+                monitorRequester->monitorConnect(pvd::Status(pvd::Status::STATUSTYPE_ERROR, e.what()),
+                                                 pvd::MonitorPtr(), pvd::StructureConstPtr());
+                return pvd::MonitorPtr();
+            }
+        }
+    }
+
     ChannelCacheEntry::pvrequest_t ser;
     // serialize request struct to string using host byte order (only used for local comparison)
-    pvd::serializeToVector(pvRequest.get(), EPICS_BYTE_ORDER, ser);
+    pvd::serializeToVector(upRequest.get(), EPICS_BYTE_ORDER, ser);
 
     MonitorCacheEntry::shared_pointer ment;
     MonitorUser::shared_pointer mon;
@@ -177,7 +483,7 @@ GWChannel::createMonitor(
 
             ment = entry->mon_entries.find(ser);
             if(!ment) {
-                ment.reset(new MonitorCacheEntry(entry.get(), pvRequest));
+                ment.reset(new MonitorCacheEntry(entry.get(), upRequest));
                 entry->mon_entries[ser] = ment; // ref. wrapped
                 ment->weakref = ment;
 
@@ -189,7 +495,7 @@ GWChannel::createMonitor(
                 {
                     UnGuard U(G);
 
-                    M = entry->channel->createMonitor(ment, pvRequest);
+                    M = entry->channel->createMonitor(ment, upRequest);
                 }
                 ment->mon = M;
             }
@@ -197,7 +503,10 @@ GWChannel::createMonitor(
 
         Guard G(ment->mutex());
 
-        mon.reset(new MonitorUser(ment));
+        if(policy)
+            epicsAtomicIncrSizeT(&policy->nusers);
+
+        mon.reset(new MonitorUser(ment, policy, maxRate, deadband));
         ment->interested.insert(mon);
         mon->weakref = mon;
         mon->srvchan = shared_pointer(weakref);
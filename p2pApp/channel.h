@@ -5,6 +5,44 @@
 
 #include "chancache.h"
 
+//! Totals for one GW server, shared by all of its GWChannels
+struct ServerStats
+{
+    StatCounter channels; // GWChannels created
+    StatCounter gets;     // ChannelGets created
+    StatCounter puts;     // ChannelPuts created
+    StatCounter monitors; // Monitors created
+};
+
+//! Settings of one GW server, which apply to the GWChannels it creates
+struct GWServerOptions
+{
+    // ChannelGet results received less than this many seconds ago are given to other downstream gets.
+    // zero disables sharing.
+    double getHoldoff;
+    // Answer ChannelGet from the current value of a running monitor with the same fields.
+    bool getFromMonitor;
+    // Merge non-blocking ChannelPuts which arrive while an upstream put is in progress.
+    bool combinePuts;
+    // Queue settings for subscriptions.  The first which matches applies.
+    typedef std::vector<MonitorPolicy::shared_pointer> monitorPolicies_t;
+    monitorPolicies_t monitorPolicies;
+    // may be NULL
+    std::tr1::shared_ptr<ServerStats> stats;
+
+    GWServerOptions() :getHoldoff(0.0), getFromMonitor(false), combinePuts(false) {}
+
+    //! @returns the first policy matching a channel and client, or NULL
+    MonitorPolicy::shared_pointer monitorPolicy(const std::string& channelName, const std::string& peer) const
+    {
+        for(size_t i=0; i<monitorPolicies.size(); i++) {
+            if(monitorPolicies[i]->match(channelName, peer))
+                return monitorPolicies[i];
+        }
+        return MonitorPolicy::shared_pointer();
+    }
+};
+
 struct GWChannel : public epics::pvAccess::Channel
 {
     POINTER_DEFINITIONS(GWChannel);
@@ -15,11 +53,13 @@ struct GWChannel : public epics::pvAccess::Channel
     const requester_type::weak_pointer requester;
     const std::string address; // address of client on GW server side
     const epics::pvAccess::ChannelProvider::weak_pointer server_provder;
+    const GWServerOptions options;
 
     GWChannel(const ChannelCacheEntry::shared_pointer& e,
               const epics::pvAccess::ChannelProvider::weak_pointer& srvprov,
               const requester_type::weak_pointer&,
-              const std::string& addr);
+              const std::string& addr,
+              const GWServerOptions& options = GWServerOptions());
     virtual ~GWChannel();
 
 
@@ -0,0 +1,255 @@
+
+#include <epicsAtomic.h>
+#include <errlog.h>
+
+#include <epicsMutex.h>
+
+#include <pv/pvAccess.h>
+
+#define epicsExportSharedSymbols
+#include "helper.h"
+#include "pva2pva.h"
+#include "chancache.h"
+#include "channel.h"
+
+namespace pva = epics::pvAccess;
+namespace pvd = epics::pvData;
+
+size_t GetCacheEntry::num_instances;
+size_t GetUser::num_instances;
+
+GetCacheEntry::GetCacheEntry(ChannelCacheEntry *ent, const pvd::PVStructurePtr& pvRequest)
+    :chan(ent)
+    ,fieldreq(MonitorCacheEntry::fieldRequest(pvRequest))
+    ,inprog(false)
+    ,nupstream(0)
+    ,nshared(0)
+    ,nmonitor(0)
+{
+    epicsAtomicIncrSizeT(&num_instances);
+}
+
+GetCacheEntry::~GetCacheEntry()
+{
+    pva::ChannelGet::shared_pointer O;
+    O.swap(op);
+    if(O) {
+        O->destroy();
+    }
+    epicsAtomicDecrSizeT(&num_instances);
+    const_cast<ChannelCacheEntry*&>(chan) = NULL; // spoil to fault use after free
+}
+
+std::string
+GetCacheEntry::getRequesterName()
+{
+    return "GetCacheEntry";
+}
+
+void
+GetCacheEntry::channelGetConnect(const pvd::Status& status,
+                                 pva::ChannelGet::shared_pointer const & channelGet,
+                                 pvd::StructureConstPtr const & structure)
+{
+    interested_t::vector_type tonotify;
+    {
+        Guard G(mutex());
+        if(!op) // may be called before createChannelGet() returns
+            op = channelGet;
+        connectresult = status;
+        typedesc = structure;
+        lastvalue.reset();
+        tonotify = interested.lock_vector();
+    }
+
+    shared_pointer self(weakref); // keeps us alive until all GetUsers are destroy()ed
+
+    FOREACH(interested_t::vector_type::iterator, it, end, tonotify) {
+        pva::ChannelGetRequester::shared_pointer req((*it)->req.lock());
+        if(req)
+            req->channelGetConnect(status, *it, structure);
+    }
+}
+
+namespace {
+// Find the current value of a running upstream monitor of chan with the given type,
+// and the same selection of fields.
+// Call with no locks held
+pvd::PVStructurePtr monitorValue(ChannelCacheEntry *chan, const pvd::StructureConstPtr& type,
+                                 const MonitorCacheEntry::pvrequest_t& fieldreq)
+{
+    ChannelCacheEntry::mon_entries_t::lock_vector_type mons;
+    {
+        Guard G(chan->mutex());
+        mons = chan->mon_entries.lock_vector();
+    }
+
+    FOREACH(ChannelCacheEntry::mon_entries_t::lock_vector_type::const_iterator, it, end, mons) {
+        MonitorCacheEntry& ME = *it->second;
+        Guard G(ME.mutex());
+        // with updates left in the upstream queue by flow control, lastelem is out of date
+        if(!ME.havedata || ME.done || ME.blocked || !ME.typedesc)
+            continue;
+        if(ME.fieldreq!=fieldreq)
+            continue; // field options (eg. array slices) may differ, even with the same type
+        if(ME.typedesc!=type && !(*ME.typedesc==*type))
+            continue;
+        return ME.getSnapshot();
+    }
+    return pvd::PVStructurePtr();
+}
+}
+
+void
+GetCacheEntry::get(const GetUser::shared_pointer& usr)
+{
+    pvd::PVStructurePtr value;
+    pvd::BitSet::shared_pointer changed;
+    pva::ChannelGet::shared_pointer O;
+    bool connected = true;
+
+    if(usr->fromMonitor) {
+        pvd::StructureConstPtr type;
+        {
+            Guard G(mutex());
+            type = typedesc;
+        }
+        if(type)
+            value = monitorValue(chan, type, fieldreq);
+        if(value) {
+            changed.reset(new pvd::BitSet);
+            changed->set(0);
+        }
+    }
+
+    {
+        Guard G(mutex());
+        if(!op || !typedesc) {
+            connected = false;
+            value.reset();
+        } else if(value) {
+            nmonitor++;
+
+        } else if(usr->holdoff>0.0 && lastvalue && (epicsTime::getCurrent() - lastget) <= usr->holdoff) {
+            // recent enough
+            value = lastvalue;
+            changed = lastchanged;
+            nshared++;
+
+        } else {
+            waiting.push_back(usr);
+            if(!inprog) {
+                inprog = true;
+                O = op;
+                nupstream++;
+            } else {
+                nshared++; // join the get() already in progress
+            }
+        }
+    }
+
+    if(O) {
+        O->get();
+
+    } else if(value) {
+        pva::ChannelGetRequester::shared_pointer req(usr->req.lock());
+        if(req)
+            req->getDone(pvd::Status(), usr, value, changed);
+
+    } else if(!connected) {
+        pva::ChannelGetRequester::shared_pointer req(usr->req.lock());
+        if(req)
+            req->getDone(pvd::Status(pvd::Status::STATUSTYPE_ERROR, "Not connected"), usr,
+                         pvd::PVStructurePtr(), pvd::BitSet::shared_pointer());
+    }
+}
+
+void
+GetCacheEntry::getDone(const pvd::Status& status,
+                       pva::ChannelGet::shared_pointer const & channelGet,
+                       pvd::PVStructurePtr const & pvStructure,
+                       pvd::BitSet::shared_pointer const & bitSet)
+{
+    std::vector<GetUser::shared_pointer> tonotify;
+    pvd::PVStructurePtr value;
+    pvd::BitSet::shared_pointer changed;
+
+    if(status.isSuccess() && pvStructure) {
+        // upstream may re-use pvStructure for the next get(), so copy once for all downstream.
+        // shallow, array values are shared.
+        value = pvd::getPVDataCreate()->createPVStructure(pvStructure->getStructure());
+        value->copyUnchecked(*pvStructure);
+        value->setImmutable();
+        // downstream users may not have seen any previous value, so send all
+        changed.reset(new pvd::BitSet);
+        changed->set(0);
+    }
+
+    {
+        Guard G(mutex());
+        inprog = false;
+        tonotify.swap(waiting);
+        if(value) {
+            lastvalue = value;
+            lastchanged = changed;
+            lastget = epicsTime::getCurrent();
+        }
+    }
+
+    shared_pointer self(weakref); // keeps us alive until all GetUsers are destroy()ed
+
+    FOREACH(std::vector<GetUser::shared_pointer>::iterator, it, end, tonotify) {
+        GetUser *usr = it->get();
+        pva::ChannelGetRequester::shared_pointer req(usr->req.lock());
+        bool destroyed;
+        {
+            Guard G(mutex());
+            destroyed = usr->destroyed;
+        }
+        if(req && !destroyed)
+            req->getDone(status, *it, value, changed);
+    }
+}
+
+GetUser::GetUser(const GetCacheEntry::shared_pointer& e, double holdoff, bool fromMonitor)
+    :entry(e)
+    ,holdoff(holdoff)
+    ,fromMonitor(fromMonitor)
+    ,destroyed(false)
+{
+    epicsAtomicIncrSizeT(&num_instances);
+}
+
+GetUser::~GetUser()
+{
+    epicsAtomicDecrSizeT(&num_instances);
+}
+
+void
+GetUser::destroy()
+{
+    Guard G(entry->mutex());
+    destroyed = true;
+}
+
+std::tr1::shared_ptr<pva::Channel>
+GetUser::getChannel()
+{
+    return GWChannel::shared_pointer(srvchan);
+}
+
+void
+GetUser::cancel()
+{
+    // upstream get() is shared, so we don't cancel it
+}
+
+void
+GetUser::lastRequest()
+{}
+
+void
+GetUser::get()
+{
+    entry->get(shared_pointer(weakref));
+}
@@ -1,7 +1,9 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <stdexcept>
+#include <algorithm>
 #include <map>
 
 #if !defined(_WIN32)
@@ -13,6 +15,7 @@
 #include <epicsGetopt.h>
 #include <iocsh.h>
 #include <epicsTimer.h>
+#include <errlog.h>
 #include <libComRegister.h>
 
 #include <pv/json.h>
@@ -39,6 +42,9 @@ namespace {
 pvd::StructureConstPtr schema(pvd::getFieldCreate()->createFieldBuilder()
                               ->add("version", pvd::pvUInt)
                               ->add("readOnly", pvd::pvBoolean)
+                              ->add("statsFile", pvd::pvString)
+                              ->add("statsPeriod", pvd::pvDouble)
+                              ->add("statsPerChannel", pvd::pvBoolean)
                               ->addNestedStructureArray("clients")
                                  ->add("name", pvd::pvString)
                                  ->add("provider", pvd::pvString)
@@ -46,6 +52,17 @@ pvd::StructureConstPtr schema(pvd::getFieldCreate()->createFieldBuilder()
                                  ->add("autoaddrlist", pvd::pvBoolean)
                                  ->add("serverport", pvd::pvUShort)
                                  ->add("bcastport", pvd::pvUShort)
+                                 ->add("createWorkers", pvd::pvInt)
+                                 ->add("negativeCacheSize", pvd::pvUInt)
+                                 ->add("negativeTTL", pvd::pvDouble)
+                                 ->add("searchRate", pvd::pvDouble)
+                                 ->add("searchBurst", pvd::pvDouble)
+                                 ->add("snapshotMonitors", pvd::pvBoolean)
+                                 ->add("notifyWorkers", pvd::pvUInt)
+                                 ->add("monitorFlowControl", pvd::pvBoolean)
+                                 ->add("workers", pvd::pvUInt)
+                                 ->add("idleTimeout", pvd::pvDouble)
+                                 ->add("cleanSlice", pvd::pvUInt)
                               ->endNested()
                               ->addNestedStructureArray("servers")
                                  ->add("name", pvd::pvString)
@@ -56,6 +73,20 @@ pvd::StructureConstPtr schema(pvd::getFieldCreate()->createFieldBuilder()
                                  ->add("serverport", pvd::pvUShort)
                                  ->add("bcastport", pvd::pvUShort)
                                  ->add("control_prefix", pvd::pvString)
+                                 ->add("getHoldoff", pvd::pvDouble)
+                                 ->add("getFromMonitor", pvd::pvBoolean)
+                                 ->add("combinePuts", pvd::pvBoolean)
+                                 ->addNestedStructureArray("monitorPolicies")
+                                    ->add("name", pvd::pvString)
+                                    ->add("channel", pvd::pvString)
+                                    ->add("client", pvd::pvString)
+                                    ->add("queueSize", pvd::pvUInt)
+                                    ->add("drop", pvd::pvString)
+                                    ->add("maxRate", pvd::pvDouble)
+                                    ->add("deadband", pvd::pvDouble)
+                                    ->add("relDeadband", pvd::pvDouble)
+                                    ->add("deadbandPass", pvd::pvString)
+                                 ->endNested()
                               ->endNested()
                               ->createStructure());
 
@@ -150,7 +181,55 @@ GWServerChannelProvider::shared_pointer configure_client(ServerConfig& arg, cons
     if(!base)
         throw std::runtime_error("Can't create ChannelProvider");
 
-    GWServerChannelProvider::shared_pointer ret(new GWServerChannelProvider(base));
+    // threads calling createChannel() so that a slow provider doesn't delay search replies.
+    // zero (or unset) for the default, negative to create from the search thread
+    int ncreators = conf->getSubFieldT<pvd::PVInt>("createWorkers")->get();
+
+    GWServerChannelProvider::shared_pointer ret(new GWServerChannelProvider(base, ncreators));
+
+    // more independent upstream contexts, each with its own RX threads.
+    // channel names are partitioned among them.
+    unsigned nworkers = conf->getSubFieldT<pvd::PVUInt>("workers")->get();
+    for(unsigned i=1; i<nworkers; i++) {
+        pva::ChannelProvider::shared_pointer other(pva::ChannelProviderRegistry::clients()->createProvider(provider, C));
+        if(!other)
+            throw std::runtime_error("Can't create ChannelProvider");
+        ret->cache.addProvider(other);
+    }
+
+    // remember names not found upstream
+    ret->cache.negative.capacity = conf->getSubFieldT<pvd::PVUInt>("negativeCacheSize")->get();
+    ret->cache.negative.ttl = conf->getSubFieldT<pvd::PVDouble>("negativeTTL")->get();
+    if(ret->cache.negative.ttl<=0.0)
+        ret->cache.negative.ttl = 60.0;
+
+    // limit rate of new names searched for by each client host
+    ret->cache.limiter.rate = conf->getSubFieldT<pvd::PVDouble>("searchRate")->get();
+    ret->cache.limiter.burst = conf->getSubFieldT<pvd::PVDouble>("searchBurst")->get();
+    if(ret->cache.limiter.burst<1.0)
+        ret->cache.limiter.burst = std::max(1.0, ret->cache.limiter.rate);
+
+    // close upstream channels unused for this long, a few at a time
+    double idle = conf->getSubFieldT<pvd::PVDouble>("idleTimeout")->get();
+    if(idle>0.0)
+        ret->cache.idleTimeout = idle;
+    unsigned slice = conf->getSubFieldT<pvd::PVUInt>("cleanSlice")->get();
+    if(slice)
+        ret->cache.cleanSlice = slice;
+
+    // share one copy of each monitor update among all downstream subscribers
+    ret->cache.snapshotMonitors = conf->getSubFieldT<pvd::PVBoolean>("snapshotMonitors")->get();
+
+    // stop reading from upstream while all downstream subscribers are full
+    ret->cache.monitorFlowControl = conf->getSubFieldT<pvd::PVBoolean>("monitorFlowControl")->get();
+
+    // threads delivering monitor wakeups downstream, so that a slow server connection
+    // doesn't delay the client RX thread
+    unsigned nnotifiers = conf->getSubFieldT<pvd::PVUInt>("notifyWorkers")->get();
+    if(nnotifiers==0)
+        nnotifiers = 2;
+    ret->cache.notifier.start(nnotifiers);
+
     return ret;
 }
 
@@ -174,12 +253,60 @@ pva::ServerContext::shared_pointer configure_server(ServerConfig& arg, const pvd
     pvd::PVStringArray::const_svector names(clients->view());
     std::vector<pva::ChannelProvider::shared_pointer> providers;
 
+    GWServerOptions options;
+    options.stats.reset(new ServerStats);
+    options.getHoldoff = conf->getSubFieldT<pvd::PVDouble>("getHoldoff")->get();
+    options.getFromMonitor = conf->getSubFieldT<pvd::PVBoolean>("getFromMonitor")->get();
+    options.combinePuts = conf->getSubFieldT<pvd::PVBoolean>("combinePuts")->get();
+
+    // subscription queue settings by channel name and client address.  first match applies.
+    pvd::PVStructureArray::const_svector policies(conf->getSubFieldT<pvd::PVStructureArray>("monitorPolicies")->view());
+    for(size_t i=0; i<policies.size(); i++) {
+        if(!policies[i]) continue;
+        const pvd::PVStructurePtr& pconf = policies[i];
+
+        MonitorPolicy::shared_pointer policy(new MonitorPolicy);
+        policy->name = pconf->getSubFieldT<pvd::PVString>("name")->get();
+        policy->channel = pconf->getSubFieldT<pvd::PVString>("channel")->get();
+        policy->client = pconf->getSubFieldT<pvd::PVString>("client")->get();
+        policy->queueSize = pconf->getSubFieldT<pvd::PVUInt>("queueSize")->get();
+        policy->maxRate = pconf->getSubFieldT<pvd::PVDouble>("maxRate")->get();
+        policy->deadband.abs = pconf->getSubFieldT<pvd::PVDouble>("deadband")->get();
+        policy->deadband.rel = pconf->getSubFieldT<pvd::PVDouble>("relDeadband")->get();
+
+        std::string pass(pconf->getSubFieldT<pvd::PVString>("deadbandPass")->get());
+        if(!policy->deadband.parsePass(pass))
+            throw std::runtime_error(std::string("Monitor policy deadbandPass must be \"alarm\", \"all\", or \"none\" : ")+pass);
+
+        std::string drop(pconf->getSubFieldT<pvd::PVString>("drop")->get());
+        if(drop=="oldest")
+            policy->dropOldest = true;
+        else if(!drop.empty() && drop!="squash")
+            throw std::runtime_error(std::string("Monitor policy drop must be \"squash\" or \"oldest\" : ")+drop);
+
+        if(policy->name.empty()) {
+            std::ostringstream strm;
+            strm<<name<<"#"<<i;
+            policy->name = strm.str();
+        }
+        options.monitorPolicies.push_back(policy);
+    }
+    arg.serverOptions[name] = options;
+
     for(pvd::PVStringArray::const_svector::const_iterator it(names.begin()), end(names.end()); it!=end; ++it)
     {
         ServerConfig::clients_t::const_iterator it2(arg.clients.find(*it));
         if(it2==arg.clients.end())
             throw std::runtime_error("Server references non-existant client");
-        providers.push_back(it2->second);
+        providers.push_back(GWServerView::shared_pointer(new GWServerView(it2->second, options)));
+    }
+
+    // status PVs
+    std::string prefix(conf->getSubFieldT<pvd::PVString>("control_prefix")->get());
+    if(!prefix.empty()) {
+        StatsProvider::shared_pointer stats(new StatsProvider(prefix));
+        providers.push_back(stats);
+        arg.statsProviders.push_back(stats);
     }
 
     pva::ServerContext::shared_pointer ret(pva::ServerContext::create(pva::ServerContext::Config()
@@ -235,6 +362,34 @@ void gwcr(int lvl, const char *client, const char *channel)
     }
 }
 
+void gwstats(const char *file)
+{
+    if(!theserver)
+        return;
+    try {
+        theserver->write_stats(file);
+    }catch(std::exception& e){
+        std::cout<<"Error: "<<e.what()<<"\n";
+    }
+}
+
+struct StatsUpdater : public epicsTimerNotify
+{
+    ServerConfig& conf;
+    const double period;
+    StatsUpdater(ServerConfig& conf, double period) :conf(conf), period(period) {}
+    virtual ~StatsUpdater() {}
+    virtual expireStatus expire(const epicsTime& currentTime)
+    {
+        try {
+            conf.update_stats();
+        }catch(std::exception& e){
+            errlogPrintf("p2p: Error updating statistics: %s\n", e.what());
+        }
+        return expireStatus(restart, period);
+    }
+};
+
 }// namespace
 
 int main(int argc, char *argv[])
@@ -245,6 +400,7 @@ int main(int argc, char *argv[])
         epics::iocshRegister<const char*, const char*, &iocsh_drop>("drop", "client", "channel");
         epics::iocshRegister<int, const char*, &gwsr>("gwsr", "level", "channel");
         epics::iocshRegister<int, const char*, const char*, &gwcr>("gwcr", "level", "client", "channel");
+        epics::iocshRegister<const char*, &gwstats>("gwstats", "file");
 
         libComRegister();
         registerReadOnly();
@@ -253,6 +409,10 @@ int main(int argc, char *argv[])
         epics::registerRefCounter("GWChannel", &GWChannel::num_instances);
         epics::registerRefCounter("MonitorCacheEntry", &MonitorCacheEntry::num_instances);
         epics::registerRefCounter("MonitorUser", &MonitorUser::num_instances);
+        epics::registerRefCounter("GetCacheEntry", &GetCacheEntry::num_instances);
+        epics::registerRefCounter("GetUser", &GetUser::num_instances);
+        epics::registerRefCounter("PutCacheEntry", &PutCacheEntry::num_instances);
+        epics::registerRefCounter("PutUser", &PutUser::num_instances);
 
         ServerConfig arg;
         theserver = &arg;
@@ -322,6 +482,22 @@ int main(int argc, char *argv[])
             arg.servers[name] = configure_server(arg, server);
         }
 
+        // periodic statistics file and status PVs
+        arg.statsFile = arg.conf->getSubFieldT<pvd::PVString>("statsFile")->get();
+        arg.statsPerChannel = arg.conf->getSubFieldT<pvd::PVBoolean>("statsPerChannel")->get();
+        double statsPeriod = arg.conf->getSubFieldT<pvd::PVDouble>("statsPeriod")->get();
+        if(statsPeriod<=0.0)
+            statsPeriod = 10.0;
+
+        epicsTimerQueueActive *statsQueue = 0;
+        epicsTimer *statsTimer = 0;
+        StatsUpdater statsUpdater(arg, statsPeriod);
+        if(!arg.statsFile.empty() || !arg.statsProviders.empty()) {
+            statsQueue = &epicsTimerQueueActive::allocate(true, epicsThreadPriorityLow);
+            statsTimer = &statsQueue->createTimer();
+            statsTimer->start(statsUpdater, 0.0);
+        }
+
         int ret = 0;
         if(arg.interactive) {
             ret = iocsh(NULL);
@@ -337,6 +513,11 @@ int main(int argc, char *argv[])
             }
         }
 
+        if(statsTimer) {
+            statsTimer->destroy();
+            statsQueue->release();
+        }
+
         theserver = 0;
 
         return ret;
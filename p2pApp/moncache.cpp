@@ -1,9 +1,14 @@
 
+#include <algorithm>
+#include <cmath>
+
 #include <epicsAtomic.h>
 #include <errlog.h>
 
 #include <epicsMutex.h>
 #include <epicsTimer.h>
+#include <epicsString.h>
+#include <epicsEndian.h>
 
 #include <pv/pvAccess.h>
 
@@ -29,19 +34,230 @@ T getS(const pvd::PVStructurePtr& s, const char* name, T dft)
         return dft;
     }
 }
+
+// seconds between updates for the lower of two rates.  zero for no limit.
+double rateInterval(double rateA, double rateB)
+{
+    double rate = rateA>0.0 ? rateA : rateB;
+    if(rateB>0.0)
+        rate = std::min(rate, rateB);
+    return rate>0.0 ? 1.0/rate : 0.0;
+}
+}
+
+MonitorNotifier::MonitorNotifier()
+    :queue("p2pNotify")
+    ,active(false)
+    ,depth(0u)
+    ,maxDepth(0u)
+    ,nqueued(0u)
+    ,ncoalesced(0u)
+    ,maxLatency(0.0)
+{}
+
+void MonitorNotifier::start(unsigned nworkers)
+{
+    queue.start(nworkers, epicsThreadPriorityCAServerLow);
+    Guard G(mutex);
+    active = true;
+}
+
+void MonitorNotifier::close()
+{
+    {
+        Guard G(mutex);
+        active = false;
+    }
+    queue.close();
+}
+
+bool MonitorNotifier::add(const WorkQueue::value_type& usr)
+{
+    {
+        Guard G(mutex);
+        if(!active)
+            return false;
+        depth++;
+        nqueued++;
+        maxDepth = std::max(maxDepth, depth);
+    }
+    if(!queue.add(usr)) { // close()d meanwhile
+        Guard G(mutex);
+        depth--;
+        nqueued--;
+        return false;
+    }
+    return true;
+}
+
+const double MonitorFlusher::tick = 0.02;
+
+MonitorFlusher::MonitorFlusher()
+    :epoch(epicsTime::getCurrent())
+    ,lastTick(0u)
+    ,pending(0u)
+    ,stopping(false)
+    ,nflushed(0u)
+    ,worker(NULL)
+{}
+
+MonitorFlusher::~MonitorFlusher()
+{
+    close();
+}
+
+void MonitorFlusher::close()
+{
+    epicsThread *W;
+    {
+        Guard G(mutex);
+        stopping = true;
+        W = worker;
+        worker = NULL;
+    }
+    if(W) {
+        wakeup.signal();
+        W->exitWait();
+        delete W;
+    }
+}
+
+size_t MonitorFlusher::tickOf(const epicsTime& t) const
+{
+    double dt = t - epoch;
+    return dt<=0.0 ? 0u : size_t(dt/tick);
+}
+
+void MonitorFlusher::add(const std::tr1::shared_ptr<MonitorUser>& usr, const epicsTime& due)
+{
+    bool wake;
+    {
+        Guard G(mutex);
+        if(stopping)
+            return;
+        if(!worker) {
+            worker = new epicsThread(*this, "p2pFlush",
+                                     epicsThreadGetStackSize(epicsThreadStackSmall),
+                                     epicsThreadPriorityCAServerLow);
+            worker->start();
+        }
+        // the slot after the one containing due, so that due has passed when it is processed
+        size_t n = std::max(tickOf(due), lastTick)+1u;
+        slots[n%nslots].push_back(std::make_pair(due, std::tr1::weak_ptr<MonitorUser>(usr)));
+        wake = !pending++;
+    }
+    if(wake)
+        wakeup.signal();
+}
+
+void MonitorFlusher::run()
+{
+    std::vector<std::tr1::shared_ptr<MonitorUser> > due;
+    Guard G(mutex);
+
+    while(!stopping) {
+        if(!pending) {
+            UnGuard U(G);
+            wakeup.wait();
+            continue;
+        }
+
+        {
+            UnGuard U(G);
+            wakeup.wait(tick);
+        }
+
+        epicsTime now(epicsTime::getCurrent());
+        size_t cur = tickOf(now);
+
+        // visit each slot at most once
+        for(size_t n = cur>lastTick ? std::min<size_t>(cur-lastTick, nslots) : 0u; n; n--) {
+            slot_t& S = slots[(cur-n+1u)%nslots];
+
+            for(size_t i=0; i<S.size();) {
+                if(S[i].first <= now) {
+                    std::tr1::shared_ptr<MonitorUser> usr(S[i].second.lock());
+                    if(usr)
+                        due.push_back(usr);
+                    S[i] = S.back();
+                    S.pop_back();
+                    pending--;
+                } else {
+                    i++; // waiting for a later turn of the wheel
+                }
+            }
+        }
+        lastTick = std::max(lastTick, cur);
+        nflushed += due.size();
+
+        if(!due.empty()) {
+            UnGuard U(G);
+
+            FOREACH(std::vector<std::tr1::shared_ptr<MonitorUser> >::iterator, it, end, due) {
+                (*it)->flush();
+            }
+            due.clear();
+        }
+    }
+}
+
+bool Deadband::parsePass(const std::string& pass)
+{
+    if(pass.empty() || pass=="alarm") {
+        passAlarm = true;
+        passTimeStamp = false;
+    } else if(pass=="all") {
+        passAlarm = passTimeStamp = true;
+    } else if(pass=="none") {
+        passAlarm = passTimeStamp = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool MonitorPolicy::match(const std::string& channelName, const std::string& peer) const
+{
+    return (channel.empty() || epicsStrGlobMatch(channelName.c_str(), channel.c_str()))
+            && (client.empty() || epicsStrGlobMatch(peer.c_str(), client.c_str()));
 }
 
 MonitorCacheEntry::MonitorCacheEntry(ChannelCacheEntry *ent, const pvd::PVStructure::shared_pointer& pvr)
     :chan(ent)
+    ,notifier(&ent->cache->notifier)
+    ,flusher(&ent->cache->flusher)
+    ,stats(&ent->cache->stats)
     ,bufferSize(getS<pvd::uint32>(pvr, "record._options.queueSize", 2)) // should be same default as pvAccess, but not required
+    ,snapshot(ent->cache->snapshotMonitors)
+    ,flowControl(ent->cache->monitorFlowControl)
+    ,fieldreq(fieldRequest(pvr))
     ,havedata(false)
     ,done(false)
     ,nwakeups(0)
     ,nevents(0)
+    ,nblocked(0)
+    ,resumeQueued(false)
+    ,alarmBegin(0u)
+    ,alarmEnd(0u)
+    ,timeBegin(0u)
+    ,timeEnd(0u)
 {
     epicsAtomicIncrSizeT(&num_instances);
 }
 
+MonitorCacheEntry::pvrequest_t
+MonitorCacheEntry::fieldRequest(const pvd::PVStructurePtr& pvRequest)
+{
+    pvrequest_t ret;
+    pvd::PVStructurePtr field;
+    if(pvRequest)
+        field = pvRequest->getSubField<pvd::PVStructure>("field");
+    // "field()" is the same as no "field"
+    if(field && !field->getPVFields().empty())
+        pvd::serializeToVector(field.get(), EPICS_BYTE_ORDER, ret);
+    return ret;
+}
+
 MonitorCacheEntry::~MonitorCacheEntry()
 {
     pvd::Monitor::shared_pointer M;
@@ -58,7 +274,7 @@ MonitorCacheEntry::monitorConnect(pvd::Status const & status,
                                   pvd::MonitorPtr const & monitor,
                                   pvd::StructureConstPtr const & structure)
 {
-    interested_t::vector_type tonotify;
+    interested_t::snapshot_pointer tonotify;
     {
         Guard G(mutex());
         if(typedesc) {
@@ -79,11 +295,28 @@ MonitorCacheEntry::monitorConnect(pvd::Status const & status,
 
         if(startresult.isSuccess()) {
             lastelem.reset(new pvd::MonitorElement(pvd::getPVDataCreate()->createPVStructure(structure)));
+
+            const pvd::PVStructurePtr& root = lastelem->pvStructurePtr;
+            pvd::PVScalarPtr value(root->getSubField<pvd::PVScalar>("value"));
+            if(value) {
+                pvd::ScalarType vtype = value->getScalar()->getScalarType();
+                if(vtype!=pvd::pvBoolean && vtype!=pvd::pvString)
+                    valueField = value;
+            }
+            pvd::PVFieldPtr fld;
+            if(!!(fld = root->getSubField("alarm"))) {
+                alarmBegin = fld->getFieldOffset();
+                alarmEnd = fld->getNextFieldOffset();
+            }
+            if(!!(fld = root->getSubField("timeStamp"))) {
+                timeBegin = fld->getFieldOffset();
+                timeEnd = fld->getNextFieldOffset();
+            }
         }
 
         // set typedesc and startresult for futured MonitorUsers
-        // and copy snapshot of already interested MonitorUsers
-        tonotify = interested.lock_vector();
+        // and snapshot of already interested MonitorUsers
+        tonotify = interested.snapshot();
     }
 
     if(!startresult.isSuccess())
@@ -91,12 +324,15 @@ MonitorCacheEntry::monitorConnect(pvd::Status const & status,
 
     shared_pointer self(weakref); // keeps us alive all MonitorUsers are destroy()ed
 
-    for(interested_t::vector_type::const_iterator it = tonotify.begin(),
-        end = tonotify.end(); it!=end; ++it)
+    for(interested_t::snapshot_type::const_iterator it = tonotify->begin(),
+        end = tonotify->end(); it!=end; ++it)
     {
-        pvd::MonitorRequester::shared_pointer req((*it)->req);
+        MonitorUser::shared_pointer usr(it->lock());
+        if(!usr)
+            continue;
+        pvd::MonitorRequester::shared_pointer req(usr->req);
         if(req) {
-            req->monitorConnect(startresult, *it, structure);
+            req->monitorConnect(startresult, usr, structure);
         }
     }
 }
@@ -119,30 +355,56 @@ MonitorCacheEntry::monitorEvent(pvd::MonitorPtr const & monitor)
      */
 
     epicsAtomicIncrSizeT(&nwakeups);
+    stats->upstreamWakeups.add();
 
     shared_pointer self(weakref); // keeps us alive in case all MonitorUsers are destroy()ed
 
     pva::MonitorElementPtr update;
 
     typedef std::vector<MonitorUser::shared_pointer> dsnotify_t;
-    dsnotify_t dsnotify;
+    dsnotify_t dsnotify, toflush;
 
     {
         Guard G(mutex()); // MCE and MU guarded by the same mutex
-        if(!havedata)
-            havedata = true;
+        blocked.reset();
 
-        //TODO: flow control, if all MU buffers are full, break before poll()==NULL
-        while((update=monitor->poll()))
+        for(;;)
         {
+            if(flowControl && havedata) {
+                // leave updates in the upstream queue until some MonitorUser has space.
+                // With pipeline=true this also withholds acknowledgements from upstream
+                bool space = false;
+                interested_t::iterator IIT(interested);
+                for(interested_t::value_pointer pusr = IIT.next(); !space && pusr; pusr = IIT.next())
+                    space = !pusr->initial && pusr->running && pusr->queue.numFree();
+
+                if(!space) {
+                    blocked = monitor; // until MonitorUser::start() or release()
+                    nblocked++;
+                    break;
+                }
+            }
+
+            if(!(update=monitor->poll()))
+                break;
+
             epicsAtomicIncrSizeT(&nevents);
+            stats->upstreamEvents.add();
+            havedata = true;
+            ingestTime = epicsTime::getCurrent();
 
             lastelem->pvStructurePtr->copyUnchecked(*update->pvStructurePtr,
                                                     *update->changedBitSet);
+            {
+                size_t nbytes = updateBytes(*update->pvStructurePtr, *update->changedBitSet);
+                bytes.record(nbytes);
+                stats->bytes.record(nbytes);
+            }
             *lastelem->changedBitSet = *update->changedBitSet;
             *lastelem->overrunBitSet = *update->overrunBitSet;
             monitor->release(update);
             update.reset();
+            lastsnap.reset(); // out of date, any previous remains with MonitorUser queues
 
             interested_t::iterator IIT(interested); // recursively locks interested.mutex() (assumes this->mutex() is interestd.mutex())
             for(interested_t::value_pointer pusr = IIT.next(); pusr; pusr = IIT.next())
@@ -153,59 +415,140 @@ MonitorCacheEntry::monitorEvent(pvd::MonitorPtr const & monitor)
                     Guard G(usr->mutex());
                     if(usr->initial)
                         continue; // no start() yet
-                    // TODO: track overflow when !running (after stop())?
-                    if(!usr->running || usr->empty.empty()) {
-                        usr->inoverflow = true;
 
-                        /* overrun |= lastelem->overrun           // upstream overflows
-                         * overrun |= changed & lastelem->changed // downstream overflows
-                         * changed |= lastelem->changed           // accumulate changes
-                         */
+                    MonitorPolicy *policy = usr->policy.get();
+
+                    if(usr->deadband.enabled() && usr->suppress()) {
+                        epicsAtomicIncrSizeT(&usr->nsuppressed);
+                        stats->suppressed.add();
+                        if(policy)
+                            epicsAtomicIncrSizeT(&policy->nsuppressed);
+                        continue;
+                    }
+
+                    bool full = !usr->running || !usr->queue.numFree();
+
+                    if(usr->held) {
+                        // rate limited.  accumulate until flush()
+                        usr->accumulate(*lastelem);
+                        stats->decimated.add();
+                        if(policy)
+                            epicsAtomicIncrSizeT(&policy->ndecimated);
+                        continue;
+
+                    } else if(full && usr->running && !usr->inoverflow && policy && policy->dropOldest
+                              && usr->queue.numFilled()) {
+                        // discard the oldest queued update in favor of this one
+                        MonitorSlots& Q = usr->queue;
+                        size_t slot = Q.recycle();
+                        pvd::MonitorElementPtr& elem = Q[slot];
+
+                        pvd::BitSet changed(*lastelem->changedBitSet),
+                                    overrun(*lastelem->overrunBitSet);
+                        if(Q.numFilled()==1u) {
+                            // no newer update to carry the discarded changes.
+                            // keeps the stamp of the discarded update
+                            overrun |= *elem->overrunBitSet;
+                            overrun.or_and(changed, *elem->changedBitSet);
+                            changed |= *elem->changedBitSet;
+                        } else {
+                            Q.oldestStamp() = Q.stamp(slot);
+                            Q.stamp(slot) = ingestTime;
+                            // the next oldest update has complete values,
+                            // but must also show the fields changed by the discarded update.
+                            pvd::MonitorElement& next = *Q.oldest();
+                            *next.overrunBitSet |= *elem->overrunBitSet;
+                            next.overrunBitSet->or_and(*next.changedBitSet, *elem->changedBitSet);
+                            *next.changedBitSet |= *elem->changedBitSet;
+                        }
+
+                        if(snapshot) {
+                            elem.reset(new pvd::MonitorElement(getSnapshot()));
+                        } else {
+                            elem->pvStructurePtr->copyUnchecked(*lastelem->pvStructurePtr);
+                        }
+                        *elem->changedBitSet = changed;
+                        *elem->overrunBitSet = overrun;
 
-                        *usr->overflowElement->overrunBitSet |= *lastelem->overrunBitSet;
-                        usr->overflowElement->overrunBitSet->or_and(*usr->overflowElement->changedBitSet,
-                                                                    *lastelem->changedBitSet);
-                        *usr->overflowElement->changedBitSet |= *lastelem->changedBitSet;
+                        epicsAtomicIncrSizeT(&usr->ndropped);
+                        epicsAtomicIncrSizeT(&policy->ndropped);
+                        stats->downstreamDrops.add();
+                        continue;
 
-                        usr->overflowElement->pvStructurePtr->copyUnchecked(*lastelem->pvStructurePtr,
-                                                                            *lastelem->changedBitSet);
+                    } else if(full) {
+                        // TODO: track overflow when !running (after stop())?
+                        usr->inoverflow = true;
+                        usr->accumulate(*lastelem);
 
                         epicsAtomicIncrSizeT(&usr->ndropped);
+                        stats->downstreamDrops.add();
+                        if(policy)
+                            epicsAtomicIncrSizeT(&policy->nsquashed);
                         continue;
                     }
                     // we only come out of overflow when downstream release()s an element to us
-                    // empty.empty() does not imply inoverflow,
-                    // however inoverflow does imply empty.empty()
+                    // !numFree() does not imply inoverflow,
+                    // however inoverflow does imply !numFree()
                     assert(!usr->inoverflow);
 
-                    if(usr->filled.empty())
+                    if(usr->minInterval>0.0) {
+                        if(ingestTime - usr->lastSent < usr->minInterval) {
+                            // too soon, hold back until lastSent+minInterval
+                            usr->held = true;
+                            usr->accumulate(*lastelem);
+                            if(!usr->flushScheduled) {
+                                usr->flushScheduled = true;
+                                toflush.push_back(pusr);
+                            }
+                            stats->decimated.add();
+                            if(policy)
+                                epicsAtomicIncrSizeT(&policy->ndecimated);
+                            continue;
+                        }
+                        usr->lastSent = ingestTime;
+                    }
+
+                    if(!usr->queue.numFilled())
                         dsnotify.push_back(pusr);
 
-                    pvd::MonitorElementPtr elem(usr->empty.front());
+                    size_t slot = usr->queue.nextFree();
+                    pvd::MonitorElementPtr& elem = usr->queue[slot];
+                    if(snapshot) {
+                        // only the bit masks are private to this MonitorUser
+                        elem.reset(new pvd::MonitorElement(getSnapshot()));
+                    } else {
+                        // Note: can't use changed mask to optimize this copy since we don't know
+                        //       the state of the free element
+                        elem->pvStructurePtr->copyUnchecked(*lastelem->pvStructurePtr);
+                    }
 
                     *elem->overrunBitSet = *lastelem->overrunBitSet;
                     *elem->changedBitSet = *lastelem->changedBitSet;
-                    // Note: can't use changed mask to optimize this copy since we don't know
-                    //       the state of the free element
-                    elem->pvStructurePtr->copyUnchecked(*lastelem->pvStructurePtr);
+                    usr->queue.stamp(slot) = ingestTime;
 
-                    usr->filled.push_back(elem);
-                    usr->empty.pop_front();
+                    usr->queue.fill();
 
                     epicsAtomicIncrSizeT(&usr->nevents);
+                    stats->downstreamEvents.add();
                 }
             }
         }
     }
 
     // unlock here, race w/ stop(), unlisten()?
-    //TODO: notify from worker thread
 
     FOREACH(dsnotify_t::iterator, it,end,dsnotify) {
-        MonitorUser *usr = (*it).get();
-        pvd::MonitorRequester::shared_pointer req(usr->req);
-        epicsAtomicIncrSizeT(&usr->nwakeups);
-        req->monitorEvent(*it); // notify when first item added to empty queue, may call poll(), release(), and others
+        (*it)->notify(); // notify when first item added to empty queue
+    }
+
+    FOREACH(dsnotify_t::iterator, it,end,toflush) {
+        MonitorUser *usr = it->get();
+        epicsTime due;
+        {
+            Guard G(mutex());
+            due = usr->lastSent + usr->minInterval;
+        }
+        flusher->add(*it, due);
     }
 }
 
@@ -214,11 +557,12 @@ void
 MonitorCacheEntry::unlisten(pvd::MonitorPtr const & monitor)
 {
     pvd::Monitor::shared_pointer M;
-    interested_t::vector_type tonotify;
+    interested_t::snapshot_pointer tonotify;
     {
         Guard G(mutex());
         M.swap(mon);
-        tonotify = interested.lock_vector();
+        blocked.reset();
+        tonotify = interested.snapshot();
         // assume that upstream won't call monitorEvent() again
 
         // cause future downstream start() to error
@@ -227,11 +571,13 @@ MonitorCacheEntry::unlisten(pvd::MonitorPtr const & monitor)
     if(M) {
         M->destroy();
     }
-    FOREACH(interested_t::vector_type::iterator, it, end, tonotify) {
-        MonitorUser *usr = it->get();
+    FOREACH(interested_t::snapshot_type::const_iterator, it, end, *tonotify) {
+        MonitorUser::shared_pointer usr(it->lock());
+        if(!usr)
+            continue;
         pvd::MonitorRequester::shared_pointer req(usr->req);
-        if(usr->inuse.empty()) // TODO: what about stopped?
-            req->unlisten(*it);
+        if(!usr->queue.numOut()) // TODO: what about stopped?
+            req->unlisten(usr);
     }
 }
 
@@ -241,19 +587,77 @@ MonitorCacheEntry::getRequesterName()
     return "MonitorCacheEntry";
 }
 
-MonitorUser::MonitorUser(const MonitorCacheEntry::shared_pointer &e)
+void
+MonitorCacheEntry::resume()
+{
+    {
+        Guard G(mutex());
+        if(!blocked || resumeQueued)
+            return;
+        resumeQueued = true;
+    }
+    // monitorEvent() may copy to every MonitorUser, so not on the downstream thread
+    // which called release().  Unless there are no workers.
+    if(!notifier->queue.add(weakref))
+        run();
+}
+
+// from MonitorNotifier worker
+void
+MonitorCacheEntry::run()
+{
+    pvd::MonitorPtr M;
+    {
+        Guard G(mutex());
+        resumeQueued = false;
+        M = blocked;
+    }
+    if(M)
+        monitorEvent(M);
+}
+
+const pvd::PVStructurePtr&
+MonitorCacheEntry::getSnapshot()
+{
+    if(!lastsnap) {
+        // shallow, array values are shared with lastelem
+        pvd::PVStructurePtr snap(pvd::getPVDataCreate()->createPVStructure(typedesc));
+        snap->copyUnchecked(*lastelem->pvStructurePtr);
+        snap->setImmutable();
+        lastsnap = snap;
+    }
+    return lastsnap;
+}
+
+MonitorUser::MonitorUser(const MonitorCacheEntry::shared_pointer &e,
+                         const MonitorPolicy::shared_pointer& policy,
+                         double maxRate,
+                         const Deadband& deadband)
     :entry(e)
     ,initial(true)
     ,running(false)
     ,inoverflow(false)
     ,nevents(0)
     ,ndropped(0)
+    ,notifyQueued(false)
+    ,policy(policy)
+    ,minInterval(rateInterval(policy ? policy->maxRate : 0.0, maxRate))
+    ,held(false)
+    ,flushScheduled(false)
+    ,deadband(deadband)
+    ,haveLastValue(false)
+    ,lastValue(0.0)
+    ,nsuppressed(0u)
 {
     epicsAtomicIncrSizeT(&num_instances);
 }
 
 MonitorUser::~MonitorUser()
 {
+    if(notifyQueued) { // run() won't happen
+        Guard G(entry->notifier->mutex);
+        entry->notifier->depth--;
+    }
     epicsAtomicDecrSizeT(&num_instances);
 }
 
@@ -289,34 +693,46 @@ MonitorUser::start()
         if(initial) {
             initial = false;
 
-            empty.resize(entry->bufferSize);
+            queue.resize(policy && policy->queueSize ? policy->queueSize : entry->bufferSize);
             pvd::PVDataCreatePtr fact(pvd::getPVDataCreate());
-            for(unsigned i=0; i<empty.size(); i++) {
-                empty[i].reset(new pvd::MonitorElement(fact->createPVStructure(typedesc)));
+            for(size_t i=0; !entry->snapshot && i<queue.capacity(); i++) {
+                queue[i].reset(new pvd::MonitorElement(fact->createPVStructure(typedesc)));
             }
 
             // extra element to accumulate updates during overflow
             overflowElement.reset(new pvd::MonitorElement(fact->createPVStructure(typedesc)));
         }
 
-        doEvt = filled.empty();
+        doEvt = !queue.numFilled();
 
-        if(lval && !empty.empty()) {
+        if(lval && queue.numFree()) {
             //already running, notify of initial element
 
-            const pva::MonitorElementPtr& elem(empty.front());
-            elem->pvStructurePtr->copy(*lval);
+            size_t slot = queue.nextFree();
+            pva::MonitorElementPtr& elem = queue[slot];
+            if(entry->snapshot) {
+                elem.reset(new pvd::MonitorElement(entry->getSnapshot()));
+            } else {
+                elem->pvStructurePtr->copy(*lval);
+            }
             elem->changedBitSet->set(0); // indicate all changed
             elem->overrunBitSet->clear();
-            filled.push_back(elem);
-            empty.pop_front();
+            lastSent = queue.stamp(slot) = epicsTime::getCurrent();
+            queue.fill();
+
+            if(entry->valueField) {
+                lastValue = entry->valueField->getAs<double>();
+                haveLastValue = true;
+            }
         }
 
-        doEvt &= !filled.empty();
+        doEvt &= !!queue.numFilled();
         running = true;
     }
     if(doEvt)
-        req->monitorEvent(shared_pointer(weakref)); // TODO: worker thread?
+        notify();
+    if(entry->flowControl)
+        entry->resume();
     return pvd::Status();
 }
 
@@ -332,46 +748,174 @@ pva::MonitorElementPtr
 MonitorUser::poll()
 {
     Guard G(mutex());
-    pva::MonitorElementPtr ret;
-    if(!filled.empty()) {
-        ret = filled.front();
-        inuse.insert(ret); // track which ones are out for client use
-        filled.pop_front();
-        //TODO: track lost buffers w/ wrapped shared_ptr?
+    epicsTime stamp;
+    pva::MonitorElementPtr ret(queue.poll(&stamp));
+    if(ret) {
+        double latency = epicsTime::getCurrent() - stamp;
+        entry->latency.record(latency);
+        entry->stats->latency.record(latency);
     }
+#ifdef P2P_TRACK_INUSE
+    if(ret)
+        inuse.insert(ret); // track which ones are out for client use
+#endif
+    //TODO: track lost buffers w/ wrapped shared_ptr?
     return ret;
 }
 
 void
 MonitorUser::release(pva::MonitorElementPtr const & monitorElement)
 {
-    Guard G(mutex());
-    //TODO: ifdef DEBUG? (only track inuse when debugging?)
-    std::set<epics::pvData::MonitorElementPtr>::iterator it = inuse.find(monitorElement);
-    if(it!=inuse.end()) {
-        inuse.erase(it);
+    {
+        Guard G(mutex());
+        size_t slot = queue.find(monitorElement);
+#ifdef P2P_TRACK_INUSE
+        assert((slot!=MonitorSlots::npos) == (inuse.find(monitorElement)!=inuse.end()));
+        inuse.erase(monitorElement);
+#endif
+        if(slot==MonitorSlots::npos) {
+            // oh no, we've been given an element which we didn't give to downstream
+            throw std::invalid_argument("Can't release MonitorElement not in use");
 
-        if(inoverflow) { // leaving overflow condition
+        } else if(inoverflow) { // leaving overflow condition
 
             // to avoid copy, enqueue the current overflowElement
-            // and replace it with the element being release()d
+            // in place of the element being release()d
 
-            filled.push_back(overflowElement);
-            overflowElement = monitorElement;
-            overflowElement->changedBitSet->clear();
-            overflowElement->overrunBitSet->clear();
+            queue[slot].swap(overflowElement);
+            queue.stamp(slot) = overflowStamp;
+            queue.refill(slot);
+
+            resetOverflow();
 
             inoverflow = false;
+            held = false;
+            lastSent = epicsTime::getCurrent();
         } else {
-            // push_back empty element
-            empty.push_back(monitorElement);
+            if(entry->snapshot) {
+                if(!queue[slot]->pvStructurePtr->isImmutable())
+                    spares.push_back(queue[slot]); // a former overflowElement
+                queue[slot].reset(); // don't hold a reference to the released snapshot
+            }
+            queue.release(slot);
+        }
+    }
+    if(entry->flowControl)
+        entry->resume();
+}
+
+void
+MonitorUser::accumulate(const pvd::MonitorElement& update)
+{
+    /* overrun |= update->overrun           // upstream overflows
+     * overrun |= changed & update->changed // downstream overflows
+     * changed |= update->changed           // accumulate changes
+     */
+
+    if(overflowElement->changedBitSet->isEmpty())
+        overflowStamp = entry->ingestTime; // first update since last queued
+
+    *overflowElement->overrunBitSet |= *update.overrunBitSet;
+    overflowElement->overrunBitSet->or_and(*overflowElement->changedBitSet,
+                                           *update.changedBitSet);
+    *overflowElement->changedBitSet |= *update.changedBitSet;
+
+    overflowElement->pvStructurePtr->copyUnchecked(*update.pvStructurePtr,
+                                                   *update.changedBitSet);
+}
+
+void
+MonitorUser::resetOverflow()
+{
+    if(entry->snapshot && (!overflowElement || overflowElement->pvStructurePtr->isImmutable())) {
+        // a snapshot is shared with other MonitorUsers, so it can't
+        // be used to accumulate.  Only changed fields will be sent,
+        // so the initial value of the private element doesn't matter.
+        if(spares.empty()) {
+            overflowElement.reset(new pvd::MonitorElement(pvd::getPVDataCreate()->createPVStructure(entry->typedesc)));
+        } else {
+            overflowElement = spares.back();
+            spares.pop_back();
         }
-    } else {
-        // oh no, we've been given an element which we didn't give to downstream
-        //TODO: check empty and filled lists to see if this is one of ours, of from somewhere else
-        throw std::invalid_argument("Can't release MonitorElement not in use");
     }
-    // TODO: pipeline window update?
+    overflowElement->changedBitSet->clear();
+    overflowElement->overrunBitSet->clear();
+}
+
+bool
+MonitorUser::suppress()
+{
+    const MonitorCacheEntry& E = *entry;
+    if(!E.valueField)
+        return false; // no value, or not a number
+
+    const pvd::BitSet& changed = *E.lastelem->changedBitSet;
+    const size_t valueBit = E.valueField->getFieldOffset();
+    const double value = E.valueField->getAs<double>();
+
+    bool valueChanged = changed.get(0) || changed.get(valueBit),
+         pass = changed.get(0) || !haveLastValue;
+
+    for(pvd::int32 bit = changed.nextSetBit(1); !pass && bit>=0; bit = changed.nextSetBit(bit+1)) {
+        size_t b = bit;
+        if(b==valueBit) {
+            // tested below
+        } else if(b>=E.alarmBegin && b<E.alarmEnd) {
+            pass = deadband.passAlarm;
+        } else if(b>=E.timeBegin && b<E.timeEnd) {
+            pass = deadband.passTimeStamp;
+        } else {
+            pass = true; // some other field changed
+        }
+    }
+
+    if(!pass && valueChanged) {
+        double delta = std::fabs(value - lastValue),
+               band = std::max(deadband.abs, deadband.rel*std::fabs(lastValue));
+        pass = delta > band;
+    }
+
+    if(pass && valueChanged) {
+        // downstream will see this value
+        lastValue = value;
+        haveLastValue = true;
+    }
+    return !pass;
+}
+
+// from MonitorFlusher worker
+void
+MonitorUser::flush()
+{
+    bool doEvt;
+    {
+        Guard G(mutex());
+        flushScheduled = false;
+        if(!held)
+            return; // already sent by release()
+        held = false;
+
+        if(inoverflow) {
+            return; // release() will queue overflowElement
+        } else if(!running || !queue.numFree()) {
+            inoverflow = true;
+            return;
+        }
+
+        doEvt = !queue.numFilled();
+
+        size_t slot = queue.nextFree();
+        queue[slot].swap(overflowElement);
+        queue.stamp(slot) = overflowStamp;
+        queue.fill();
+
+        resetOverflow();
+        lastSent = epicsTime::getCurrent();
+        epicsAtomicIncrSizeT(&nevents);
+        entry->stats->downstreamEvents.add();
+    }
+    if(doEvt)
+        notify();
 }
 
 std::string
@@ -379,3 +923,57 @@ MonitorUser::getRequesterName()
 {
     return "MonitorCacheEntry";
 }
+
+void
+MonitorUser::notify()
+{
+    MonitorNotifier *N = entry->notifier;
+    {
+        Guard G(mutex());
+        if(notifyQueued) {
+            Guard G2(N->mutex);
+            N->ncoalesced++;
+            return;
+        }
+        notifyQueued = true;
+        notifyTime = epicsTime::getCurrent();
+    }
+    if(N->add(weakref))
+        return;
+
+    // no workers, deliver from this thread
+    {
+        Guard G(mutex());
+        notifyQueued = false;
+    }
+    pvd::MonitorRequester::shared_pointer req(this->req);
+    epicsAtomicIncrSizeT(&nwakeups);
+    entry->stats->downstreamWakeups.add();
+    req->monitorEvent(shared_pointer(weakref)); // may call poll(), release(), and others
+}
+
+// from MonitorNotifier worker
+void
+MonitorUser::run()
+{
+    MonitorNotifier *N = entry->notifier;
+    bool deliver;
+    double latency;
+    {
+        Guard G(mutex());
+        notifyQueued = false;
+        latency = epicsTime::getCurrent() - notifyTime;
+        deliver = !!queue.numFilled(); // skip if downstream has already poll()'d everything
+    }
+    {
+        Guard G(N->mutex);
+        N->depth--;
+        N->maxLatency = std::max(N->maxLatency, latency);
+    }
+    pvd::MonitorRequester::shared_pointer req(this->req.lock());
+    if(deliver && req) {
+        epicsAtomicIncrSizeT(&nwakeups);
+        entry->stats->downstreamWakeups.add();
+        req->monitorEvent(shared_pointer(weakref));
+    }
+}
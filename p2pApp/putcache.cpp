@@ -0,0 +1,255 @@
+
+#include <epicsAtomic.h>
+#include <errlog.h>
+
+#include <epicsMutex.h>
+
+#include <pv/pvAccess.h>
+
+#define epicsExportSharedSymbols
+#include "helper.h"
+#include "pva2pva.h"
+#include "chancache.h"
+#include "channel.h"
+
+namespace pva = epics::pvAccess;
+namespace pvd = epics::pvData;
+
+size_t PutCacheEntry::num_instances;
+size_t PutUser::num_instances;
+
+PutCacheEntry::PutCacheEntry(ChannelCacheEntry *ent)
+    :chan(ent)
+    ,inprog(false)
+    ,nupstream(0)
+    ,nabsorbed(0)
+{
+    epicsAtomicIncrSizeT(&num_instances);
+}
+
+PutCacheEntry::~PutCacheEntry()
+{
+    pva::ChannelPut::shared_pointer O;
+    O.swap(op);
+    if(O) {
+        O->destroy();
+    }
+    epicsAtomicDecrSizeT(&num_instances);
+    const_cast<ChannelCacheEntry*&>(chan) = NULL; // spoil to fault use after free
+}
+
+std::string
+PutCacheEntry::getRequesterName()
+{
+    return "PutCacheEntry";
+}
+
+void
+PutCacheEntry::channelPutConnect(const pvd::Status& status,
+                                 pva::ChannelPut::shared_pointer const & channelPut,
+                                 pvd::StructureConstPtr const & structure)
+{
+    interested_t::vector_type tonotify;
+    {
+        Guard G(mutex());
+        if(!op) // may be called before createChannelPut() returns
+            op = channelPut;
+        connectresult = status;
+        typedesc = structure;
+        tonotify = interested.lock_vector();
+    }
+
+    shared_pointer self(weakref); // keeps us alive until all PutUsers are destroy()ed
+
+    FOREACH(interested_t::vector_type::iterator, it, end, tonotify) {
+        pva::ChannelPutRequester::shared_pointer req((*it)->req.lock());
+        if(req)
+            req->channelPutConnect(status, *it, structure);
+    }
+}
+
+// start the next upstream operation, if any.  Call with mutex() locked
+void
+PutCacheEntry::next(Guard& G)
+{
+    if(inprog || !op)
+        return;
+
+    pva::ChannelPut::shared_pointer O(op);
+
+    if(pending) {
+        pvd::PVStructurePtr value;
+        pvd::BitSet::shared_pointer changed;
+        value.swap(pending);
+        changed.swap(pendingChanged);
+        inflight.swap(pendingUsers);
+        inprog = true;
+        nupstream++;
+
+        UnGuard U(G);
+        O->put(value, changed);
+
+    } else if(!getwaiting.empty()) {
+        getting.swap(getwaiting);
+        inprog = true;
+
+        UnGuard U(G);
+        O->get();
+    }
+}
+
+void
+PutCacheEntry::put(const PutUser::shared_pointer& usr,
+                   const pvd::PVStructurePtr& value,
+                   const pvd::BitSet::shared_pointer& changed)
+{
+    {
+        Guard G(mutex());
+        if(op && typedesc) {
+            // always merge, so that the order of put()s is kept
+            if(!pending) {
+                pending = pvd::getPVDataCreate()->createPVStructure(typedesc);
+                pendingChanged.reset(new pvd::BitSet);
+            } else {
+                nabsorbed++;
+            }
+            pending->copyUnchecked(*value, *changed);
+            *pendingChanged |= *changed;
+            pendingUsers.push_back(usr);
+
+            next(G);
+            return;
+        }
+    }
+
+    pva::ChannelPutRequester::shared_pointer req(usr->req.lock());
+    if(req)
+        req->putDone(pvd::Status(pvd::Status::STATUSTYPE_ERROR, "Not connected"), usr);
+}
+
+void
+PutCacheEntry::get(const PutUser::shared_pointer& usr)
+{
+    {
+        Guard G(mutex());
+        if(op && typedesc) {
+            getwaiting.push_back(usr);
+            next(G);
+            return;
+        }
+    }
+
+    pva::ChannelPutRequester::shared_pointer req(usr->req.lock());
+    if(req)
+        req->getDone(pvd::Status(pvd::Status::STATUSTYPE_ERROR, "Not connected"), usr,
+                     pvd::PVStructurePtr(), pvd::BitSet::shared_pointer());
+}
+
+void
+PutCacheEntry::putDone(const pvd::Status& status,
+                       pva::ChannelPut::shared_pointer const & channelPut)
+{
+    std::vector<PutUser::shared_pointer> tonotify;
+    {
+        Guard G(mutex());
+        inprog = false;
+        tonotify.swap(inflight);
+    }
+
+    shared_pointer self(weakref); // keeps us alive until all PutUsers are destroy()ed
+
+    FOREACH(std::vector<PutUser::shared_pointer>::iterator, it, end, tonotify) {
+        PutUser *usr = it->get();
+        pva::ChannelPutRequester::shared_pointer req(usr->req.lock());
+        bool destroyed;
+        {
+            Guard G(mutex());
+            destroyed = usr->destroyed;
+        }
+        if(req && !destroyed)
+            req->putDone(status, *it);
+    }
+
+    // only now, so that downstream sees putDone() in the order of put()
+    Guard G(mutex());
+    next(G);
+}
+
+void
+PutCacheEntry::getDone(const pvd::Status& status,
+                       pva::ChannelPut::shared_pointer const & channelPut,
+                       pvd::PVStructurePtr const & pvStructure,
+                       pvd::BitSet::shared_pointer const & bitSet)
+{
+    std::vector<PutUser::shared_pointer> tonotify;
+    {
+        Guard G(mutex());
+        inprog = false;
+        tonotify.swap(getting);
+    }
+
+    shared_pointer self(weakref); // keeps us alive until all PutUsers are destroy()ed
+
+    FOREACH(std::vector<PutUser::shared_pointer>::iterator, it, end, tonotify) {
+        PutUser *usr = it->get();
+        pva::ChannelPutRequester::shared_pointer req(usr->req.lock());
+        bool destroyed;
+        {
+            Guard G(mutex());
+            destroyed = usr->destroyed;
+        }
+        if(req && !destroyed)
+            req->getDone(status, *it, pvStructure, bitSet);
+    }
+
+    Guard G(mutex());
+    next(G);
+}
+
+PutUser::PutUser(const PutCacheEntry::shared_pointer& e)
+    :entry(e)
+    ,destroyed(false)
+{
+    epicsAtomicIncrSizeT(&num_instances);
+}
+
+PutUser::~PutUser()
+{
+    epicsAtomicDecrSizeT(&num_instances);
+}
+
+void
+PutUser::destroy()
+{
+    Guard G(entry->mutex());
+    destroyed = true;
+}
+
+std::tr1::shared_ptr<pva::Channel>
+PutUser::getChannel()
+{
+    return GWChannel::shared_pointer(srvchan);
+}
+
+void
+PutUser::cancel()
+{
+    // upstream put() is shared, so we don't cancel it
+}
+
+void
+PutUser::lastRequest()
+{}
+
+void
+PutUser::put(pvd::PVStructure::shared_pointer const & pvPutStructure,
+             pvd::BitSet::shared_pointer const & putBitSet)
+{
+    entry->put(shared_pointer(weakref), pvPutStructure, putBitSet);
+}
+
+void
+PutUser::get()
+{
+    entry->get(shared_pointer(weakref));
+}
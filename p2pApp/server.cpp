@@ -1,8 +1,13 @@
 #include <stdio.h>
 
+#include <vector>
+#include <algorithm>
+#include <fstream>
+
 #include <epicsAtomic.h>
 #include <epicsString.h>
 #include <epicsTimer.h>
+#include <errlog.h>
 
 #include <pv/logger.h>
 #include <pv/pvIntrospect.h> /* for pvdVersion.h */
@@ -35,17 +40,30 @@ GWServerChannelProvider::getChannelProvider()
 pva::ChannelFind::shared_pointer
 GWServerChannelProvider::channelFind(std::string const & channelName,
                                      pva::ChannelFindRequester::shared_pointer const & channelFindRequester)
+{
+    return channelFindFor(channelName, channelFindRequester, shared_from_this());
+}
+
+pva::ChannelFind::shared_pointer
+GWServerChannelProvider::channelFindFor(std::string const & channelName,
+                                        pva::ChannelFindRequester::shared_pointer const & channelFindRequester,
+                                        const pva::ChannelFind::shared_pointer& srvfind)
 {
     pva::ChannelFind::shared_pointer ret;
     bool found = false;
 
     if(!channelName.empty())
     {
-        LOG(pva::logLevelDebug, "Searching for '%s'", channelName.c_str());
-        ChannelCacheEntry::shared_pointer ent(cache.lookup(channelName));
+        std::string peer;
+        pva::PeerInfo::const_shared_pointer info(channelFindRequester->getPeerInfo());
+        if(info)
+            peer = info->peer;
+
+        LOG(pva::logLevelDebug, "Searching for '%s' from '%s'", channelName.c_str(), peer.c_str());
+        ChannelCacheEntry::shared_pointer ent(cache.lookup(channelName, peer));
         if(ent) {
             found = true;
-            ret = shared_from_this();
+            ret = srvfind;
         }
     }
 
@@ -62,19 +80,29 @@ pva::Channel::shared_pointer
 GWServerChannelProvider::createChannel(std::string const & channelName,
                                        pva::ChannelRequester::shared_pointer const & channelRequester,
                                        short priority, std::string const & addressx)
+{
+    return createGWChannel(channelName, channelRequester, shared_from_this(), GWServerOptions());
+}
+
+pva::Channel::shared_pointer
+GWServerChannelProvider::createGWChannel(std::string const & channelName,
+                                         pva::ChannelRequester::shared_pointer const & channelRequester,
+                                         const pva::ChannelProvider::shared_pointer& srvprov,
+                                         const GWServerOptions& options)
 {
     GWChannel::shared_pointer ret;
     std::string address = channelRequester->getRequesterName();
 
     if(!channelName.empty())
     {
-        Guard G(cache.cacheLock);
+        // hold shard lock so that the cleaner can't remove the entry before we are interested
+        ChannelCache::Shard::guard_type G(cache.shardOf(channelName));
 
-        ChannelCacheEntry::shared_pointer ent(cache.lookup(channelName)); // recursively locks cacheLock
+        ChannelCacheEntry::shared_pointer ent(cache.lookup(channelName)); // recursively locks shard
 
         if(ent)
         {
-            ret.reset(new GWChannel(ent, shared_from_this(), channelRequester, address));
+            ret.reset(new GWChannel(ent, srvprov, channelRequester, address, options));
             ent->interested.insert(ret);
             ret->weakref = ret;
         }
@@ -93,12 +121,41 @@ GWServerChannelProvider::createChannel(std::string const & channelName,
 
 void GWServerChannelProvider::destroy() {}
 
-GWServerChannelProvider::GWServerChannelProvider(const pva::ChannelProvider::shared_pointer& prov)
-    :cache(prov)
+GWServerChannelProvider::GWServerChannelProvider(const pva::ChannelProvider::shared_pointer& prov,
+                                                 int ncreators)
+    :cache(prov, ncreators)
 {}
 
 GWServerChannelProvider::~GWServerChannelProvider() {}
 
+std::tr1::shared_ptr<pva::ChannelProvider>
+GWServerView::getChannelProvider()
+{
+    return shared_from_this();
+}
+
+pva::ChannelFind::shared_pointer
+GWServerView::channelFind(std::string const & channelName,
+                          pva::ChannelFindRequester::shared_pointer const & channelFindRequester)
+{
+    return client->channelFindFor(channelName, channelFindRequester, shared_from_this());
+}
+
+pva::Channel::shared_pointer
+GWServerView::createChannel(std::string const & channelName,
+                            pva::ChannelRequester::shared_pointer const & channelRequester,
+                            short priority, std::string const & addressx)
+{
+    return client->createGWChannel(channelName, channelRequester, shared_from_this(), options);
+}
+
+GWServerView::GWServerView(const GWServerChannelProvider::shared_pointer& client, const GWServerOptions& options)
+    :client(client)
+    ,options(options)
+{}
+
+GWServerView::~GWServerView() {}
+
 void ServerConfig::drop(const char *client, const char *channel)
 {
     if(!client)
@@ -118,25 +175,60 @@ void ServerConfig::drop(const char *client, const char *channel)
 
         // find the channel, if it's there
         {
-            Guard G(prov->cache.cacheLock);
+            ChannelCache::Shard& shard = prov->cache.shardOf(channel);
+            ChannelCache::Shard::guard_type G(shard);
 
-            ChannelCache::entries_t::iterator it = prov->cache.entries.find(channel);
-            if(it==prov->cache.entries.end())
+            ChannelCache::entries_t::iterator it = shard.entries.find(channel);
+            if(it==shard.entries.end())
                 continue;
 
             std::cout<<"Drop from "<<it->first<<" : "<<it->second->channelName<<"\n";
 
             entry = it->second;
-            prov->cache.entries.erase(it); // drop out of cache (TODO: not required)
+            shard.erase(it); // drop out of cache (TODO: not required)
         }
 
         // trigger client side disconnect (recursively calls call CRequester::channelStateChange())
         // TODO: shouldn't need this
-        entry->channel->destroy();
+        if(entry->channel) // may still be waiting for createChannel()
+            entry->channel->destroy();
 
     }
 }
 
+namespace {
+void printLatency(const char *indent, const LatencyHistogram& H)
+{
+    size_t n = H.count();
+    if(!n)
+        return;
+    std::cout<<indent<<"Latency of "<<n<<" updates p50 "<<H.quantile(0.5)*1e3
+             <<" p90 "<<H.quantile(0.9)*1e3
+             <<" p99 "<<H.quantile(0.99)*1e3
+             <<" max "<<H.max()*1e3<<" ms\n";
+}
+
+void printBytes(const char *indent, const ByteHistogram& H)
+{
+    size_t n = H.count();
+    if(!n)
+        return;
+    std::cout<<indent<<"Size of "<<n<<" updates p50 "<<H.quantile(0.5)
+             <<" p90 "<<H.quantile(0.9)
+             <<" p99 "<<H.quantile(0.99)
+             <<" max "<<H.max()<<" bytes\n";
+}
+
+void updateSamples(StatsSamples& samples, const std::string& prefix, const std::string& lbl,
+                   const LatencyHistogram& latency, const ByteHistogram& bytes)
+{
+    // cumulative, so rates and quantiles over any period can be computed by the reader
+    histogramSamples(samples, prefix+"_latency_seconds", lbl, latency);
+    samples.push_back(StatsSample(prefix+"_latency_max_seconds", lbl, latency.max(), false));
+    histogramSamples(samples, prefix+"_bytes", lbl, bytes);
+}
+}
+
 void ServerConfig::status_server(int lvl, const char *server)
 {
     if(!server)
@@ -175,31 +267,98 @@ void ServerConfig::status_client(int lvl, const char *client, const char *channe
 
         ChannelCache::entries_t entries;
 
-        size_t ncache, ncleaned, ndust;
-        {
-            Guard G(prov->cache.cacheLock);
+        const ChannelCache& cache = prov->cache;
+        const size_t nshards = cache.nshards;
+        std::vector<size_t> occupancy(nshards), nlocks(nshards), ncontended(nshards);
+        std::vector<size_t> perprovider(cache.providers.size());
+
+        size_t ncache = 0u, ncontend = 0u, maxocc = 0u;
+        for(size_t i=0; i<nshards; i++) {
+            ChannelCache::Shard& shard = cache.shards[i];
+            ChannelCache::Shard::guard_type G(shard);
+
+            occupancy[i] = shard.entries.size();
+            nlocks[i] = shard.nlocks;
+            ncontended[i] = shard.ncontended;
 
-            ncache = prov->cache.entries.size();
-            ncleaned = prov->cache.cleanerRuns;
-            ndust = prov->cache.cleanerDust;
+            ncache += occupancy[i];
+            ncontend += ncontended[i];
+            maxocc = std::max(maxocc, occupancy[i]);
+
+            if(perprovider.size()>1u) {
+                FOREACH(ChannelCache::entries_t::const_iterator, it2, end2, shard.entries)
+                    perprovider[cache.providerIndex(it2->first)]++;
+            }
 
             if(lvl>0) {
                 if(!iswild) { // no string or some glob pattern
-                    entries = prov->cache.entries; // copy of std::map
+                    entries.insert(shard.entries.begin(), shard.entries.end());
                 } else { // just one channel
-                    ChannelCache::entries_t::iterator it(prov->cache.entries.find(channel));
-                    if(it!=prov->cache.entries.end())
+                    ChannelCache::entries_t::iterator it(shard.entries.find(channel));
+                    if(it!=shard.entries.end())
                         entries[it->first] = it->second;
                 }
             }
         }
-
-        std::cout<<"Cache has "<<ncache<<" channels.  Cleaned "
-                <<ncleaned<<" times closing "<<ndust<<" channels\n";
+        size_t ncleaned = epicsAtomicGetSizeT(&cache.cleanerRuns),
+               ndust = epicsAtomicGetSizeT(&cache.cleanerDust);
+
+        size_t npending, ncreated, nbatches;
+        prov->cache.createStats(npending, ncreated, nbatches);
+
+        std::cout<<"Cache has "<<ncache<<" channels in "<<nshards<<" shards (max "<<maxocc<<").  Cleaned "
+                <<ncleaned<<" times closing "<<ndust<<" channels.  "
+                <<ncontend<<" contended locks\n";
+        if(perprovider.size()>1u) {
+            std::cout<<"Channels partitioned among "<<perprovider.size()<<" upstream contexts:";
+            for(size_t i=0; i<perprovider.size(); i++)
+                std::cout<<" "<<perprovider[i];
+            std::cout<<"\n";
+        }
+        std::cout<<"getField() "<<epicsAtomicGetSizeT(&cache.fieldHits)<<" cached "
+                 <<epicsAtomicGetSizeT(&cache.fieldMisses)<<" forwarded\n";
+        if(prov->cache.creator)
+            std::cout<<"Created "<<ncreated<<" channels in "<<nbatches<<" batches.  "
+                     <<npending<<" waiting\n";
+        if(prov->cache.negative.capacity) {
+            ChannelCache::NegativeCache& neg = prov->cache.negative;
+            Guard G(neg.mutex);
+            std::cout<<"Negative cache has "<<neg.index.size()<<"/"<<neg.capacity<<" names.  "
+                     <<neg.nhits<<" hits "<<neg.nmisses<<" misses\n";
+        }
+        if(prov->cache.limiter.rate>0.0) {
+            ChannelCache::SearchLimiter& lim = prov->cache.limiter;
+            Guard G(lim.mutex);
+            std::cout<<"Search limit "<<lim.rate<<"/s tracking "<<lim.buckets.size()<<" hosts.  "
+                     <<lim.ndropped<<" drops\n";
+        }
+        {
+            MonitorNotifier& N = prov->cache.notifier;
+            Guard G(N.mutex);
+            if(N.active)
+                std::cout<<"Notify queue "<<N.depth<<" (max "<<N.maxDepth<<").  "
+                         <<N.nqueued<<" wakeups "<<N.ncoalesced<<" coalesced.  Max latency "
+                         <<N.maxLatency*1e3<<" ms\n";
+        }
+        {
+            MonitorFlusher& F = prov->cache.flusher;
+            Guard G(F.mutex);
+            if(F.nflushed || F.pending)
+                std::cout<<"Rate limited updates "<<F.nflushed<<" flushed "<<F.pending<<" pending\n";
+        }
+        if(lvl>2) {
+            printLatency("", cache.stats.latency);
+            printBytes("", cache.stats.bytes);
+        }
 
         if(lvl<=0)
             continue;
 
+        for(size_t i=0; i<nshards; i++) {
+            std::cout<<"  Shard "<<i<<" has "<<occupancy[i]<<" channels.  "
+                     <<ncontended[i]<<"/"<<nlocks[i]<<" locks contended\n";
+        }
+
         FOREACH(ChannelCache::entries_t::const_iterator, it2, end2, entries)
         {
             const std::string& channame = it2->first;
@@ -208,25 +367,56 @@ void ServerConfig::status_client(int lvl, const char *client, const char *channe
 
             ChannelCacheEntry& E = *it2->second;
             ChannelCacheEntry::mon_entries_t::lock_vector_type mons;
-            size_t nsrv, nmon;
-            bool dropflag;
-            const char *chstate;
+            ChannelCacheEntry::get_entries_t::lock_vector_type gets;
+            ChannelCacheEntry::put_entries_t::lock_vector_type puts;
+            size_t nsrv, nmon, nfieldhits, nfieldmisses, ngetup = 0, ngetshared = 0, ngetmon = 0,
+                   nputup = 0, nputabsorbed = 0;
+            double idle;
+            const char *chstate = "CREATING";
+            pva::Channel::shared_pointer upstream;
+            {
+                ChannelCache::Shard::guard_type G(prov->cache.shardOf(channame));
+                upstream = E.channel;
+                idle = epicsTime::getCurrent() - E.lastUsed;
+            }
+            if(upstream)
+                chstate = pva::Channel::ConnectionStateNames[upstream->getConnectionState()];
             {
                 Guard G(E.mutex());
-                chstate = pva::Channel::ConnectionStateNames[E.channel->getConnectionState()];
                 nsrv = E.interested.size();
                 nmon = E.mon_entries.size();
-                dropflag = E.dropPoke;
+                nfieldhits = E.nfieldhits;
+                nfieldmisses = E.nfieldmisses;
+                gets = E.get_entries.lock_vector();
+                puts = E.put_entries.lock_vector();
 
                 if(lvl>1)
                     mons = E.mon_entries.lock_vector();
             }
 
+            FOREACH(ChannelCacheEntry::get_entries_t::lock_vector_type::const_iterator, it3, end3, gets) {
+                GetCacheEntry& GE = *it3->second;
+                Guard G(GE.mutex());
+                ngetup += GE.nupstream;
+                ngetshared += GE.nshared;
+                ngetmon += GE.nmonitor;
+            }
+            FOREACH(ChannelCacheEntry::put_entries_t::lock_vector_type::const_iterator, it3, end3, puts) {
+                PutCacheEntry& PE = *it3->second;
+                Guard G(PE.mutex());
+                nputup += PE.nupstream;
+                nputabsorbed += PE.nabsorbed;
+            }
+
             std::cout<<chstate
                      <<" Client Channel '"<<channame
                      <<"' used by "<<nsrv<<" Server channel(s) with "
                      <<nmon<<" unique subscription(s) "
-                     <<(dropflag?'!':'_')<<"\n";
+                     <<"idle "<<idle<<"s"
+                     <<" getField() "<<nfieldhits<<"/"<<(nfieldhits+nfieldmisses)<<" cached"
+                     <<" get() "<<ngetshared<<"/"<<(ngetshared+ngetup+ngetmon)<<" shared "
+                     <<ngetmon<<" from monitor"
+                     <<" put() "<<nputabsorbed<<"/"<<(nputabsorbed+nputup)<<" combined\n";
 
             if(lvl<=1)
                 continue;
@@ -239,7 +429,8 @@ void ServerConfig::status_client(int lvl, const char *client, const char *channe
 #ifdef USE_MSTATS
                 pvd::Monitor::Stats mstats;
 #endif
-                bool hastype, hasdata, isdone;
+                size_t nblocked;
+                bool hastype, hasdata, isdone, isblocked;
                 {
                     Guard G(ME.mutex());
 
@@ -247,6 +438,8 @@ void ServerConfig::status_client(int lvl, const char *client, const char *channe
                     hastype = !!ME.typedesc;
                     hasdata = !!ME.lastelem;
                     isdone = ME.done;
+                    isblocked = !!ME.blocked;
+                    nblocked = ME.nblocked;
 
 #ifdef USE_MSTATS
                     if(ME.mon)
@@ -263,7 +456,12 @@ void ServerConfig::status_client(int lvl, const char *client, const char *channe
                          <<"opened, Has "<<(hasdata?"":"not ")
                          <<"recv'd some data, Has "<<(isdone?"":"not ")<<"finalized\n"
                            "    "<<      epicsAtomicGetSizeT(&ME.nwakeups)<<" wakeups "
-                         <<epicsAtomicGetSizeT(&ME.nevents)<<" events\n";
+                         <<epicsAtomicGetSizeT(&ME.nevents)<<" events "
+                         <<nblocked<<" blocks"<<(isblocked?" (blocked)":"")<<"\n";
+                if(lvl>2) {
+                    printLatency("    ", ME.latency);
+                    printBytes("    ", ME.bytes);
+                }
 #ifdef USE_MSTATS
                 if(mstats.nempty || mstats.nfilled || mstats.noutstanding)
                     std::cout<<"    US monitor queue "<<mstats.nfilled
@@ -278,14 +476,15 @@ void ServerConfig::status_client(int lvl, const char *client, const char *channe
 
                     size_t nempty, nfilled, nused, total;
                     std::string remote;
-                    bool isrunning;
+                    bool isrunning, isheld;
                     {
                         Guard G(MU.mutex());
 
-                        nempty = MU.empty.size();
-                        nfilled = MU.filled.size();
-                        nused = MU.inuse.size();
+                        nempty = MU.queue.numFree();
+                        nfilled = MU.queue.numFilled();
+                        nused = MU.queue.numOut();
                         isrunning = MU.running;
+                        isheld = MU.held;
 
                         GWChannel::shared_pointer srvchan(MU.srvchan.lock());
                         if(srvchan)
@@ -298,11 +497,14 @@ void ServerConfig::status_client(int lvl, const char *client, const char *channe
                     std::cout<<"    Server monitor from "
                              <<remote
                              <<(isrunning?"":" Paused")
+                             <<(isheld?" Held":"")
+                             <<(MU.policy ? " policy '"+MU.policy->name+"'" : std::string())
                              <<" buffer "<<nfilled<<"/"<<total
                              <<" out "<<nused<<"/"<<total
                              <<" "<<epicsAtomicGetSizeT(&MU.nwakeups)<<" wakeups "
                              <<epicsAtomicGetSizeT(&MU.nevents)<<" events "
-                             <<epicsAtomicGetSizeT(&MU.ndropped)<<" drops\n";
+                             <<epicsAtomicGetSizeT(&MU.ndropped)<<" drops "
+                             <<epicsAtomicGetSizeT(&MU.nsuppressed)<<" suppressed\n";
                 }
             }
 
@@ -313,4 +515,210 @@ void ServerConfig::status_client(int lvl, const char *client, const char *channe
 
         std::cout<<"<== Client: "<<it->first<<"\n\n";
     }
+
+    FOREACH(serverOptions_t::const_iterator, it, end, serverOptions)
+    {
+        const GWServerOptions::monitorPolicies_t& policies = it->second.monitorPolicies;
+        if(policies.empty())
+            continue;
+
+        std::cout<<"==> Monitor policies of server: "<<it->first<<"\n";
+        FOREACH(GWServerOptions::monitorPolicies_t::const_iterator, it2, end2, policies)
+        {
+            const MonitorPolicy& P = **it2;
+            std::cout<<"  Policy '"<<P.name<<"' channel '"<<P.channel<<"' client '"<<P.client<<"'"
+                     <<" queueSize "<<P.queueSize
+                     <<(P.dropOldest ? " drop oldest" : " squash newest")
+                     <<" maxRate "<<P.maxRate
+                     <<" deadband "<<P.deadband.abs<<" relDeadband "<<P.deadband.rel<<"\n"
+                       "    "<<epicsAtomicGetSizeT(&P.nusers)<<" subscriptions "
+                     <<epicsAtomicGetSizeT(&P.nsquashed)<<" squashed "
+                     <<epicsAtomicGetSizeT(&P.ndropped)<<" dropped "
+                     <<epicsAtomicGetSizeT(&P.ndecimated)<<" decimated "
+                     <<epicsAtomicGetSizeT(&P.nsuppressed)<<" suppressed\n";
+        }
+        std::cout<<"<== Monitor policies of server: "<<it->first<<"\n\n";
+    }
+}
+
+void ServerConfig::collect_stats(StatsSamples& samples, bool perChannel)
+{
+    FOREACH(clients_t::const_iterator, it, end, clients)
+    {
+        const std::string lbl(statsLabel("client", it->first));
+        ChannelCache& cache = it->second->cache;
+
+        size_t nchannels = 0u;
+        ChannelCache::entries_t entries;
+        for(size_t i=0; i<cache.nshards; i++) {
+            ChannelCache::Shard::guard_type G(cache.shards[i]);
+            nchannels += cache.shards[i].entries.size();
+            if(perChannel)
+                entries.insert(cache.shards[i].entries.begin(), cache.shards[i].entries.end());
+        }
+
+        samples.push_back(StatsSample("p2p_client_channels", lbl, nchannels, false));
+        samples.push_back(StatsSample("p2p_client_upstream_wakeups", lbl, cache.stats.upstreamWakeups.get(), true));
+        samples.push_back(StatsSample("p2p_client_upstream_events", lbl, cache.stats.upstreamEvents.get(), true));
+        samples.push_back(StatsSample("p2p_client_downstream_events", lbl, cache.stats.downstreamEvents.get(), true));
+        samples.push_back(StatsSample("p2p_client_downstream_wakeups", lbl, cache.stats.downstreamWakeups.get(), true));
+        samples.push_back(StatsSample("p2p_client_downstream_drops", lbl, cache.stats.downstreamDrops.get(), true));
+        samples.push_back(StatsSample("p2p_client_suppressed", lbl, cache.stats.suppressed.get(), true));
+        samples.push_back(StatsSample("p2p_client_decimated", lbl, cache.stats.decimated.get(), true));
+        samples.push_back(StatsSample("p2p_client_cleaner_runs", lbl, epicsAtomicGetSizeT(&cache.cleanerRuns), true));
+        samples.push_back(StatsSample("p2p_client_cleaner_closed", lbl, epicsAtomicGetSizeT(&cache.cleanerDust), true));
+        samples.push_back(StatsSample("p2p_client_getfield_hits", lbl, epicsAtomicGetSizeT(&cache.fieldHits), true));
+        samples.push_back(StatsSample("p2p_client_getfield_misses", lbl, epicsAtomicGetSizeT(&cache.fieldMisses), true));
+        {
+            Guard G(cache.negative.mutex);
+            samples.push_back(StatsSample("p2p_client_negative_hits", lbl, cache.negative.nhits, true));
+            samples.push_back(StatsSample("p2p_client_negative_misses", lbl, cache.negative.nmisses, true));
+        }
+        {
+            Guard G(cache.limiter.mutex);
+            samples.push_back(StatsSample("p2p_client_search_drops", lbl, cache.limiter.ndropped, true));
+        }
+        {
+            Guard G(cache.notifier.mutex);
+            samples.push_back(StatsSample("p2p_client_notify_depth", lbl, cache.notifier.depth, false));
+            samples.push_back(StatsSample("p2p_client_notify_max_latency_seconds", lbl, cache.notifier.maxLatency, false));
+        }
+        updateSamples(samples, "p2p_client_update", lbl, cache.stats.latency, cache.stats.bytes);
+
+        FOREACH(ChannelCache::entries_t::const_iterator, it2, end2, entries)
+        {
+            const std::string clbl(lbl+","+statsLabel("channel", it2->first));
+            ChannelCacheEntry& E = *it2->second;
+            ChannelCacheEntry::mon_entries_t::lock_vector_type mons;
+            size_t nsrv;
+            {
+                Guard G(E.mutex());
+                nsrv = E.interested.size();
+                mons = E.mon_entries.lock_vector();
+            }
+
+            size_t nwakeups = 0u, nevents = 0u, nblocked = 0u, nusers = 0u,
+                   dsevents = 0u, dsdrops = 0u, dssuppressed = 0u;
+            LatencyHistogram latency;
+            ByteHistogram bytes;
+#ifdef USE_MSTATS
+            size_t usfilled = 0u, usoutstanding = 0u;
+#endif
+            FOREACH(ChannelCacheEntry::mon_entries_t::lock_vector_type::const_iterator, it3, end3, mons) {
+                MonitorCacheEntry& ME = *it3->second;
+                MonitorCacheEntry::interested_t::vector_type usrs;
+#ifdef USE_MSTATS
+                pvd::Monitor::Stats mstats;
+#endif
+                {
+                    Guard G(ME.mutex());
+                    nblocked += ME.nblocked;
+                    usrs = ME.interested.lock_vector();
+#ifdef USE_MSTATS
+                    if(ME.mon)
+                        ME.mon->getStats(mstats);
+#endif
+                }
+                nwakeups += epicsAtomicGetSizeT(&ME.nwakeups);
+                nevents += epicsAtomicGetSizeT(&ME.nevents);
+                latency.merge(ME.latency);
+                bytes.merge(ME.bytes);
+#ifdef USE_MSTATS
+                usfilled += mstats.nfilled;
+                usoutstanding += mstats.noutstanding;
+#endif
+                nusers += usrs.size();
+                FOREACH(MonitorCacheEntry::interested_t::vector_type::const_iterator, it4, end4, usrs) {
+                    dsevents += epicsAtomicGetSizeT(&(*it4)->nevents);
+                    dsdrops += epicsAtomicGetSizeT(&(*it4)->ndropped);
+                    dssuppressed += epicsAtomicGetSizeT(&(*it4)->nsuppressed);
+                }
+            }
+
+            samples.push_back(StatsSample("p2p_channel_server_channels", clbl, nsrv, false));
+            samples.push_back(StatsSample("p2p_channel_subscriptions", clbl, nusers, false));
+            samples.push_back(StatsSample("p2p_channel_upstream_monitors", clbl, mons.size(), false));
+            // sums over current monitors, so these may decrease
+            samples.push_back(StatsSample("p2p_channel_upstream_wakeups", clbl, nwakeups, false));
+            samples.push_back(StatsSample("p2p_channel_upstream_events", clbl, nevents, false));
+            samples.push_back(StatsSample("p2p_channel_upstream_blocked", clbl, nblocked, false));
+            samples.push_back(StatsSample("p2p_channel_downstream_events", clbl, dsevents, false));
+            samples.push_back(StatsSample("p2p_channel_downstream_drops", clbl, dsdrops, false));
+            samples.push_back(StatsSample("p2p_channel_suppressed", clbl, dssuppressed, false));
+            updateSamples(samples, "p2p_channel_update", clbl, latency, bytes);
+#ifdef USE_MSTATS
+            samples.push_back(StatsSample("p2p_channel_upstream_queue_filled", clbl, usfilled, false));
+            samples.push_back(StatsSample("p2p_channel_upstream_queue_outstanding", clbl, usoutstanding, false));
+#endif
+        }
+    }
+
+    FOREACH(serverOptions_t::const_iterator, it, end, serverOptions)
+    {
+        const std::string lbl(statsLabel("server", it->first));
+        const GWServerOptions& opts = it->second;
+
+        if(opts.stats) {
+            samples.push_back(StatsSample("p2p_server_channels_created", lbl, opts.stats->channels.get(), true));
+            samples.push_back(StatsSample("p2p_server_gets_created", lbl, opts.stats->gets.get(), true));
+            samples.push_back(StatsSample("p2p_server_puts_created", lbl, opts.stats->puts.get(), true));
+            samples.push_back(StatsSample("p2p_server_monitors_created", lbl, opts.stats->monitors.get(), true));
+        }
+
+        FOREACH(GWServerOptions::monitorPolicies_t::const_iterator, it2, end2, opts.monitorPolicies)
+        {
+            const MonitorPolicy& P = **it2;
+            const std::string plbl(lbl+","+statsLabel("policy", P.name));
+            samples.push_back(StatsSample("p2p_policy_subscriptions", plbl, epicsAtomicGetSizeT(&P.nusers), true));
+            samples.push_back(StatsSample("p2p_policy_squashed", plbl, epicsAtomicGetSizeT(&P.nsquashed), true));
+            samples.push_back(StatsSample("p2p_policy_dropped", plbl, epicsAtomicGetSizeT(&P.ndropped), true));
+            samples.push_back(StatsSample("p2p_policy_decimated", plbl, epicsAtomicGetSizeT(&P.ndecimated), true));
+            samples.push_back(StatsSample("p2p_policy_suppressed", plbl, epicsAtomicGetSizeT(&P.nsuppressed), true));
+        }
+    }
+}
+
+namespace {
+// write then rename, so that readers never see a partial file
+void writeStatsFile(const std::string& file, const StatsSamples& samples)
+{
+    std::string temp(file+".tmp");
+    {
+        std::ofstream strm(temp.c_str());
+        writeOpenMetrics(strm, samples);
+        if(!strm.good())
+            throw std::runtime_error(std::string("Error writing ")+temp);
+    }
+    if(rename(temp.c_str(), file.c_str()))
+        throw std::runtime_error(std::string("Error renaming ")+temp);
+}
+}
+
+void ServerConfig::write_stats(const char *file)
+{
+    StatsSamples samples;
+    collect_stats(samples, statsPerChannel);
+
+    if(!file || !file[0])
+        writeOpenMetrics(std::cout, samples);
+    else
+        writeStatsFile(file, samples);
+}
+
+void ServerConfig::update_stats()
+{
+    StatsSamples samples;
+    collect_stats(samples, statsPerChannel);
+
+    if(!statsFile.empty()) {
+        try {
+            writeStatsFile(statsFile, samples);
+        } catch(std::exception& e) {
+            errlogPrintf("p2p: statistics: %s\n", e.what());
+        }
+    }
+
+    FOREACH(statsProviders_t::const_iterator, it, end, statsProviders) {
+        (*it)->update(samples);
+    }
 }
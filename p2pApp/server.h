@@ -5,6 +5,7 @@
 
 #include "chancache.h"
 #include "channel.h"
+#include "stats.h"
 
 struct GWServerChannelProvider :
         public epics::pvAccess::ChannelProvider,
@@ -24,17 +25,61 @@ struct GWServerChannelProvider :
 
     virtual epics::pvAccess::ChannelFind::shared_pointer channelFind(std::string const & channelName,
                                              epics::pvAccess::ChannelFindRequester::shared_pointer const & channelFindRequester);
+    //! Search on behalf of the server side ChannelFind srvfind, which is given to channelFindRequester if found
+    epics::pvAccess::ChannelFind::shared_pointer channelFindFor(std::string const & channelName,
+                                                                epics::pvAccess::ChannelFindRequester::shared_pointer const & channelFindRequester,
+                                                                const epics::pvAccess::ChannelFind::shared_pointer& srvfind);
 
     using epics::pvAccess::ChannelProvider::createChannel;
     virtual epics::pvAccess::Channel::shared_pointer createChannel(std::string const & channelName,
                                                        epics::pvAccess::ChannelRequester::shared_pointer const & channelRequester,
                                                        short priority, std::string const & addressx);
+    //! Create a GWChannel which belongs to the server side provider srvprov
+    epics::pvAccess::Channel::shared_pointer createGWChannel(std::string const & channelName,
+                                                             epics::pvAccess::ChannelRequester::shared_pointer const & channelRequester,
+                                                             const epics::pvAccess::ChannelProvider::shared_pointer& srvprov,
+                                                             const GWServerOptions& options);
     virtual void destroy();
 
-    explicit GWServerChannelProvider(const epics::pvAccess::ChannelProvider::shared_pointer& prov);
+    //! @param ncreators # of threads to call createChannel() from, as the "createWorkers" config key.
+    //!        Zero selects ChannelCache::defaultCreators.  ChannelCache::createInline calls createChannel() from the search thread.
+    explicit GWServerChannelProvider(const epics::pvAccess::ChannelProvider::shared_pointer& prov,
+                                     int ncreators = 0);
     virtual ~GWServerChannelProvider();
 };
 
+//! The view of one client given to one server, with that server's options
+struct GWServerView :
+        public epics::pvAccess::ChannelProvider,
+        public epics::pvAccess::ChannelFind,
+        public std::tr1::enable_shared_from_this<GWServerView>
+{
+    POINTER_DEFINITIONS(GWServerView);
+    const GWServerChannelProvider::shared_pointer client;
+    const GWServerOptions options;
+
+    //! so that the server creates channels through this view
+    virtual std::tr1::shared_ptr<ChannelProvider> getChannelProvider();
+
+    virtual void cancel() {}
+
+    virtual std::string getProviderName() {
+        return client->getProviderName();
+    }
+
+    virtual epics::pvAccess::ChannelFind::shared_pointer channelFind(std::string const & channelName,
+                                             epics::pvAccess::ChannelFindRequester::shared_pointer const & channelFindRequester);
+
+    using epics::pvAccess::ChannelProvider::createChannel;
+    virtual epics::pvAccess::Channel::shared_pointer createChannel(std::string const & channelName,
+                                                       epics::pvAccess::ChannelRequester::shared_pointer const & channelRequester,
+                                                       short priority, std::string const & addressx);
+    virtual void destroy() {}
+
+    GWServerView(const GWServerChannelProvider::shared_pointer& client, const GWServerOptions& options);
+    virtual ~GWServerView();
+};
+
 struct ServerConfig {
     int debug;
     bool interactive;
@@ -46,11 +91,27 @@ struct ServerConfig {
     typedef std::map<std::string, epics::pvAccess::ServerContext::shared_pointer> servers_t;
     servers_t servers;
 
-    ServerConfig() :debug(1), interactive(true) {}
+    typedef std::map<std::string, GWServerOptions> serverOptions_t;
+    serverOptions_t serverOptions;
+
+    // periodic statistics exposition
+    std::string statsFile;
+    bool statsPerChannel;
+    typedef std::vector<StatsProvider::shared_pointer> statsProviders_t;
+    statsProviders_t statsProviders; // status PVs of servers with a control_prefix
+
+    ServerConfig() :debug(1), interactive(true), statsPerChannel(false) {}
 
     void drop(const char *client, const char *channel);
     void status_server(int lvl, const char *server);
     void status_client(int lvl, const char *client, const char *channel);
+
+    //! Append current statistics of all clients and servers
+    void collect_stats(StatsSamples& samples, bool perChannel);
+    //! Write statistics to file (or stdout if NULL or empty)
+    void write_stats(const char *file);
+    //! Periodic update of statsFile and statsProviders
+    void update_stats();
 };
 
 #endif // SERVER_H
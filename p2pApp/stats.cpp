@@ -0,0 +1,548 @@
+
+#include <algorithm>
+#include <assert.h>
+#include <sstream>
+#include <cmath>
+
+#include <epicsAtomic.h>
+#include <epicsStdio.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include <pv/pvAccess.h>
+
+#define epicsExportSharedSymbols
+#include "helper.h"
+#include "pva2pva.h"
+#include "pvahelper.h"
+#include "stats.h"
+
+namespace pva = epics::pvAccess;
+namespace pvd = epics::pvData;
+
+namespace {
+epicsThreadOnceId slotOnce = EPICS_THREAD_ONCE_INIT;
+epicsThreadPrivateId slotId;
+size_t nextSlot;
+
+void slotInit(void *)
+{
+    slotId = epicsThreadPrivateCreate();
+}
+
+pvd::StructureConstPtr statsType(pvd::getFieldCreate()->createFieldBuilder()
+                                 ->setId("epics:nt/NTTable:1.0")
+                                 ->addArray("labels", pvd::pvString)
+                                 ->addNestedStructure("value")
+                                    ->addArray("name", pvd::pvString)
+                                    ->addArray("labels", pvd::pvString)
+                                    ->addArray("value", pvd::pvDouble)
+                                 ->endNested()
+                                 ->addNestedStructure("timeStamp")
+                                    ->setId("time_t")
+                                    ->add("secondsPastEpoch", pvd::pvLong)
+                                    ->add("nanoseconds", pvd::pvInt)
+                                    ->add("userTag", pvd::pvInt)
+                                 ->endNested()
+                                 ->createStructure());
+
+bool sampleLess(const StatsSample& lhs, const StatsSample& rhs)
+{
+    return lhs.name < rhs.name;
+}
+}
+
+StatCounter::StatCounter()
+{
+    // create the key here, so that add() need not call epicsThreadOnce(), which locks
+    epicsThreadOnce(&slotOnce, &slotInit, 0);
+    for(size_t i=0; i<nslots; i++)
+        slots[i].count = 0u;
+}
+
+// Each thread is given the next slot, round robin, on first use.
+// slotId was created by the StatCounter ctor.
+size_t StatCounter::slot()
+{
+    size_t n = (size_t)epicsThreadPrivateGet(slotId);
+    if(!n) {
+        n = epicsAtomicIncrSizeT(&nextSlot); // never zero
+        epicsThreadPrivateSet(slotId, (void*)n);
+    }
+    return n%nslots;
+}
+
+void StatCounter::add(size_t n)
+{
+    epicsAtomicAddSizeT(&slots[slot()].count, n);
+}
+
+size_t StatCounter::get() const
+{
+    size_t ret = 0u;
+    for(size_t i=0; i<nslots; i++)
+        ret += epicsAtomicGetSizeT(&slots[i].count);
+    return ret;
+}
+
+Histogram::Histogram(double unit)
+    :unit(unit)
+    ,sumlo(0u)
+    ,sumhi(0u)
+    ,maxval(0u)
+{
+    for(size_t i=0; i<nbuckets; i++)
+        counts[i] = 0u;
+}
+
+size_t Histogram::bucketOf(size_t units)
+{
+    if(units < size_t(nsub))
+        return units; // exact
+    size_t e = nsubbits; // floor(log2(units))
+    while(e+1u < size_t(nexp) && (units>>(e+1u)))
+        e++;
+    if(units>>(e+1u))
+        return nbuckets-1u; // too large
+    size_t sub = (units>>(e-nsubbits)) & (nsub-1u);
+    return (e-nsubbits+1u)*nsub + sub;
+}
+
+size_t Histogram::upperBound(size_t bucket)
+{
+    if(bucket < size_t(nsub))
+        return bucket+1u;
+    size_t e = bucket/nsub + nsubbits - 1u,
+           sub = bucket%nsub;
+    return (nsub+sub+1u)<<(e-nsubbits);
+}
+
+void Histogram::record(double value)
+{
+    double units = value/unit;
+    size_t val = units<=0.0 ? 0u : units>=double(size_t(1u)<<nexp) ? size_t(1u)<<nexp : size_t(units);
+
+    epicsAtomicIncrSizeT(&counts[bucketOf(val)]);
+    addSum(val);
+
+    size_t prev = epicsAtomicGetSizeT(&maxval);
+    while(val > prev) {
+        size_t actual = epicsAtomicCmpAndSwapSizeT(&maxval, prev, val);
+        if(actual==prev)
+            break;
+        prev = actual;
+    }
+}
+
+void Histogram::addSum(size_t val)
+{
+    size_t prev = epicsAtomicGetSizeT(&sumlo);
+    for(;;) {
+        size_t actual = epicsAtomicCmpAndSwapSizeT(&sumlo, prev, prev+val);
+        if(actual==prev)
+            break;
+        prev = actual;
+    }
+    if(prev+val < prev) // wrapped
+        epicsAtomicIncrSizeT(&sumhi);
+}
+
+void Histogram::merge(const Histogram& other)
+{
+    assert(unit==other.unit);
+    for(size_t i=0; i<nbuckets; i++)
+        counts[i] += epicsAtomicGetSizeT(&other.counts[i]);
+    size_t hi, lo;
+    do {
+        hi = epicsAtomicGetSizeT(&other.sumhi);
+        lo = epicsAtomicGetSizeT(&other.sumlo);
+    } while(hi!=epicsAtomicGetSizeT(&other.sumhi));
+    addSum(lo);
+    sumhi += hi;
+    maxval = std::max(maxval, epicsAtomicGetSizeT(&other.maxval));
+}
+
+size_t Histogram::count() const
+{
+    size_t ret = 0u;
+    for(size_t i=0; i<nbuckets; i++)
+        ret += epicsAtomicGetSizeT(&counts[i]);
+    return ret;
+}
+
+size_t Histogram::count(size_t bucket) const
+{
+    return epicsAtomicGetSizeT(&counts[bucket]);
+}
+
+epicsUInt64 Histogram::sumUnits() const
+{
+    size_t hi, lo;
+    do {
+        hi = epicsAtomicGetSizeT(&sumhi);
+        lo = epicsAtomicGetSizeT(&sumlo);
+    } while(hi!=epicsAtomicGetSizeT(&sumhi));
+    // 2**32 where size_t is 32 bits.  Zero otherwise, when sumhi is never incremented
+    const epicsUInt64 carry = epicsUInt64(size_t(-1))+1u;
+    return hi*carry + lo;
+}
+
+double Histogram::sum() const
+{
+    return double(sumUnits())*unit;
+}
+
+double Histogram::max() const
+{
+    return epicsAtomicGetSizeT(&maxval)*unit;
+}
+
+double Histogram::quantile(double q) const
+{
+    size_t snap[nbuckets], total = 0u;
+    for(size_t i=0; i<nbuckets; i++)
+        total += snap[i] = epicsAtomicGetSizeT(&counts[i]);
+    if(!total)
+        return 0.0;
+
+    size_t target = size_t(std::ceil(q*total)), sum = 0u;
+    if(target<1u)
+        target = 1u;
+    for(size_t i=0; i<nbuckets; i++) {
+        sum += snap[i];
+        if(sum>=target)
+            return upperBound(i)*unit;
+    }
+    return upperBound(nbuckets-1u)*unit;
+}
+
+namespace {
+size_t fieldBytes(const pvd::PVField& fld)
+{
+    switch(fld.getField()->getType()) {
+    case pvd::scalar: {
+        pvd::ScalarType stype = static_cast<const pvd::PVScalar&>(fld).getScalar()->getScalarType();
+        if(stype==pvd::pvString)
+            return static_cast<const pvd::PVString&>(fld).get().size();
+        return pvd::ScalarTypeFunc::elementSize(stype);
+    }
+    case pvd::scalarArray: {
+        const pvd::PVScalarArray& arr = static_cast<const pvd::PVScalarArray&>(fld);
+        pvd::ScalarType stype = arr.getScalarArray()->getElementType();
+        if(stype==pvd::pvString) {
+            pvd::PVStringArray::const_svector strs(static_cast<const pvd::PVStringArray&>(fld).view());
+            size_t ret = 0u;
+            for(size_t i=0; i<strs.size(); i++)
+                ret += strs[i].size();
+            return ret;
+        }
+        return arr.getLength()*pvd::ScalarTypeFunc::elementSize(stype);
+    }
+    case pvd::structure: {
+        const pvd::PVFieldPtrArray& flds = static_cast<const pvd::PVStructure&>(fld).getPVFields();
+        size_t ret = 0u;
+        for(size_t i=0; i<flds.size(); i++)
+            ret += fieldBytes(*flds[i]);
+        return ret;
+    }
+    case pvd::structureArray: {
+        pvd::PVStructureArray::const_svector elems(static_cast<const pvd::PVStructureArray&>(fld).view());
+        size_t ret = 0u;
+        for(size_t i=0; i<elems.size(); i++)
+            if(elems[i])
+                ret += fieldBytes(*elems[i]);
+        return ret;
+    }
+    case pvd::union_: {
+        pvd::PVFieldPtr val(static_cast<const pvd::PVUnion&>(fld).get());
+        return val ? fieldBytes(*val) : 0u;
+    }
+    case pvd::unionArray: {
+        pvd::PVUnionArray::const_svector elems(static_cast<const pvd::PVUnionArray&>(fld).view());
+        size_t ret = 0u;
+        for(size_t i=0; i<elems.size(); i++)
+            if(elems[i])
+                ret += fieldBytes(*elems[i]);
+        return ret;
+    }
+    }
+    return 0u;
+}
+}
+
+size_t updateBytes(const pvd::PVStructure& root, const pvd::BitSet& changed)
+{
+    if(changed.get(root.getFieldOffset()))
+        return fieldBytes(root);
+
+    size_t ret = 0u;
+    for(pvd::int32 i = changed.nextSetBit(0); i>=0; ) {
+        pvd::PVFieldPtr fld(root.getSubField(i));
+        if(!fld)
+            break;
+        ret += fieldBytes(*fld);
+        // sub-fields of fld are already counted
+        i = changed.nextSetBit(fld->getNextFieldOffset());
+    }
+    return ret;
+}
+
+std::string StatsSample::fullName() const
+{
+    return counter ? name+"_total" : name+suffix;
+}
+
+std::string statsLabel(const char *key, const std::string& value)
+{
+    std::string ret(key);
+    ret += "=\"";
+    for(size_t i=0; i<value.size(); i++) {
+        switch(value[i]) {
+        case '\\': ret += "\\\\"; break;
+        case '"': ret += "\\\""; break;
+        case '\n': ret += "\\n"; break;
+        default: ret += value[i];
+        }
+    }
+    ret += '"';
+    return ret;
+}
+
+void histogramSamples(StatsSamples& samples, const std::string& name, const std::string& labels,
+                      const Histogram& H)
+{
+    // a consistent copy, as record() may be called concurrently
+    Histogram snap(H.unit);
+    snap.merge(H);
+
+    const std::string prefix(labels.empty() ? labels : labels+",");
+    const size_t maxunits = size_t(snap.max()/snap.unit+0.5);
+
+    // one bucket for each power of two, so the exposition is not too long
+    size_t cumulative = 0u;
+    for(size_t i=0; i<size_t(Histogram::nbuckets)-1u; i++) {
+        cumulative += snap.count(i);
+        if((i+1u)%Histogram::nsub)
+            continue;
+        size_t units = Histogram::upperBound(i);
+        char le[32];
+        epicsSnprintf(le, sizeof(le), snap.unit<1.0 ? "%.6f" : "%.1f", units*snap.unit);
+        samples.push_back(StatsSample(name, "_bucket", prefix+statsLabel("le", le), cumulative));
+        if(units > maxunits)
+            break; // remaining buckets are empty
+    }
+    samples.push_back(StatsSample(name, "_bucket", prefix+statsLabel("le", "+Inf"), snap.count()));
+    samples.push_back(StatsSample(name, "_count", labels, snap.count()));
+    samples.push_back(StatsSample(name, "_sum", labels, snap.sum()));
+}
+
+void writeOpenMetrics(std::ostream& strm, const StatsSamples& samples)
+{
+    // samples of one family must be together
+    StatsSamples sorted(samples);
+    std::stable_sort(sorted.begin(), sorted.end(), sampleLess);
+
+    // default precision (6) would round large values.  17 digits round trip a double
+    std::streamsize prec = strm.precision(17);
+
+    const std::string *family = 0;
+    FOREACH(StatsSamples::const_iterator, it, end, sorted) {
+        if(!family || *family!=it->name) {
+            family = &it->name;
+            strm<<"# TYPE "<<it->name<<(it->counter ? " counter\n" : it->histogram() ? " histogram\n" : " gauge\n");
+        }
+        strm<<it->fullName();
+        if(!it->labels.empty())
+            strm<<'{'<<it->labels<<'}';
+        strm<<' ';
+        if(it->counter)
+            strm<<epicsUInt64(it->value); // counters are integers
+        else
+            strm<<it->value;
+        strm<<'\n';
+    }
+    strm<<"# EOF\n";
+    strm.precision(prec);
+}
+
+struct StatsProvider::Channel : public BaseChannel
+{
+    POINTER_DEFINITIONS(Channel);
+    weak_pointer weakself;
+
+    const StatsProvider::shared_pointer prov;
+
+    Channel(const StatsProvider::shared_pointer& prov,
+            const pva::ChannelRequester::shared_pointer& req)
+        :BaseChannel(prov->pvname, prov, req, statsType)
+        ,prov(prov)
+    {}
+    virtual ~Channel() {}
+
+    virtual pva::ChannelGet::shared_pointer createChannelGet(
+            pva::ChannelGetRequester::shared_pointer const & requester,
+            pvd::PVStructure::shared_pointer const & pvRequest);
+
+    virtual pvd::Monitor::shared_pointer createMonitor(
+            pvd::MonitorRequester::shared_pointer const & requester,
+            pvd::PVStructure::shared_pointer const & pvRequest);
+};
+
+struct StatsProvider::Get : public pva::ChannelGet,
+                            public std::tr1::enable_shared_from_this<StatsProvider::Get>
+{
+    POINTER_DEFINITIONS(Get);
+
+    const StatsProvider::Channel::shared_pointer channel;
+    const pva::ChannelGetRequester::weak_pointer requester;
+
+    Get(const StatsProvider::Channel::shared_pointer& channel,
+        const pva::ChannelGetRequester::shared_pointer& requester)
+        :channel(channel)
+        ,requester(requester)
+    {}
+    virtual ~Get() {}
+
+    virtual void destroy() {}
+    virtual std::tr1::shared_ptr<pva::Channel> getChannel() { return channel; }
+    virtual void cancel() {}
+    virtual void lastRequest() {}
+
+    virtual void get()
+    {
+        StatsProvider& P = *channel->prov;
+        pvd::PVStructurePtr value(pvd::getPVDataCreate()->createPVStructure(statsType));
+        pvd::BitSet::shared_pointer changed(new pvd::BitSet);
+        changed->set(0);
+        {
+            Guard G(P.lock);
+            value->copyUnchecked(*P.value);
+        }
+        pva::ChannelGetRequester::shared_pointer req(requester.lock());
+        if(req)
+            req->getDone(pvd::Status(), shared_from_this(), value, changed);
+    }
+};
+
+struct StatsProvider::Monitor : public BaseMonitor
+{
+    POINTER_DEFINITIONS(Monitor);
+
+    const StatsProvider::shared_pointer prov;
+
+    Monitor(const StatsProvider::shared_pointer& prov,
+            const requester_t::shared_pointer& requester,
+            const pvd::PVStructure::shared_pointer& pvReq)
+        :BaseMonitor(prov->lock, requester, pvReq)
+        ,prov(prov)
+    {}
+    virtual ~Monitor() { destroy(); }
+
+    virtual void onStart()
+    {
+        guard_t G(lock);
+        post(G);
+    }
+};
+
+pva::ChannelGet::shared_pointer
+StatsProvider::Channel::createChannelGet(
+        pva::ChannelGetRequester::shared_pointer const & requester,
+        pvd::PVStructure::shared_pointer const & pvRequest)
+{
+    StatsProvider::Get::shared_pointer ret(new StatsProvider::Get(shared_pointer(weakself), requester));
+    requester->channelGetConnect(pvd::Status(), ret, fielddesc);
+    return ret;
+}
+
+pvd::Monitor::shared_pointer
+StatsProvider::Channel::createMonitor(
+        pvd::MonitorRequester::shared_pointer const & requester,
+        pvd::PVStructure::shared_pointer const & pvRequest)
+{
+    StatsProvider::Monitor::shared_pointer ret(new StatsProvider::Monitor(prov, requester, pvRequest));
+    prov->monitors.insert(ret);
+    ret->weakself = ret;
+    Guard G(prov->lock);
+    ret->connect(G, prov->value);
+    return ret;
+}
+
+StatsProvider::StatsProvider(const std::string& prefix)
+    :pvname(prefix+"stats")
+    ,value(pvd::getPVDataCreate()->createPVStructure(statsType))
+{
+    pvd::PVStringArray::svector labels(3);
+    labels[0] = "name";
+    labels[1] = "labels";
+    labels[2] = "value";
+    value->getSubFieldT<pvd::PVStringArray>("labels")->replace(pvd::freeze(labels));
+}
+
+StatsProvider::~StatsProvider() {}
+
+void StatsProvider::update(const StatsSamples& samples)
+{
+    pvd::PVStringArray::svector names(samples.size()), labels(samples.size());
+    pvd::PVDoubleArray::svector values(samples.size());
+    for(size_t i=0; i<samples.size(); i++) {
+        names[i] = samples[i].fullName();
+        labels[i] = samples[i].labels;
+        values[i] = samples[i].value;
+    }
+
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+
+    weak_set<Monitor>::vector_type tonotify(monitors.lock_vector());
+
+    pvd::BitSet changed;
+    Guard G(lock);
+
+    value->getSubFieldT<pvd::PVStringArray>("value.name")->replace(pvd::freeze(names));
+    value->getSubFieldT<pvd::PVStringArray>("value.labels")->replace(pvd::freeze(labels));
+    value->getSubFieldT<pvd::PVDoubleArray>("value.value")->replace(pvd::freeze(values));
+    value->getSubFieldT<pvd::PVLong>("timeStamp.secondsPastEpoch")->put(now.secPastEpoch+POSIX_TIME_AT_EPICS_EPOCH);
+    value->getSubFieldT<pvd::PVInt>("timeStamp.nanoseconds")->put(now.nsec);
+
+    changed.set(value->getSubFieldT<pvd::PVField>("value")->getFieldOffset());
+    changed.set(value->getSubFieldT<pvd::PVField>("timeStamp")->getFieldOffset());
+
+    FOREACH(weak_set<Monitor>::vector_type::iterator, it, end, tonotify) {
+        (*it)->post(G, changed); // unlocks for callback
+    }
+}
+
+std::tr1::shared_ptr<pva::ChannelProvider>
+StatsProvider::getChannelProvider()
+{
+    return shared_from_this();
+}
+
+pva::ChannelFind::shared_pointer
+StatsProvider::channelFind(std::string const & channelName,
+                           pva::ChannelFindRequester::shared_pointer const & channelFindRequester)
+{
+    pva::ChannelFind::shared_pointer ret;
+    bool found = channelName==pvname;
+    if(found)
+        ret = shared_from_this();
+    channelFindRequester->channelFindResult(pvd::Status::Ok, ret, found);
+    return ret;
+}
+
+pva::Channel::shared_pointer
+StatsProvider::createChannel(std::string const & channelName,
+                             pva::ChannelRequester::shared_pointer const & channelRequester,
+                             short priority, std::string const & addressx)
+{
+    StatsProvider::Channel::shared_pointer ret;
+    if(channelName==pvname) {
+        ret.reset(new StatsProvider::Channel(shared_from_this(), channelRequester));
+        ret->weakself = ret;
+        channelRequester->channelCreated(pvd::Status::Ok, ret);
+    } else {
+        channelRequester->channelCreated(pvd::Status(pvd::Status::STATUSTYPE_ERROR, "Not found"), ret);
+    }
+    return ret;
+}
@@ -0,0 +1,181 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include <epicsMutex.h>
+#include <epicsTypes.h>
+
+#include <pv/pvAccess.h>
+
+#include "weakset.h"
+
+/** Counter incremented from many threads.
+ *
+ * Each thread adds to one of several slots, each on its own cache line,
+ * so that the hot path does not contend.  Slots are summed by get().
+ */
+struct StatCounter
+{
+    enum {nslots = 8};
+
+    StatCounter();
+
+    void add(size_t n = 1u);
+    size_t get() const;
+
+private:
+    struct slot_t {
+        size_t count;
+        char pad[64-sizeof(size_t)];
+    } slots[nslots];
+
+    static size_t slot();
+};
+
+/** Histogram with log spaced buckets, in the manner of HdrHistogram.
+ *
+ * Values are counted as integer multiples of unit.  Each power of two is divided
+ * into nsub linear sub-buckets, so a bucket is at most 1/nsub wider than its lower bound.
+ * Larger values (2**nexp units or more) are counted in the last bucket.
+ * record() is lock free.
+ */
+struct Histogram
+{
+    enum {nsubbits = 2,
+          nsub = 1<<nsubbits,
+          nexp = 28, // values < 2**nexp units
+          nbuckets = (nexp-nsubbits+1)*nsub};
+
+    const double unit;
+
+    explicit Histogram(double unit);
+
+    void record(double value);
+    //! Add the counts of another histogram.  Not atomic, for a local copy.
+    void merge(const Histogram& other);
+
+    size_t count() const;
+    //! # of values counted in one bucket
+    size_t count(size_t bucket) const;
+    //! sum of all values recorded
+    double sum() const;
+    //! sum of all values recorded, in units
+    epicsUInt64 sumUnits() const;
+    //! largest value recorded
+    double max() const;
+    //! upper bound of the bucket containing the q-th quantile (0<=q<=1).  zero if empty
+    double quantile(double q) const;
+
+    //! bucket # for a value in units
+    static size_t bucketOf(size_t units);
+    //! exclusive upper bound of a bucket, in units
+    static size_t upperBound(size_t bucket);
+
+private:
+    size_t counts[nbuckets];
+    // sum in units, with carry into sumhi where size_t is 32 bits.
+    // epicsAtomic has no 64-bit add
+    size_t sumlo, sumhi;
+    size_t maxval;
+
+    void addSum(size_t val);
+};
+
+//! Latencies in seconds, counted in usec. (up to ~268 sec.)
+struct LatencyHistogram : public Histogram
+{
+    LatencyHistogram() :Histogram(1e-6) {}
+};
+
+//! Sizes in bytes (up to 256 MB)
+struct ByteHistogram : public Histogram
+{
+    ByteHistogram() :Histogram(1.0) {}
+};
+
+/** Estimate the size in bytes of the fields of root marked in changed.
+ * Counts the values of scalars and arrays, without type or protocol overhead.
+ */
+size_t updateBytes(const epics::pvData::PVStructure& root, const epics::pvData::BitSet& changed);
+
+//! One value for the statistics exposition
+struct StatsSample
+{
+    std::string name;   // metric family
+    std::string labels; // eg. client="a",channel="b"
+    double value;
+    bool counter;       // monotonic.  Otherwise a gauge
+    std::string suffix; // for a histogram "_bucket", "_count", or "_sum".  Otherwise empty
+
+    StatsSample() :value(0.0), counter(false) {}
+    StatsSample(const std::string& name, const std::string& labels, double value, bool counter)
+        :name(name), labels(labels), value(value), counter(counter)
+    {}
+    //! One sample of a histogram
+    StatsSample(const std::string& name, const char *suffix, const std::string& labels, double value)
+        :name(name), labels(labels), value(value), counter(false), suffix(suffix)
+    {}
+
+    bool histogram() const { return !suffix.empty(); }
+
+    //! name as exposed.  counters get a "_total" suffix
+    std::string fullName() const;
+};
+typedef std::vector<StatsSample> StatsSamples;
+
+//! Quote a label value
+std::string statsLabel(const char *key, const std::string& value);
+
+/** Append the samples of a histogram family: cumulative "_bucket" counts
+ * at each power of two up to the largest value, then "_count" and "_sum".
+ */
+void histogramSamples(StatsSamples& samples, const std::string& name, const std::string& labels,
+                      const Histogram& H);
+
+//! Write OpenMetrics text exposition format
+void writeOpenMetrics(std::ostream& strm, const StatsSamples& samples);
+
+/** Serves one status PV, "<prefix>stats", an NTTable of statistics with columns
+ * name, labels, and value.  update() posts new values to subscribers.
+ */
+struct StatsProvider :
+        public epics::pvAccess::ChannelProvider,
+        public epics::pvAccess::ChannelFind,
+        public std::tr1::enable_shared_from_this<StatsProvider>
+{
+    POINTER_DEFINITIONS(StatsProvider);
+    struct Channel;
+    struct Get;
+    struct Monitor;
+
+    const std::string pvname;
+
+    epicsMutex lock;
+    // guarded by lock
+    epics::pvData::PVStructurePtr value;
+    weak_set<Monitor> monitors;
+
+    explicit StatsProvider(const std::string& prefix);
+    virtual ~StatsProvider();
+
+    void update(const StatsSamples& samples);
+
+    virtual std::tr1::shared_ptr<ChannelProvider> getChannelProvider();
+    virtual void cancel() {}
+
+    virtual std::string getProviderName() { return "GWStats"; }
+
+    virtual epics::pvAccess::ChannelFind::shared_pointer channelFind(std::string const & channelName,
+                                             epics::pvAccess::ChannelFindRequester::shared_pointer const & channelFindRequester);
+
+    using epics::pvAccess::ChannelProvider::createChannel;
+    virtual epics::pvAccess::Channel::shared_pointer createChannel(std::string const & channelName,
+                                                       epics::pvAccess::ChannelRequester::shared_pointer const & channelRequester,
+                                                       short priority, std::string const & addressx);
+    virtual void destroy() {}
+};
+
+#endif // STATS_H
@@ -1,6 +1,10 @@
 
+#include <sstream>
+#include <cmath>
+
 #include <epicsAtomic.h>
 #include <epicsGuard.h>
+#include <epicsThread.h>
 #include <epicsUnitTest.h>
 #include <testMain.h>
 
@@ -36,6 +40,128 @@ pvd::PVStructurePtr makeRequest(size_t bsize)
     return ret;
 }
 
+pvd::PVStructurePtr makeRateRequest(size_t bsize, double maxRate)
+{
+    pvd::StructureConstPtr dtype(pvd::getFieldCreate()->createFieldBuilder()
+                                 ->addNestedStructure("record")
+                                    ->addNestedStructure("_options")
+                                        ->add("queueSize", pvd::pvString)
+                                        ->add("maxRate", pvd::pvString)
+                                    ->endNested()
+                                 ->endNested()
+                                 ->createStructure());
+
+    pvd::PVStructurePtr ret(pvd::getPVDataCreate()->createPVStructure(dtype));
+    ret->getSubFieldT<pvd::PVScalar>("record._options.queueSize")->putFrom<pvd::int32>(bsize);
+    ret->getSubFieldT<pvd::PVScalar>("record._options.maxRate")->putFrom<double>(maxRate);
+
+    return ret;
+}
+
+pvd::PVStructurePtr makeDeadbandRequest(double abs, double rel)
+{
+    pvd::StructureConstPtr dtype(pvd::getFieldCreate()->createFieldBuilder()
+                                 ->addNestedStructure("record")
+                                    ->addNestedStructure("_options")
+                                        ->add("deadband", pvd::pvString)
+                                        ->add("relDeadband", pvd::pvString)
+                                    ->endNested()
+                                 ->endNested()
+                                 ->createStructure());
+
+    pvd::PVStructurePtr ret(pvd::getPVDataCreate()->createPVStructure(dtype));
+    ret->getSubFieldT<pvd::PVScalar>("record._options.deadband")->putFrom<double>(abs);
+    ret->getSubFieldT<pvd::PVScalar>("record._options.relDeadband")->putFrom<double>(rel);
+
+    return ret;
+}
+
+pvd::PVStructurePtr makePutRequest(bool block)
+{
+    pvd::StructureConstPtr dtype(pvd::getFieldCreate()->createFieldBuilder()
+                                 ->addNestedStructure("record")
+                                    ->addNestedStructure("_options")
+                                        ->add("block", pvd::pvString)
+                                    ->endNested()
+                                 ->endNested()
+                                 ->createStructure());
+
+    pvd::PVStructurePtr ret(pvd::getPVDataCreate()->createPVStructure(dtype));
+    ret->getSubFieldT<pvd::PVScalar>("record._options.block")->putFrom<pvd::boolean>(block);
+
+    return ret;
+}
+
+pvd::PVStructurePtr makeProcessRequest()
+{
+    pvd::StructureConstPtr dtype(pvd::getFieldCreate()->createFieldBuilder()
+                                 ->addNestedStructure("record")
+                                    ->addNestedStructure("_options")
+                                        ->add("process", pvd::pvString)
+                                    ->endNested()
+                                 ->endNested()
+                                 ->createStructure());
+
+    pvd::PVStructurePtr ret(pvd::getPVDataCreate()->createPVStructure(dtype));
+    ret->getSubFieldT<pvd::PVScalar>("record._options.process")->putFrom<std::string>("true");
+
+    return ret;
+}
+
+// keeps Requester::message()s
+struct TestMessageMonitorRequester : public TestChannelMonitorRequester
+{
+    POINTER_DEFINITIONS(TestMessageMonitorRequester);
+    std::vector<std::string> messages;
+    virtual ~TestMessageMonitorRequester() {}
+    virtual void message(std::string const & message, pvd::MessageType messageType)
+    {
+        Guard G(lock);
+        messages.push_back(message);
+    }
+};
+
+// counts monitorEvent() calls not made by the thread which created it
+struct TestWorkerMonitorRequester : public TestChannelMonitorRequester
+{
+    POINTER_DEFINITIONS(TestWorkerMonitorRequester);
+    const epicsThreadId creator;
+    size_t nfromworker; // guarded by lock
+    TestWorkerMonitorRequester() :creator(epicsThreadGetIdSelf()), nfromworker(0u) {}
+    virtual ~TestWorkerMonitorRequester() {}
+    virtual void monitorEvent(pvd::MonitorPtr const & monitor)
+    {
+        {
+            Guard G(lock);
+            if(epicsThreadGetIdSelf()!=creator)
+                nfromworker++;
+        }
+        TestChannelMonitorRequester::monitorEvent(monitor);
+    }
+    size_t fromWorker()
+    {
+        Guard G(lock);
+        return nfromworker;
+    }
+};
+
+struct TestFindRequester : public pva::ChannelFindRequester
+{
+    POINTER_DEFINITIONS(TestFindRequester);
+    bool done, found;
+    pva::ChannelFind::shared_pointer find;
+    TestFindRequester() :done(false), found(false) {}
+    virtual ~TestFindRequester() {}
+    virtual void channelFindResult(const pvd::Status& status,
+                                   pva::ChannelFind::shared_pointer const & channelFind,
+                                   bool wasFound)
+    {
+        done = true;
+        found = status.isSuccess() && wasFound;
+        find = channelFind;
+    }
+};
+
 struct TestMonitor {
     TestProvider::shared_pointer upstream;
     TestPV::shared_pointer test1;
@@ -55,7 +181,7 @@ struct TestMonitor {
                                ->createStructure()))
         ,test1_x(test1->value, "x")
         ,test1_y(test1->value, "y")
-        ,gateway(new GWServerChannelProvider(upstream))
+        ,gateway(new GWServerChannelProvider(upstream, ChannelCache::createInline))
         ,client_req(new TestChannelRequester)
         ,client(gateway->createChannel("test1", client_req))
     {
@@ -168,6 +294,652 @@ struct TestMonitor {
         mon2->destroy();
     }
 
+    void test_share_snapshot()
+    {
+        testDiag("Test two downstream monitors sharing immutable snapshots");
+        gateway->cache.snapshotMonitors = true;
+
+        TestChannelMonitorRequester::shared_pointer mreq(new TestChannelMonitorRequester);
+        pvd::Monitor::shared_pointer mon(client->createMonitor(mreq, makeRequest(2)));
+        if(!mon) testAbort("Failed to create monitor");
+
+        TestChannelMonitorRequester::shared_pointer mreq2(new TestChannelMonitorRequester);
+        pvd::Monitor::shared_pointer mon2(client->createMonitor(mreq2, makeRequest(2)));
+        if(!mon2) testAbort("Failed to create monitor2");
+
+        testOk1(mon->start().isSuccess());
+        testOk1(mon2->start().isSuccess());
+        upstream->dispatch(); // trigger monitorEvent() from upstream to gateway
+
+        pva::MonitorElementPtr elem(mon->poll());
+        pva::MonitorElementPtr elem2(mon2->poll());
+        testOk1(elem && elem2 && elem!=elem2);
+        testOk1(elem && elem2 && elem->pvStructurePtr==elem2->pvStructurePtr);
+        testOk1(elem && elem->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get()==1);
+
+        if(elem) mon->release(elem);
+        if(elem2) mon2->release(elem2);
+
+        testDiag("mon keeps up while mon2 overflows");
+        pvd::BitSet changed;
+        changed.set(1);
+        for(pvd::int32 i=50; i<54; i++) {
+            test1_x = i;
+            test1->post(changed);
+
+            elem = mon->poll();
+            testOk(elem && elem->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get()==i, "x==%d", (int)i);
+            if(elem) mon->release(elem);
+        }
+
+        elem2 = mon2->poll();
+        testOk1(elem2 && elem2->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get()==50);
+        if(elem2) mon2->release(elem2);
+        elem2 = mon2->poll();
+        testOk1(elem2 && elem2->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get()==51);
+        if(elem2) mon2->release(elem2);
+        elem2 = mon2->poll();
+        testOk1(elem2 && elem2->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get()==53);
+        testOk1(elem2 && elem2->overrunBitSet->nextSetBit(0)==1);
+        if(elem2) mon2->release(elem2);
+
+        testOk1(!mon->poll());
+        testOk1(!mon2->poll());
+
+        MonitorUser::shared_pointer usr2(std::tr1::static_pointer_cast<MonitorUser>(mon2));
+        pva::MonitorElementPtr spare;
+        {
+            Guard G(usr2->mutex());
+            testOk(usr2->spares.size()==1u, "private element kept");
+            if(!usr2->spares.empty())
+                spare = usr2->spares.back();
+        }
+
+        testDiag("second overflow re-uses the private element");
+        for(pvd::int32 i=60; i<64; i++) {
+            test1_x = i;
+            test1->post(changed);
+
+            elem = mon->poll();
+            if(elem) mon->release(elem);
+        }
+
+        elem2 = mon2->poll();
+        testOk1(elem2 && elem2->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get()==60);
+        if(elem2) mon2->release(elem2);
+        {
+            Guard G(usr2->mutex());
+            testOk(spare && usr2->overflowElement==spare && usr2->spares.empty(), "overflowElement re-used");
+        }
+        elem2 = mon2->poll();
+        if(elem2) mon2->release(elem2);
+        elem2 = mon2->poll();
+        testOk1(elem2 && elem2->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get()==63);
+        if(elem2) mon2->release(elem2);
+
+        mon->destroy();
+        mon2->destroy();
+    }
+
+    void test_flow_control()
+    {
+        testDiag("Check that upstream is not poll()'d while downstream is full");
+        gateway->cache.monitorFlowControl = true;
+
+        TestChannelMonitorRequester::shared_pointer mreq(new TestChannelMonitorRequester);
+        pvd::Monitor::shared_pointer mon(client->createMonitor(mreq, makeRequest(2)));
+        if(!mon) testAbort("Failed to create monitor");
+        MonitorUser::shared_pointer usr(std::tr1::dynamic_pointer_cast<MonitorUser>(mon));
+
+        testOk1(mon->start().isSuccess());
+        upstream->dispatch(); // trigger monitorEvent() from upstream to gateway
+
+        testDiag("hold initial update");
+        pva::MonitorElementPtr first(mon->poll());
+        testOk1(!!first.get());
+
+        // fills our queue, then leaves the rest upstream
+        pvd::BitSet changed;
+        changed.set(1);
+        for(pvd::int32 i=50; i<54; i++) {
+            test1_x = i;
+            test1->post(changed);
+        }
+
+        {
+            Guard G(usr->mutex());
+            testOk1(!!usr->entry->blocked);
+            testOk1(usr->ndropped==0);
+        }
+
+        if(first) mon->release(first);
+
+        for(pvd::int32 i=50; i<54; i++) {
+            pva::MonitorElementPtr elem(mon->poll());
+            testOk(elem && elem->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get()==i, "x==%d", (int)i);
+            if(elem) mon->release(elem);
+        }
+
+        testOk1(!mon->poll());
+
+        mon->destroy();
+    }
+
+    void test_getfield()
+    {
+        testDiag("Test getField() cache");
+
+        GWChannel::shared_pointer chan(std::tr1::dynamic_pointer_cast<GWChannel>(client));
+        TestChannelFieldRequester::shared_pointer req(new TestChannelFieldRequester);
+
+        client->getField(req, "");
+        testOk1(req->done && req->status.isSuccess() && req->fielddesc==test1->dtype);
+
+        req.reset(new TestChannelFieldRequester);
+        client->getField(req, "");
+        testOk1(req->done && req->fielddesc==test1->dtype);
+
+        req.reset(new TestChannelFieldRequester);
+        client->getField(req, "x");
+        testOk1(req->done && req->fielddesc && req->fielddesc->getType()==pvd::scalar);
+
+        req.reset(new TestChannelFieldRequester);
+        client->getField(req, "nonexistent");
+        testOk1(req->done && !req->status.isSuccess());
+
+        {
+            Guard G(chan->entry->mutex());
+            testOk(chan->entry->nfieldhits==3 && chan->entry->nfieldmisses==1,
+                   "hits %u misses %u", (unsigned)chan->entry->nfieldhits, (unsigned)chan->entry->nfieldmisses);
+        }
+
+        test1->disconnect();
+        {
+            Guard G(chan->entry->mutex());
+            testOk1(!chan->entry->fieldtype);
+        }
+    }
+
+    void test_get_share()
+    {
+        testDiag("Test sharing of upstream get()");
+
+        GWServerOptions opts;
+        opts.getHoldoff = 100.0;
+        GWServerView::shared_pointer view(new GWServerView(gateway, opts));
+        TestChannelRequester::shared_pointer creq(new TestChannelRequester);
+        pva::Channel::shared_pointer chan(view->createChannel("test1", creq));
+        if(!chan) testAbort("channel \"test1\" not connected");
+
+        TestChannelGetRequester::shared_pointer req1(new TestChannelGetRequester),
+                                                req2(new TestChannelGetRequester);
+        pva::ChannelGet::shared_pointer get1(chan->createChannelGet(req1, makeRequest(0))),
+                                        get2(chan->createChannelGet(req2, makeRequest(0)));
+        testOk1(req1->connected && req2->connected && req2->fielddesc==test1->dtype);
+
+        {
+            Guard G(test1->lock);
+            test1->getChanged.set(1); // upstream reports only 'x' changed
+        }
+
+        get1->get();
+        testOk1(req1->done && req1->value && req1->value->getSubFieldT<pvd::PVInt>("x")->get()==1);
+        testOk(req1->changed && req1->changed->get(0), "forwarded get() marks all changed");
+
+        test1_x = 5;
+        get2->get();
+        testOk(req2->done && req2->value && req2->value->getSubFieldT<pvd::PVInt>("x")->get()==1,
+               "second get() within holdoff sees previous value");
+        testOk(req2->changed && req2->changed->get(0), "shared get() marks all changed");
+        testEqual(test1->ngets, 1u);
+
+        testDiag("holdoff zero forwards every get()");
+        TestChannelGetRequester::shared_pointer req3(new TestChannelGetRequester);
+        pva::ChannelGet::shared_pointer get3(client->createChannelGet(req3, makeRequest(0)));
+        get3->get();
+        testOk1(req3->done && req3->value && req3->value->getSubFieldT<pvd::PVInt>("x")->get()==5);
+        testEqual(test1->ngets, 2u);
+
+        {
+            Guard G(test1->lock);
+            test1->getChanged.clear();
+        }
+
+        get1->destroy();
+        get2->destroy();
+        get3->destroy();
+        chan->destroy();
+    }
+
+    void test_server_views()
+    {
+        testDiag("Test two servers with different options on one client");
+
+        GWServerOptions opts[2];
+        opts[0].getHoldoff = 1.0;
+        opts[1].getHoldoff = 2.0;
+
+        for(size_t i=0; i<2; i++) {
+            GWServerView::shared_pointer view(new GWServerView(gateway, opts[i]));
+
+            TestFindRequester::shared_pointer freq(new TestFindRequester);
+            view->channelFind("test1", freq);
+            testOk1(freq->done && freq->found);
+            testOk(freq->find && freq->find->getChannelProvider()==view, "found through view %u", unsigned(i));
+            if(!freq->find)
+                testAbort("channel \"test1\" not found");
+
+            // as the server does
+            TestChannelRequester::shared_pointer creq(new TestChannelRequester);
+            pva::Channel::shared_pointer chan(freq->find->getChannelProvider()->createChannel("test1", creq));
+            GWChannel::shared_pointer gwchan(std::tr1::dynamic_pointer_cast<GWChannel>(chan));
+            testOk1(gwchan && gwchan->getProvider()==view);
+            testOk1(gwchan && gwchan->options.getHoldoff==opts[i].getHoldoff);
+            if(chan)
+                chan->destroy();
+        }
+    }
+
+    void test_get_monitor()
+    {
+        testDiag("Test get() answered from a running monitor");
+
+        GWServerOptions opts;
+        opts.getFromMonitor = true;
+        GWServerView::shared_pointer view(new GWServerView(gateway, opts));
+        TestChannelRequester::shared_pointer creq(new TestChannelRequester);
+        pva::Channel::shared_pointer chan(view->createChannel("test1", creq));
+        if(!chan) testAbort("channel \"test1\" not connected");
+
+        TestChannelGetRequester::shared_pointer req(new TestChannelGetRequester);
+        pva::ChannelGet::shared_pointer get(chan->createChannelGet(req, makeRequest(0)));
+        testOk1(req->connected);
+
+        get->get();
+        testOk(req->done && test1->ngets==1, "no monitor, get() forwarded");
+
+        TestChannelMonitorRequester::shared_pointer mreq(new TestChannelMonitorRequester);
+        pvd::Monitor::shared_pointer mon(client->createMonitor(mreq, makeRequest(2)));
+        if(!mon) testAbort("Failed to create monitor");
+        testOk1(mon->start().isSuccess());
+        upstream->dispatch(); // trigger monitorEvent() from upstream to gateway
+
+        test1_x = 7;
+        pvd::BitSet changed;
+        changed.set(1);
+        test1->post(changed);
+
+        req->done = false;
+        get->get();
+        testOk1(req->done && req->value && req->value->getSubFieldT<pvd::PVInt>("x")->get()==7);
+        testEqual(test1->ngets, 1u);
+
+        testDiag("get() with process=true is forwarded");
+        TestChannelGetRequester::shared_pointer preq(new TestChannelGetRequester);
+        pva::ChannelGet::shared_pointer pget(chan->createChannelGet(preq, makeProcessRequest()));
+        testOk1(preq->connected);
+        pget->get();
+        testOk1(preq->done && preq->value && preq->value->getSubFieldT<pvd::PVInt>("x")->get()==7);
+        testEqual(test1->ngets, 2u);
+
+        mon->destroy();
+        pget->destroy();
+        get->destroy();
+        chan->destroy();
+    }
+
+    void test_put_combine()
+    {
+        testDiag("Test combining of non-blocking put()s");
+
+        GWServerOptions opts;
+        opts.combinePuts = true;
+        GWServerView::shared_pointer view(new GWServerView(gateway, opts));
+        TestChannelRequester::shared_pointer creq(new TestChannelRequester);
+        pva::Channel::shared_pointer chan(view->createChannel("test1", creq));
+        if(!chan) testAbort("channel \"test1\" not connected");
+
+        TestChannelPutRequester::shared_pointer req[3];
+        pva::ChannelPut::shared_pointer put[3];
+        for(size_t i=0; i<3; i++) {
+            req[i].reset(new TestChannelPutRequester);
+            put[i] = chan->createChannelPut(req[i], makePutRequest(false));
+        }
+        testOk1(req[0]->connected && req[1]->connected && req[2]->connected && req[2]->fielddesc==test1->dtype);
+
+        test1->holdPuts = true;
+
+        pvd::PVStructurePtr val(pvd::getPVDataCreate()->createPVStructure(test1->dtype));
+        pvd::BitSet::shared_pointer changed(new pvd::BitSet);
+
+        val->getSubFieldT<pvd::PVInt>("x")->put(10);
+        changed->clear();
+        changed->set(1);
+        put[0]->put(val, changed);
+        testEqual(test1->nputs, 1u);
+
+        val->getSubFieldT<pvd::PVInt>("y")->put(20);
+        changed->clear();
+        changed->set(2);
+        put[1]->put(val, changed);
+
+        val->getSubFieldT<pvd::PVInt>("x")->put(30);
+        changed->clear();
+        changed->set(1);
+        put[2]->put(val, changed);
+        testEqual(test1->nputs, 1u);
+
+        test1->completePuts();
+        testOk1(req[0]->donePut && !req[1]->donePut && !req[2]->donePut);
+        testEqual(test1->nputs, 2u);
+
+        test1->completePuts();
+        testOk1(req[1]->donePut && req[2]->donePut);
+        testOk(test1_x==30 && test1_y==20, "x=%d y=%d", (int)test1_x, (int)test1_y);
+
+        {
+            PutCacheEntry::shared_pointer pent(std::tr1::static_pointer_cast<PutUser>(put[0])->entry);
+            Guard G(pent->mutex());
+            testEqual(pent->nabsorbed, 1u);
+        }
+
+        testDiag("blocking put() is forwarded");
+        TestChannelPutRequester::shared_pointer breq(new TestChannelPutRequester);
+        pva::ChannelPut::shared_pointer bput(chan->createChannelPut(breq, makePutRequest(true)));
+        testOk1(!std::tr1::dynamic_pointer_cast<PutUser>(bput));
+
+        for(size_t i=0; i<3; i++)
+            put[i]->destroy();
+        bput->destroy();
+        chan->destroy();
+    }
+
+    void test_monitor_policy()
+    {
+        testDiag("Test server side monitor policy, drop oldest");
+
+        MonitorPolicy::shared_pointer other(new MonitorPolicy), policy(new MonitorPolicy);
+        other->channel = "other*";
+        other->queueSize = 1;
+        policy->channel = "test*";
+        policy->queueSize = 3;
+        policy->dropOldest = true;
+
+        GWServerOptions opts;
+        opts.monitorPolicies.push_back(other);
+        opts.monitorPolicies.push_back(policy);
+        GWServerView::shared_pointer view(new GWServerView(gateway, opts));
+        TestChannelRequester::shared_pointer creq(new TestChannelRequester);
+        pva::Channel::shared_pointer chan(view->createChannel("test1", creq));
+        if(!chan) testAbort("channel \"test1\" not connected");
+
+        TestChannelMonitorRequester::shared_pointer mreq(new TestChannelMonitorRequester);
+        pvd::Monitor::shared_pointer mon(chan->createMonitor(mreq, makeRequest(2)));
+        if(!mon) testAbort("Failed to create monitor");
+        testOk1(mon->start().isSuccess());
+        upstream->dispatch(); // trigger monitorEvent() from upstream to gateway
+
+        pva::MonitorElementPtr elem(mon->poll());
+        testOk1(!!elem.get());
+        if(elem) mon->release(elem);
+
+        pvd::BitSet changed;
+        changed.set(1);
+        for(int i=50; i<54; i++) {
+            test1_x = i;
+            test1->post(changed, i==53);
+        }
+
+        testDiag("50 is discarded");
+        for(int i=51; i<54; i++) {
+            elem = mon->poll();
+            testOk(elem && elem->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get()==i,
+                   "x=%d", elem ? (int)elem->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get() : -42);
+            if(i==51)
+                testOk(elem && elem->overrunBitSet->nextSetBit(0)==1, "overrun shows discarded change");
+            if(elem) mon->release(elem);
+        }
+        testOk1(!mon->poll());
+
+        testEqual(epicsAtomicGetSizeT(&policy->nusers), 1u);
+        testEqual(epicsAtomicGetSizeT(&policy->ndropped), 1u);
+        testEqual(epicsAtomicGetSizeT(&other->nusers), 0u);
+
+        mon->destroy();
+
+        testDiag("Test server side monitor policy, maxRate");
+
+        policy->dropOldest = false;
+        policy->maxRate = 2.0;
+
+        mreq.reset(new TestChannelMonitorRequester);
+        mon = chan->createMonitor(mreq, makeRequest(2));
+        if(!mon) testAbort("Failed to create monitor");
+        testOk1(mon->start().isSuccess());
+        upstream->dispatch();
+
+        elem = mon->poll();
+        testOk1(!!elem.get());
+        if(elem) mon->release(elem);
+
+        test1_x = 60;
+        test1->post(changed);
+        test1_x = 61;
+        test1->post(changed);
+
+        testOk(!mon->poll(), "updates held back");
+        testEqual(epicsAtomicGetSizeT(&policy->ndecimated), 2u);
+
+        epicsThreadSleep(1.0);
+
+        elem = mon->poll();
+        testOk(elem && elem->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get()==61,
+               "x=%d", elem ? (int)elem->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get() : -42);
+        testOk1(elem && elem->overrunBitSet->nextSetBit(0)==1);
+        if(elem) mon->release(elem);
+        testOk1(!mon->poll());
+
+        mon->destroy();
+        chan->destroy();
+    }
+
+    void test_request_rate()
+    {
+        testDiag("Test record._options.maxRate");
+
+        TestChannelMonitorRequester::shared_pointer mreq(new TestChannelMonitorRequester),
+                                                    mreq2(new TestChannelMonitorRequester);
+        pvd::Monitor::shared_pointer mon(client->createMonitor(mreq, makeRateRequest(2, 2.0))),
+                                     mon2(client->createMonitor(mreq2, makeRateRequest(2, 0.0)));
+        if(!mon || !mon2) testAbort("Failed to create monitor");
+
+        MonitorUser::shared_pointer usr(std::tr1::static_pointer_cast<MonitorUser>(mon)),
+                                    usr2(std::tr1::static_pointer_cast<MonitorUser>(mon2));
+        testOk(usr->entry==usr2->entry, "share upstream monitor");
+        testOk(usr->minInterval==0.5 && usr2->minInterval==0.0, "minInterval %f %f",
+               usr->minInterval, usr2->minInterval);
+
+        testOk1(mon->start().isSuccess());
+        testOk1(mon2->start().isSuccess());
+        upstream->dispatch();
+
+        pva::MonitorElementPtr elem;
+        for(size_t i=0; i<2; i++) {
+            pvd::Monitor::shared_pointer& M = i ? mon2 : mon;
+            elem = M->poll();
+            testOk1(!!elem.get());
+            if(elem) M->release(elem);
+        }
+
+        pvd::BitSet changed;
+        changed.set(1);
+        test1_x = 60;
+        test1->post(changed);
+        test1_x = 61;
+        test1->post(changed);
+
+        testOk(!mon->poll(), "updates held back");
+        for(int i=60; i<62; i++) {
+            elem = mon2->poll();
+            testOk1(elem && elem->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get()==i);
+            if(elem) mon2->release(elem);
+        }
+
+        epicsThreadSleep(1.0);
+
+        elem = mon->poll();
+        testOk(elem && elem->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get()==61,
+               "x=%d", elem ? (int)elem->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get() : -42);
+        if(elem) mon->release(elem);
+        testOk1(!mon->poll());
+
+        mon->destroy();
+        mon2->destroy();
+    }
+
+    void test_deadband()
+    {
+        testDiag("Test deadband on value");
+
+        TestPV::shared_pointer test2(upstream->addPV("test2", pvd::getFieldCreate()->createFieldBuilder()
+                                                     ->add("value", pvd::pvDouble)
+                                                     ->addNestedStructure("alarm")
+                                                        ->add("severity", pvd::pvInt)
+                                                     ->endNested()
+                                                     ->addNestedStructure("timeStamp")
+                                                        ->add("secondsPastEpoch", pvd::pvLong)
+                                                     ->endNested()
+                                                     ->createStructure()));
+        ScalarAccessor<double> value(test2->value, "value");
+        ScalarAccessor<pvd::int32> severity(test2->value, "alarm.severity");
+        ScalarAccessor<pvd::int64> seconds(test2->value, "timeStamp.secondsPastEpoch");
+        value = 0.0;
+
+        TestChannelRequester::shared_pointer creq(new TestChannelRequester);
+        pva::Channel::shared_pointer chan(gateway->createChannel("test2", creq));
+        if(!chan) testAbort("channel \"test2\" not connected");
+
+        TestChannelMonitorRequester::shared_pointer mreq(new TestChannelMonitorRequester),
+                                                    mreq2(new TestChannelMonitorRequester);
+        pvd::Monitor::shared_pointer mon(chan->createMonitor(mreq, makeDeadbandRequest(1.0, 0.0))),
+                                     mon2(chan->createMonitor(mreq2, makeDeadbandRequest(0.0, 0.1)));
+        if(!mon || !mon2) testAbort("Failed to create monitor");
+        MonitorUser::shared_pointer usr(std::tr1::static_pointer_cast<MonitorUser>(mon)),
+                                    usr2(std::tr1::static_pointer_cast<MonitorUser>(mon2));
+        testOk(usr->entry==usr2->entry, "share upstream monitor");
+
+        testOk1(mon->start().isSuccess());
+        testOk1(mon2->start().isSuccess());
+        upstream->dispatch();
+
+        pva::MonitorElementPtr elem;
+        for(size_t i=0; i<2; i++) {
+            pvd::Monitor::shared_pointer& M = i ? mon2 : mon;
+            elem = M->poll();
+            testOk1(!!elem.get());
+            if(elem) M->release(elem);
+        }
+
+        pvd::BitSet changed;
+        const size_t valueBit = test2->value->getSubFieldT<pvd::PVField>("value")->getFieldOffset(),
+                     sevrBit = test2->value->getSubFieldT<pvd::PVField>("alarm.severity")->getFieldOffset(),
+                     secBit = test2->value->getSubFieldT<pvd::PVField>("timeStamp.secondsPastEpoch")->getFieldOffset();
+
+        value = 0.5;
+        seconds = 1;
+        changed.clear();
+        changed.set(valueBit);
+        changed.set(secBit);
+        test2->post(changed);
+
+        testOk(!mon->poll(), "0.5 inside absolute deadband");
+        elem = mon2->poll();
+        testOk(elem && elem->pvStructurePtr->getSubFieldT<pvd::PVDouble>("value")->get()==0.5,
+               "0.5 outside relative deadband");
+        if(elem) mon2->release(elem);
+
+        value = 1.5;
+        changed.clear();
+        changed.set(valueBit);
+        test2->post(changed);
+
+        elem = mon->poll();
+        testOk(elem && elem->pvStructurePtr->getSubFieldT<pvd::PVDouble>("value")->get()==1.5,
+               "1.5 outside absolute deadband");
+        if(elem) mon->release(elem);
+        elem = mon2->poll();
+        testOk1(!!elem.get());
+        if(elem) mon2->release(elem);
+
+        value = 1.55;
+        changed.clear();
+        changed.set(valueBit);
+        test2->post(changed);
+
+        testOk(!mon2->poll(), "1.55 inside relative deadband");
+
+        seconds = 2;
+        changed.clear();
+        changed.set(secBit);
+        test2->post(changed);
+
+        testOk(!mon->poll(), "timeStamp alone is suppressed");
+
+        severity = 1;
+        changed.clear();
+        changed.set(sevrBit);
+        test2->post(changed);
+
+        elem = mon->poll();
+        testOk(elem && elem->changedBitSet->get(sevrBit), "alarm is delivered");
+        if(elem) mon->release(elem);
+
+        testEqual(epicsAtomicGetSizeT(&usr->nsuppressed), 3u);
+        testEqual(epicsAtomicGetSizeT(&usr2->nsuppressed), 2u);
+
+        testDiag("a bad option is reported, and does not discard the others");
+        pvd::PVStructurePtr badRequest(makeDeadbandRequest(0.0, 0.1));
+        badRequest->getSubFieldT<pvd::PVScalar>("record._options.deadband")->putFrom<std::string>("bad");
+        TestMessageMonitorRequester::shared_pointer mreq3(new TestMessageMonitorRequester);
+        pvd::Monitor::shared_pointer mon3(chan->createMonitor(mreq3, badRequest));
+        if(!mon3) testAbort("Failed to create monitor");
+        MonitorUser::shared_pointer usr3(std::tr1::static_pointer_cast<MonitorUser>(mon3));
+        testOk(usr3->deadband.abs==0.0 && usr3->deadband.rel==0.1, "abs %g rel %g",
+               usr3->deadband.abs, usr3->deadband.rel);
+        {
+            Guard G(mreq3->lock);
+            testOk(mreq3->messages.size()==1u, "%u messages", unsigned(mreq3->messages.size()));
+        }
+
+        testDiag("a numeric deadbandPass is reported, and does not fail the subscription");
+        pvd::StructureConstPtr ntype(pvd::getFieldCreate()->createFieldBuilder()
+                                     ->addNestedStructure("record")
+                                        ->addNestedStructure("_options")
+                                            ->add("deadband", pvd::pvString)
+                                            ->add("deadbandPass", pvd::pvInt)
+                                        ->endNested()
+                                     ->endNested()
+                                     ->createStructure());
+        pvd::PVStructurePtr numRequest(pvd::getPVDataCreate()->createPVStructure(ntype));
+        numRequest->getSubFieldT<pvd::PVScalar>("record._options.deadband")->putFrom<double>(1.0);
+        numRequest->getSubFieldT<pvd::PVScalar>("record._options.deadbandPass")->putFrom<pvd::int32>(1);
+        TestMessageMonitorRequester::shared_pointer mreq4(new TestMessageMonitorRequester);
+        pvd::Monitor::shared_pointer mon4(chan->createMonitor(mreq4, numRequest));
+        testOk1(!!mon4);
+        if(!mon4) testAbort("Failed to create monitor");
+        testOk1(std::tr1::static_pointer_cast<MonitorUser>(mon4)->deadband.abs==1.0);
+        {
+            Guard G(mreq4->lock);
+            testOk(mreq4->messages.size()==1u, "%u messages", unsigned(mreq4->messages.size()));
+        }
+
+        mon->destroy();
+        mon2->destroy();
+        mon3->destroy();
+        mon4->destroy();
+        chan->destroy();
+    }
+
     void test_ds_no_start()
     {
         testDiag("Test downstream monitor never start()s");
@@ -340,16 +1112,531 @@ struct TestMonitor {
     }
 };
 
+void testMonitorSlots()
+{
+    testDiag("Test MonitorSlots ring");
+
+    pvd::PVStructurePtr value(pvd::getPVDataCreate()->createPVStructure(pvd::getFieldCreate()->createFieldBuilder()
+                                                                         ->add("x", pvd::pvInt)
+                                                                         ->createStructure()));
+    MonitorSlots Q;
+    Q.resize(3);
+    for(size_t i=0; i<Q.capacity(); i++)
+        Q[i].reset(new pvd::MonitorElement(value));
+
+    pvd::MonitorElementPtr A(Q[Q.nextFree()]);
+    Q.fill();
+    pvd::MonitorElementPtr B(Q[Q.nextFree()]);
+    Q.fill();
+    testOk1(Q.numFree()==1 && Q.numFilled()==2);
+
+    testOk1(Q.poll()==A);
+    testOk1(Q.poll()==B);
+    testOk1(!Q.poll());
+    testOk1(Q.numOut()==2);
+
+    pvd::MonitorElementPtr other(new pvd::MonitorElement(value));
+    testOk1(Q.find(other)==MonitorSlots::npos);
+
+    testDiag("release out of order");
+    size_t b = Q.find(B);
+    testOk1(b!=MonitorSlots::npos);
+    Q.release(b);
+    testOk1(Q.find(B)==MonitorSlots::npos);
+
+    pvd::MonitorElementPtr C(Q[Q.nextFree()]);
+    Q.fill();
+    Q.refill(Q.find(A));
+    testOk1(Q.numOut()==0 && Q.numFilled()==2 && Q.numFree()==1);
+    testOk1(Q.poll()==C);
+    testOk1(Q.poll()==A);
+}
+
+void testStats()
+{
+    testDiag("Test statistics exposition");
+
+    StatCounter C;
+    C.add();
+    C.add(4);
+    testEqual(C.get(), 5u);
+
+    testEqual(statsLabel("channel", "a\"b\\c"), "channel=\"a\\\"b\\\\c\"");
+
+    StatsSamples samples;
+    samples.push_back(StatsSample("p2p_b", "", 1.0, true));
+    samples.push_back(StatsSample("p2p_a", "x=\"1\"", 2.0, false));
+    samples.push_back(StatsSample("p2p_b", "x=\"2\"", 3.0, true));
+    samples.push_back(StatsSample("p2p_c", "", 1234567.5, false));
+    samples.push_back(StatsSample("p2p_d", "", 123456789.0, true));
+
+    std::ostringstream strm;
+    writeOpenMetrics(strm, samples);
+    testEqual(strm.str(), "# TYPE p2p_a gauge\n"
+                          "p2p_a{x=\"1\"} 2\n"
+                          "# TYPE p2p_b counter\n"
+                          "p2p_b_total 1\n"
+                          "p2p_b_total{x=\"2\"} 3\n"
+                          "# TYPE p2p_c gauge\n"
+                          "p2p_c 1234567.5\n"
+                          "# TYPE p2p_d counter\n"
+                          "p2p_d_total 123456789\n"
+                          "# EOF\n");
+
+    testDiag("Test LatencyHistogram");
+    bool ok = true;
+    for(size_t v=0; v<100000u; v++) {
+        size_t b = LatencyHistogram::bucketOf(v);
+        ok &= b<LatencyHistogram::nbuckets && v<LatencyHistogram::upperBound(b)
+                && (b==0 || v>=LatencyHistogram::upperBound(b-1));
+    }
+    testOk(ok, "bucket bounds");
+
+    LatencyHistogram H;
+    testEqual(H.quantile(0.5), 0.0);
+    for(size_t i=1; i<=100; i++)
+        H.record(i*1e-3);
+    testEqual(H.count(), 100u);
+    testOk(H.quantile(0.5)>=0.050 && H.quantile(0.5)<=0.050*1.25, "p50 %f", H.quantile(0.5));
+    testOk(H.quantile(0.99)>=0.099 && H.quantile(0.99)<=0.099*1.25, "p99 %f", H.quantile(0.99));
+    testOk(fabs(H.max()-0.1)<1e-5, "max %f", H.max());
+
+    testDiag("Test histogram exposition");
+    LatencyHistogram H2;
+    H2.record(2e-6);
+    H2.record(5e-6);
+    testOk(fabs(H2.sum()-7e-6)<1e-9, "sum %g", H2.sum());
+
+    {
+        // more than 2**32 usec., which must not wrap where size_t is 32 bits
+        LatencyHistogram H3, H4;
+        for(unsigned i=0; i<20u; i++)
+            H3.record(1000.0); // counted as 2**nexp usec.
+        const epicsUInt64 expect = epicsUInt64(20u)<<LatencyHistogram::nexp;
+        testOk(H3.sumUnits()==expect, "sum %g usec.", double(H3.sumUnits()));
+        H4.merge(H3);
+        H4.merge(H3);
+        testOk(H4.sumUnits()==2u*expect, "merged sum %g usec.", double(H4.sumUnits()));
+    }
+
+    StatsSamples hsamples;
+    histogramSamples(hsamples, "p2p_h_seconds", "x=\"1\"", H2);
+    testEqual(hsamples.size(), 5u);
+    if(hsamples.size()==5u) {
+        testEqual(hsamples[0].fullName(), "p2p_h_seconds_bucket");
+        testEqual(hsamples[0].labels, "x=\"1\",le=\"0.000004\"");
+        testEqual(hsamples[0].value, 1.0);
+        testEqual(hsamples[1].labels, "x=\"1\",le=\"0.000008\"");
+        testEqual(hsamples[1].value, 2.0);
+        testEqual(hsamples[2].labels, "x=\"1\",le=\"+Inf\"");
+        testEqual(hsamples[2].value, 2.0);
+        testEqual(hsamples[3].fullName(), "p2p_h_seconds_count");
+        testEqual(hsamples[4].fullName(), "p2p_h_seconds_sum");
+    } else {
+        testSkip(9, "wrong # of samples");
+    }
+
+    if(hsamples.size()>1u)
+        hsamples.resize(1u); // first bucket only
+    std::ostringstream hstrm;
+    writeOpenMetrics(hstrm, hsamples);
+    testEqual(hstrm.str(), "# TYPE p2p_h_seconds histogram\n"
+                           "p2p_h_seconds_bucket{x=\"1\",le=\"0.000004\"} 1\n"
+                           "# EOF\n");
+
+    testDiag("Test update size estimate");
+    pvd::PVStructurePtr root(pvd::getPVDataCreate()->createPVStructure(
+                                 pvd::getFieldCreate()->createFieldBuilder()
+                                 ->add("value", pvd::pvDouble)
+                                 ->addArray("arr", pvd::pvInt)
+                                 ->add("name", pvd::pvString)
+                                 ->createStructure()));
+    root->getSubFieldT<pvd::PVScalarArray>("arr")->setLength(3u);
+    root->getSubFieldT<pvd::PVString>("name")->put("abc");
+    pvd::BitSet changed;
+    changed.set(root->getSubFieldT("value")->getFieldOffset());
+    testEqual(updateBytes(*root, changed), 8u);
+    changed.set(root->getSubFieldT("arr")->getFieldOffset());
+    testEqual(updateBytes(*root, changed), 20u);
+    changed.clear();
+    changed.set(0);
+    testEqual(updateBytes(*root, changed), 23u);
+
+    ByteHistogram B;
+    B.record(100.0);
+    hsamples.clear();
+    histogramSamples(hsamples, "p2p_h_bytes", "", B);
+    testEqual(hsamples.size(), 9u);
+    if(hsamples.size()==9u) {
+        testEqual(hsamples[5].labels, "le=\"128.0\"");
+        testEqual(hsamples[5].value, 1.0);
+        testEqual(hsamples[8].value, 100.0);
+    } else {
+        testSkip(3, "wrong # of samples");
+    }
+}
+
+void testAsyncCreate()
+{
+    testDiag("Test createChannel() from worker thread");
+
+    TestProvider::shared_pointer upstream(new TestProvider());
+    TestPV::shared_pointer test1(upstream->addPV("test1", pvd::getFieldCreate()->createFieldBuilder()
+                                                 ->add("x", pvd::pvInt)
+                                                 ->createStructure()));
+    GWServerChannelProvider::shared_pointer gateway(new GWServerChannelProvider(upstream, 1));
+
+    // first search only queues creation
+    testOk1(!gateway->cache.lookup("test1"));
+
+    ChannelCacheEntry::shared_pointer ent;
+    for(unsigned i=0; !ent && i<100; i++) {
+        epicsThreadSleep(0.01);
+        ent = gateway->cache.lookup("test1");
+    }
+    testOk(!!ent, "Connected after worker createChannel()");
+
+    testDiag("ncreators means the same for createWorkers and GWServerChannelProvider()");
+    testEqual(ChannelCache::creatorThreads(0), unsigned(ChannelCache::defaultCreators));
+    testEqual(ChannelCache::creatorThreads(ChannelCache::createInline), 0u);
+    testEqual(ChannelCache::creatorThreads(3), 3u);
+    {
+        GWServerChannelProvider::shared_pointer dflt(new GWServerChannelProvider(upstream));
+        testOk(!dflt->cache.lookup("test1"), "default queues creation");
+        ent.reset();
+        for(unsigned i=0; !ent && i<100; i++) {
+            epicsThreadSleep(0.01);
+            ent = dflt->cache.lookup("test1");
+        }
+        testOk(!!ent, "Connected after default worker createChannel()");
+    }
+    {
+        GWServerChannelProvider::shared_pointer inl(new GWServerChannelProvider(upstream, ChannelCache::createInline));
+        testOk(!!inl->cache.lookup("test1"), "createInline creates from lookup()");
+    }
+}
+
+void testPartition()
+{
+    testDiag("Test channels partitioned among upstream contexts");
+
+    TestProvider::shared_pointer upstream[2];
+    std::vector<TestPV::shared_pointer> pvs[2];
+    std::vector<std::string> names;
+    for(size_t i=0; i<16; i++)
+        names.push_back(std::string("pv") + char('a'+i));
+
+    for(size_t p=0; p<2; p++) {
+        upstream[p].reset(new TestProvider());
+        for(size_t i=0; i<names.size(); i++)
+            pvs[p].push_back(upstream[p]->addPV(names[i], pvd::getFieldCreate()->createFieldBuilder()
+                                                ->add("x", pvd::pvInt)
+                                                ->createStructure()));
+    }
+    GWServerChannelProvider::shared_pointer gateway(new GWServerChannelProvider(upstream[0], ChannelCache::createInline));
+    gateway->cache.addProvider(upstream[1]);
+
+    bool ok = true;
+    size_t count[2] = {0u, 0u};
+    for(size_t i=0; i<names.size(); i++) {
+        ChannelCacheEntry::shared_pointer ent(gateway->cache.lookup(names[i]));
+        size_t idx = gateway->cache.providerIndex(names[i]);
+        ok &= !!ent && idx<2u && pvs[idx][i]->channels.size()==1u && pvs[1-idx][i]->channels.size()==0u;
+        count[idx]++;
+    }
+    testOk(ok, "Each channel created through its own context");
+    testOk(count[0] && count[1], "Both contexts used %u %u", (unsigned)count[0], (unsigned)count[1]);
+}
+
+void testCleaner()
+{
+    testDiag("Test LRU cleaning of idle channels");
+
+    TestProvider::shared_pointer upstream(new TestProvider());
+    pvd::StructureConstPtr dtype(pvd::getFieldCreate()->createFieldBuilder()
+                                 ->add("x", pvd::pvInt)
+                                 ->createStructure());
+    TestPV::shared_pointer test1(upstream->addPV("test1", dtype)),
+                           test2(upstream->addPV("test2", dtype)),
+                           test3(upstream->addPV("test3", dtype));
+    GWServerChannelProvider::shared_pointer gateway(new GWServerChannelProvider(upstream, ChannelCache::createInline));
+    gateway->cache.idleTimeout = 10.0;
+    gateway->cache.cleanSlice = 1u;
+
+    epicsTime now(epicsTime::getCurrent());
+
+    testOk1(!!gateway->cache.lookup("test1"));
+    testOk1(!!gateway->cache.lookup("test2"));
+
+    testEqual(gateway->cache.clean(now), 0u);
+
+    testDiag("one idle entry per slice");
+    testEqual(gateway->cache.clean(now + 20.0), 1u);
+    testEqual(gateway->cache.clean(now + 20.0), 1u);
+    testEqual(test1->channels.size(), 0u);
+    testEqual(test2->channels.size(), 0u);
+
+    testDiag("in use entry is kept");
+    gateway->cache.cleanSlice = 100u;
+    TestChannelRequester::shared_pointer client_req(new TestChannelRequester);
+    pva::Channel::shared_pointer client(gateway->createChannel("test3", client_req));
+    if(!client)
+        testAbort("channel \"test3\" not connected");
+
+    ChannelCache::Shard& shard = gateway->cache.shardOf("test3");
+    testEqual(gateway->cache.clean(now + 40.0), 0u);
+    testEqual(shard.entries.size(), 1u);
+
+    client->destroy();
+    client.reset();
+    client_req.reset(); // holds a reference to the channel
+    testEqual(gateway->cache.clean(now + 80.0), 1u);
+    testOk1(!shard.lruHead && !shard.lruTail);
+}
+
+void testGetFieldPath()
+{
+    testDiag("Test getField() of a nested field from the cache");
+
+    TestProvider::shared_pointer upstream(new TestProvider());
+    TestPV::shared_pointer test1(upstream->addPV("test1", pvd::getFieldCreate()->createFieldBuilder()
+                                                 ->addNestedStructure("a")
+                                                    ->add("b", pvd::pvInt)
+                                                 ->endNested()
+                                                 ->createStructure()));
+    GWServerChannelProvider::shared_pointer gateway(new GWServerChannelProvider(upstream, ChannelCache::createInline));
+    TestChannelRequester::shared_pointer client_req(new TestChannelRequester);
+    pva::Channel::shared_pointer client(gateway->createChannel("test1", client_req));
+    if(!client)
+        testAbort("channel \"test1\" not connected");
+
+    TestChannelFieldRequester::shared_pointer req(new TestChannelFieldRequester);
+    client->getField(req, ""); // fills cache
+    testOk1(req->done && req->fielddesc==test1->dtype);
+
+    req.reset(new TestChannelFieldRequester);
+    client->getField(req, "a.b");
+    testOk1(req->done && req->fielddesc && req->fielddesc->getType()==pvd::scalar);
+
+    req.reset(new TestChannelFieldRequester);
+    client->getField(req, "a.c");
+    testOk1(req->done && !req->status.isSuccess());
+
+    req.reset(new TestChannelFieldRequester);
+    client->getField(req, "a.b.c");
+    testOk1(req->done && !req->status.isSuccess());
+
+    client->destroy();
+}
+
+void testAsyncNotify()
+{
+    testDiag("Test downstream monitorEvent() from worker thread");
+
+    TestProvider::shared_pointer upstream(new TestProvider());
+    TestPV::shared_pointer test1(upstream->addPV("test1", pvd::getFieldCreate()->createFieldBuilder()
+                                                 ->add("x", pvd::pvInt)
+                                                 ->createStructure()));
+    GWServerChannelProvider::shared_pointer gateway(new GWServerChannelProvider(upstream, ChannelCache::createInline));
+    gateway->cache.notifier.start(1);
+
+    TestChannelRequester::shared_pointer client_req(new TestChannelRequester);
+    pva::Channel::shared_pointer client(gateway->createChannel("test1", client_req));
+    if(!client)
+        testAbort("channel \"test1\" not connected");
+
+    TestWorkerMonitorRequester::shared_pointer mreq(new TestWorkerMonitorRequester);
+    pvd::Monitor::shared_pointer mon(client->createMonitor(mreq, makeRequest(2)));
+    if(!mon) testAbort("Failed to create monitor");
+
+    testOk1(mon->start().isSuccess());
+    upstream->dispatch(); // trigger monitorEvent() from upstream to gateway
+
+    // wakeup must come from the worker, not from this thread, before we poll()
+    for(unsigned i=0; !mreq->fromWorker() && i<100; i++)
+        mreq->wait.wait(0.01);
+    testOk(mreq->fromWorker()>=1u, "monitorEvent() from worker %u", (unsigned)mreq->fromWorker());
+
+    pva::MonitorElementPtr elem(mon->poll());
+    testOk(!!elem, "Initial update delivered");
+    if(elem) mon->release(elem);
+
+    {
+        Guard G(gateway->cache.notifier.mutex);
+        testOk(gateway->cache.notifier.nqueued>=1u, "nqueued %u", (unsigned)gateway->cache.notifier.nqueued);
+    }
+
+    mon->destroy();
+    client->destroy();
+}
+
+void testAsyncResume()
+{
+    testDiag("Test blocked upstream monitor resumed from worker thread");
+
+    TestProvider::shared_pointer upstream(new TestProvider());
+    TestPV::shared_pointer test1(upstream->addPV("test1", pvd::getFieldCreate()->createFieldBuilder()
+                                                 ->add("x", pvd::pvInt)
+                                                 ->createStructure()));
+    GWServerChannelProvider::shared_pointer gateway(new GWServerChannelProvider(upstream, ChannelCache::createInline));
+    gateway->cache.monitorFlowControl = true;
+    gateway->cache.notifier.start(1);
+
+    TestChannelRequester::shared_pointer client_req(new TestChannelRequester);
+    pva::Channel::shared_pointer client(gateway->createChannel("test1", client_req));
+    if(!client)
+        testAbort("channel \"test1\" not connected");
+
+    TestWorkerMonitorRequester::shared_pointer mreq(new TestWorkerMonitorRequester);
+    pvd::Monitor::shared_pointer mon(client->createMonitor(mreq, makeRequest(2)));
+    if(!mon) testAbort("Failed to create monitor");
+    MonitorUser::shared_pointer usr(std::tr1::dynamic_pointer_cast<MonitorUser>(mon));
+
+    testOk1(mon->start().isSuccess());
+    upstream->dispatch();
+
+    pva::MonitorElementPtr first;
+    for(unsigned i=0; !first && i<100; i++) {
+        first = mon->poll();
+        if(!first)
+            mreq->wait.wait(0.01);
+    }
+    testOk(!!first, "Initial update delivered");
+
+    pvd::BitSet changed;
+    changed.set(1);
+    for(pvd::int32 i=50; i<54; i++) {
+        test1->value->getSubFieldT<pvd::PVInt>("x")->put(i);
+        test1->post(changed);
+    }
+    {
+        Guard G(usr->mutex());
+        testOk1(!!usr->entry->blocked);
+    }
+
+    // release() queues the resume to the worker
+    if(first) mon->release(first);
+
+    for(pvd::int32 i=50; i<54; i++) {
+        pva::MonitorElementPtr elem;
+        for(unsigned n=0; !elem && n<100; n++) {
+            elem = mon->poll();
+            if(!elem)
+                mreq->wait.wait(0.01);
+        }
+        testOk(elem && elem->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get()==i, "x==%d", (int)i);
+        if(elem) mon->release(elem);
+    }
+
+    testDiag("after close(), resume from the releasing thread");
+    gateway->cache.notifier.close();
+
+    test1->value->getSubFieldT<pvd::PVInt>("x")->put(59);
+    test1->post(changed);
+    first = mon->poll(); // hold, as above
+    for(pvd::int32 i=60; i<64; i++) {
+        test1->value->getSubFieldT<pvd::PVInt>("x")->put(i);
+        test1->post(changed);
+    }
+    {
+        Guard G(usr->mutex());
+        testOk1(!!usr->entry->blocked);
+    }
+
+    if(first) mon->release(first);
+
+    for(pvd::int32 i=60; i<64; i++) {
+        pva::MonitorElementPtr elem(mon->poll()); // no waiting
+        testOk(elem && elem->pvStructurePtr->getSubFieldT<pvd::PVInt>("x")->get()==i, "x==%d", (int)i);
+        if(elem) mon->release(elem);
+    }
+    testOk1(!mon->poll());
+
+    mon->destroy();
+    client->destroy();
+}
+
+void testNegativeCache()
+{
+    testDiag("Test negative cache eviction");
+
+    ChannelCache::NegativeCache neg;
+
+    neg.add("a");
+    testOk(!neg.test("a"), "Disabled by default");
+
+    neg.capacity = 2;
+    neg.ttl = 100.0;
+
+    neg.add("a");
+    neg.add("b");
+    testOk1(neg.test("a"));
+    testOk1(neg.test("b"));
+    testOk1(!neg.test("c"));
+
+    neg.test("a"); // "b" now least recently used
+    neg.add("c");
+    testOk1(neg.test("a"));
+    testOk1(!neg.test("b"));
+    testOk1(neg.test("c"));
+    testEqual(neg.index.size(), 2u);
+
+    neg.ttl = -1.0;
+    neg.add("d"); // already expired
+    testOk1(!neg.test("d"));
+}
+
+void testSearchLimiter()
+{
+    testDiag("Test search rate limit");
+
+    ChannelCache::SearchLimiter lim;
+
+    testOk(lim.allow("1.2.3.4:5"), "Disabled by default");
+
+    lim.rate = 1e-6; // never refills during this test
+    lim.burst = 2.0;
+
+    testOk1(lim.allow("1.2.3.4:5"));
+    testOk1(lim.allow("1.2.3.4:6")); // same host, different port
+    testOk1(!lim.allow("1.2.3.4:5"));
+    testOk1(lim.allow("1.2.3.5:5"));
+    testEqual(lim.ndropped, 1u);
+
+    lim.prune(); // neither bucket is full
+    testEqual(lim.buckets.size(), 2u);
+}
+
 } // namespace
 
 MAIN(testmon)
 {
-    testPlan(79);
+    testPlan(292);
     TEST_METHOD(TestMonitor, test_event);
     TEST_METHOD(TestMonitor, test_share);
+    TEST_METHOD(TestMonitor, test_share_snapshot);
     TEST_METHOD(TestMonitor, test_ds_no_start);
     TEST_METHOD(TestMonitor, test_overflow_upstream);
     TEST_METHOD(TestMonitor, test_overflow_downstream);
+    TEST_METHOD(TestMonitor, test_flow_control);
+    TEST_METHOD(TestMonitor, test_getfield);
+    TEST_METHOD(TestMonitor, test_get_share);
+    TEST_METHOD(TestMonitor, test_server_views);
+    TEST_METHOD(TestMonitor, test_get_monitor);
+    TEST_METHOD(TestMonitor, test_put_combine);
+    TEST_METHOD(TestMonitor, test_monitor_policy);
+    TEST_METHOD(TestMonitor, test_request_rate);
+    TEST_METHOD(TestMonitor, test_deadband);
+    testMonitorSlots();
+    testStats();
+    testAsyncCreate();
+    testPartition();
+    testCleaner();
+    testGetFieldPath();
+    testAsyncNotify();
+    testAsyncResume();
+    testNegativeCache();
+    testSearchLimiter();
     TestProvider::testCounts();
     int ok = 1;
     size_t temp;
@@ -359,6 +1646,10 @@ MAIN(testmon)
     TESTC(ChannelCacheEntry);
     TESTC(MonitorCacheEntry);
     TESTC(MonitorUser);
+    TESTC(GetCacheEntry);
+    TESTC(GetUser);
+    TESTC(PutCacheEntry);
+    TESTC(PutUser);
 #undef TESTC
     testOk(ok, "All instances free'd");
     return testDone();
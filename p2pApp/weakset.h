@@ -27,6 +27,10 @@
  *
  * @note With the exception of swap() all methods are thread-safe
  *
+ * For frequent iteration of a set which changes less often, snapshot()
+ * returns a shared, immutable, copy of the set.  It is rebuilt only when
+ * first requested after an insert() or erase().
+ *
  * @warning Use caution when storing types deriving from enabled_shared_from_this<>
  *          As the implict weak reference they contain will not be wrapped.
  @code
@@ -62,6 +66,8 @@ public:
     typedef std::tr1::weak_ptr<T> value_weak_pointer;
     typedef std::set<value_pointer> set_type;
     typedef std::vector<value_pointer> vector_type;
+    typedef std::vector<value_weak_pointer> snapshot_type;
+    typedef std::tr1::shared_ptr<const snapshot_type> snapshot_pointer;
 
     typedef epicsMutex mutex_type;
     typedef epicsGuard<epicsMutex> guard_type;
@@ -93,6 +99,8 @@ private:
     struct data {
         mutex_type mutex;
         store_t store;
+        // cached result of snapshot().  reset() on any change to store
+        snapshot_pointer snap;
     };
     std::tr1::shared_ptr<data> _data;
 
@@ -115,6 +123,7 @@ private:
             if(C) {
                 guard_type G(C->mutex);
                 C->store.erase(R);
+                C->snap.reset();
             }
 
             /* A subtle gotcha may exist since this struct
@@ -150,6 +159,7 @@ public:
     //! @note Thread safe
     void clear() {
         guard_type G(_data->mutex);
+        _data->snap.reset();
         return _data->store.clear();
     }
 
@@ -179,6 +189,7 @@ public:
     //! @returns the number of objects removed (0 or 1)
     size_t erase(value_pointer& v) {
         guard_type G(_data->mutex);
+        _data->snap.reset();
         return _data->store.erase(v);
     }
 
@@ -193,6 +204,12 @@ public:
 
     void lock_vector(vector_type&) const;
 
+    //! Return an immutable vector of weak references to all entries.
+    //! O(1) unless the set has changed since the last call.
+    //! Entries must still be lock()'d, and may have expired.
+    //! @note The same vector is shared by all callers until the set changes
+    snapshot_pointer snapshot() const;
+
     //! Access to the weak_set internal lock
     //! for use with batch operations.
     //! @warning Use caution when swap()ing while holding this lock!
@@ -237,6 +254,7 @@ void weak_set<T>::insert(value_pointer &v)
         value_pointer chainptr(v.get(), dtor(_data, v));
 
         _data->store.insert(chainptr);
+        _data->snap.reset();
 
         v.swap(chainptr); // we only keep the chained pointer
     } else {
@@ -285,4 +303,16 @@ void weak_set<T>::lock_vector(vector_type& ret) const
     }
 }
 
+template<typename T>
+typename weak_set<T>::snapshot_pointer
+weak_set<T>::snapshot() const
+{
+    guard_type G(_data->mutex);
+    if(!_data->snap) {
+        std::tr1::shared_ptr<snapshot_type> S(new snapshot_type(_data->store.begin(), _data->store.end()));
+        _data->snap = S;
+    }
+    return _data->snap;
+}
+
 #endif // WEAKSET_H
@@ -14,6 +14,7 @@
 #include <pv/anyscalar.h>
 
 #include "pvif.h"
+#include "pdbpool.h"
 
 namespace pvd = epics::pvData;
 
@@ -223,8 +224,17 @@ long copyDBF2PVD(const pvd::shared_vector<const void> &inbuf,
 
     } else if(out->getField()->getType() == pvd::scalarArray) {
         pvd::PVScalarArray* sarr = static_cast<pvd::PVScalarArray*>(out.get());
+        pvd::ScalarType outpvd = sarr->getScalarArray()->getElementType();
 
-        sarr->putFrom(inbuf);
+        if(inpvd==outpvd) {
+            sarr->putFrom(inbuf); // shared
+
+        } else {
+            // convert into a (maybe) pooled buffer
+            pvd::shared_vector<void> outbuf(PDBArrayPool::instance().alloc(outpvd, incnt));
+            pvd::castUnsafeV(incnt, outpvd, outbuf.data(), inpvd, inbuf.data());
+            sarr->putFrom(pvd::freeze(outbuf));
+        }
 
     } else if(out->getField()->getType() == pvd::scalar) {
         pvd::PVScalar* sval = static_cast<pvd::PVScalar*>(out.get());
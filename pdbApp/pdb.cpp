@@ -32,6 +32,8 @@ namespace pvd = epics::pvData;
 namespace pva = epics::pvAccess;
 
 int PDBProviderDebug;
+int PDBProviderSnapshotMonitors;
+int PDBProviderMaxQueueSize = 100;
 
 namespace {
 
@@ -760,4 +762,6 @@ void FieldName::show() const
 
 extern "C" {
 epicsExportAddress(int, PDBProviderDebug);
+epicsExportAddress(int, PDBProviderSnapshotMonitors);
+epicsExportAddress(int, PDBProviderMaxQueueSize);
 }
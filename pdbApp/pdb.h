@@ -70,4 +70,11 @@ struct QSRV_API PDBProvider : public epics::pvAccess::ChannelProvider,
 QSRV_API
 void QSRVRegistrar_counters();
 
+extern "C" {
+    // Monitors of a PV share one BaseSnapshot of each update
+    QSRV_API extern int PDBProviderSnapshotMonitors;
+    // Upper bound on the queueSize requested by a monitor
+    QSRV_API extern int PDBProviderMaxQueueSize;
+}
+
 #endif // PDB_H
@@ -15,6 +15,7 @@
 
 #include "helper.h"
 #include "pdbgroup.h"
+#include "pdbpool.h"
 #include "pdb.h"
 
 namespace pvd = epics::pvData;
@@ -59,6 +60,7 @@ void pdb_group_event(void *user_arg, struct dbChannel *chan,
                     self->members[i].pvif->put(self->scratch, evt->dbe_mask, FL.pfl);
                 }
             }
+            self->snapshot.invalidate();
 
             if(!(evt->dbe_mask&DBE_PROPERTY)) {
                 if(!info.had_initial_VALUE) {
@@ -228,10 +230,26 @@ void PDBGroupPV::finalizeMonitor()
 
 void PDBGroupPV::show(int lvl)
 {
+    std::vector<BaseMonitor::QueueStats> queues;
+    {
+        Guard G(lock);
+        queues.reserve(interested.size());
+        FOREACH(interested_t::const_iterator, it, end, interested) {
+            queues.push_back(BaseMonitor::QueueStats());
+            (*it)->getStats(queues.back());
+        }
+    }
+
     // no locking as we only print things which are const after initialization
 
-    printf("  Atomic Get/Put:%s Monitor:%s Members:%zu\n",
-           pgatomic?"yes":"no", monatomic?"yes":"no", members.size());
+    printf("  Atomic Get/Put:%s Monitor:%s Members:%zu Monitors:%zu\n",
+           pgatomic?"yes":"no", monatomic?"yes":"no", members.size(), queues.size());
+
+    for(size_t i=0; i<queues.size(); i++) {
+        const BaseMonitor::QueueStats& Q = queues[i];
+        printf("  Monitor queueSize:%zu allocated:%zu high-water:%zu filled:%zu outstanding:%zu\n",
+               Q.nbuffers, Q.nallocated, Q.nhighwater, Q.nfilled, Q.noutstanding);
+    }
 
     if(lvl<=1)
         return;
@@ -285,7 +303,7 @@ PDBGroupChannel::createMonitor(
     ret->weakself = ret;
     assert(!!pv->complete);
     guard_t G(pv->lock);
-    ret->connect(G, pv->complete);
+    ret->connect(G, pv->complete, PDBProviderSnapshotMonitors ? &pv->snapshot : NULL, &PDBElementPool::instance());
     return ret;
 }
 
@@ -418,7 +436,7 @@ void PDBGroupPut::get()
 PDBGroupMonitor::PDBGroupMonitor(const PDBGroupPV::shared_pointer& pv,
                  const epics::pvAccess::MonitorRequester::weak_pointer &requester,
                  const pvd::PVStructure::shared_pointer& pvReq)
-    :BaseMonitor(pv->lock, requester, pvReq)
+    :BaseMonitor(pv->lock, requester, pvReq, PDBProviderMaxQueueSize>0 ? PDBProviderMaxQueueSize : 0)
     ,pv(pv)
 {
     epics::atomic::increment(num_instances);
@@ -104,6 +104,7 @@ struct QSRV_API PDBGroupPV : public PDBPV
     DBManyLock locker; // all member channels
 
     epics::pvData::PVStructurePtr complete; // complete copy from subscription
+    BaseSnapshot snapshot; // of complete, shared by monitors when PDBProviderSnapshotMonitors
 
     typedef std::set<PDBGroupMonitor*> interested_t;
     bool interested_iterating;
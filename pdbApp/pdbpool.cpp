@@ -0,0 +1,297 @@
+
+#include <stdexcept>
+#include <new>
+
+#include <stdlib.h>
+
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+
+// printfs in this file will be redirected for capture
+#include <epicsStdio.h>
+
+#include <pv/pvAccess.h>
+
+#include "pdbpool.h"
+
+#include <epicsExport.h>
+
+namespace pvd = epics::pvData;
+namespace pva = epics::pvAccess;
+
+typedef epicsGuard<epicsMutex> Guard;
+
+int PDBProviderElementPoolBytes = 4*1024*1024;
+int PDBProviderArrayPoolBytes = 32*1024*1024;
+
+size_t PDBElementPool::num_hits;
+size_t PDBElementPool::num_misses;
+size_t PDBElementPool::num_free;
+size_t PDBArrayPool::num_released;
+
+namespace {
+
+// approx. bytes of one PVField of a free element.  Field (type) is shared
+const size_t fieldCost = 64u;
+
+// release array values, which may be large, and may be PDBArrayPool buffers.
+// cost() does not count them
+void dropArrays(pvd::PVStructure& value)
+{
+    const pvd::PVFieldPtrArray& fields(value.getPVFields());
+    for(size_t i=0; i<fields.size(); i++) {
+        pvd::PVField& fld = *fields[i];
+        switch(fld.getField()->getType()) {
+        case pvd::structure:
+            dropArrays(static_cast<pvd::PVStructure&>(fld));
+            break;
+        case pvd::scalarArray:
+            // replace, so the old values are no longer referenced.  (setLength(0) would only slice)
+            static_cast<pvd::PVScalarArray&>(fld).putFrom(pvd::shared_vector<const pvd::uint8>());
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+epicsThreadOnceId poolOnce = EPICS_THREAD_ONCE_INIT;
+PDBElementPool *pool;
+PDBArrayPool *arrayPool;
+
+void poolInit(void *)
+{
+    // never free'd, as buffers may be released during exit
+    pool = new PDBElementPool;
+    arrayPool = new PDBArrayPool;
+}
+
+template<typename T>
+pvd::shared_vector<void> wrapArray(void *buf, const PDBArrayPool::Releaser& R, size_t count)
+{
+    return pvd::static_shared_vector_cast<void>(pvd::shared_vector<T>(static_cast<T*>(buf), R, 0, count));
+}
+
+} // namespace
+
+PDBElementPool& PDBElementPool::instance()
+{
+    epicsThreadOnce(&poolOnce, &poolInit, 0);
+    return *pool;
+}
+
+PDBArrayPool& PDBArrayPool::instance()
+{
+    epicsThreadOnce(&poolOnce, &poolInit, 0);
+    return *arrayPool;
+}
+
+PDBElementPool::PDBElementPool()
+    :nbytes(0u)
+{}
+
+PDBElementPool::~PDBElementPool() {}
+
+size_t PDBElementPool::cost(const pvd::PVStructure& value)
+{
+    return sizeof(pva::MonitorElement) + value.getNumberFields()*fieldCost;
+}
+
+pva::MonitorElementPtr
+PDBElementPool::get(const pvd::StructureConstPtr& type)
+{
+    pva::MonitorElementPtr ret;
+    {
+        Guard G(lock);
+        free_t::iterator it(free.find(type));
+        if(it!=free.end()) {
+            ret = it->second.back();
+            it->second.pop_back();
+            if(it->second.empty())
+                free.erase(it); // don't keep unused types alive
+            nbytes -= cost(*ret->pvStructurePtr);
+        }
+    }
+
+    if(ret) {
+        epicsAtomicIncrSizeT(&num_hits);
+        epicsAtomicDecrSizeT(&num_free);
+    } else {
+        epicsAtomicIncrSizeT(&num_misses);
+        ret.reset(new pva::MonitorElement(pvd::getPVDataCreate()->createPVStructure(type)));
+    }
+    return ret;
+}
+
+void PDBElementPool::put(const pva::MonitorElementPtr& elem)
+{
+    const size_t budget = PDBProviderElementPoolBytes>0 ? PDBProviderElementPoolBytes : 0u,
+                 elemcost = cost(*elem->pvStructurePtr);
+
+    // elem is ours now, and will be completely overwritten when re-used
+    dropArrays(*elem->pvStructurePtr);
+
+    {
+        Guard G(lock);
+        if(nbytes + elemcost > budget)
+            return; // over budget, caller will free
+
+        free[elem->pvStructurePtr->getStructure()].push_back(elem);
+        nbytes += elemcost;
+    }
+    epicsAtomicIncrSizeT(&num_free);
+}
+
+void PDBElementPool::show(int lvl)
+{
+    size_t ntypes, bytes;
+    {
+        Guard G(lock);
+        ntypes = free.size();
+        bytes = nbytes;
+    }
+    printf("Element pool: %zu free of %zu types, %zu of %d bytes, %zu hits, %zu misses\n",
+           epicsAtomicGetSizeT(&num_free), ntypes, bytes, PDBProviderElementPoolBytes,
+           epicsAtomicGetSizeT(&num_hits), epicsAtomicGetSizeT(&num_misses));
+}
+
+struct PDBArrayPool::Releaser
+{
+    PDBArrayPool *pool;
+    size_t csize;
+    Releaser(PDBArrayPool *pool, size_t csize) :pool(pool), csize(csize) {}
+    void operator()(void *buf) { pool->release(buf, csize); }
+};
+
+PDBArrayPool::PDBArrayPool()
+    :nbytes(0u)
+{}
+
+PDBArrayPool::~PDBArrayPool()
+{
+    for(classes_t::iterator it(classes.begin()), end(classes.end()); it!=end; ++it) {
+        for(size_t i=0; i<it->second.free.size(); i++)
+            ::free(it->second.free[i]);
+    }
+}
+
+size_t PDBArrayPool::classSize(size_t nbytes)
+{
+    size_t pow2 = minPooled;
+    while(pow2 <= nbytes/2u)
+        pow2 *= 2u;
+    // pow2 <= nbytes < 2*pow2, so at most 1/4 of a buffer is unused
+    size_t step = pow2/4u;
+    return (nbytes + step - 1u)/step*step;
+}
+
+pvd::shared_vector<void> PDBArrayPool::alloc(pvd::ScalarType type, size_t count)
+{
+    const size_t need = count*pvd::ScalarTypeFunc::elementSize(type);
+
+    if(type==pvd::pvString || need<minPooled)
+        return pvd::ScalarTypeFunc::allocArray(type, count);
+
+    const size_t csize = classSize(need);
+    void *buf = 0;
+    {
+        Guard G(lock);
+        class_t& C = classes[csize];
+        if(C.free.empty()) {
+            C.misses++;
+        } else {
+            C.hits++;
+            buf = C.free.back();
+            C.free.pop_back();
+            nbytes -= csize;
+        }
+        C.inuse++;
+    }
+
+    if(!buf && !(buf = malloc(csize))) {
+        Guard G(lock);
+        classes[csize].inuse--;
+        throw std::bad_alloc();
+    }
+
+    Releaser R(this, csize);
+
+    switch(type) {
+#define CASE(PVACODE, PVATYPE) case pvd::PVACODE: return wrapArray<PVATYPE>(buf, R, count)
+    CASE(pvBoolean, pvd::boolean);
+    CASE(pvByte, pvd::int8);
+    CASE(pvShort, pvd::int16);
+    CASE(pvInt, pvd::int32);
+    CASE(pvLong, pvd::int64);
+    CASE(pvUByte, pvd::uint8);
+    CASE(pvUShort, pvd::uint16);
+    CASE(pvUInt, pvd::uint32);
+    CASE(pvULong, pvd::uint64);
+    CASE(pvFloat, float);
+    CASE(pvDouble, double);
+#undef CASE
+    default:
+        break;
+    }
+    R(buf);
+    throw std::logic_error("PDBArrayPool::alloc() unsupported type");
+}
+
+void PDBArrayPool::release(void *buf, size_t csize)
+{
+    const size_t budget = PDBProviderArrayPoolBytes>0 ? PDBProviderArrayPoolBytes : 0u;
+    epicsAtomicIncrSizeT(&num_released);
+    {
+        Guard G(lock);
+        class_t& C = classes[csize];
+        C.inuse--;
+        if(nbytes + csize <= budget) {
+            C.free.push_back(buf);
+            nbytes += csize;
+            return;
+        }
+    }
+    ::free(buf); // over budget
+}
+
+void PDBArrayPool::show(int lvl)
+{
+    struct counts_t {
+        size_t csize, hits, misses, inuse, nfree;
+    };
+    std::vector<counts_t> counts;
+    counts_t total = {0u, 0u, 0u, 0u, 0u};
+    {
+        Guard G(lock);
+        counts.reserve(classes.size());
+        for(classes_t::const_iterator it(classes.begin()), end(classes.end()); it!=end; ++it) {
+            counts_t C = {it->first, it->second.hits, it->second.misses, it->second.inuse, it->second.free.size()};
+            counts.push_back(C);
+        }
+        total.csize = nbytes;
+    }
+
+    for(size_t i=0; i<counts.size(); i++) {
+        total.hits += counts[i].hits;
+        total.misses += counts[i].misses;
+        total.inuse += counts[i].inuse;
+        total.nfree += counts[i].nfree;
+    }
+
+    printf("Array pool: %zu in use, %zu free, %zu of %d bytes, %zu hits, %zu misses\n",
+           total.inuse, total.nfree, total.csize, PDBProviderArrayPoolBytes, total.hits, total.misses);
+
+    if(lvl<=0)
+        return;
+
+    for(size_t i=0; i<counts.size(); i++) {
+        const counts_t& C = counts[i];
+        printf("  %zu bytes: %zu in use, %zu free, %zu hits, %zu misses\n",
+               C.csize, C.inuse, C.nfree, C.hits, C.misses);
+    }
+}
+
+extern "C" {
+epicsExportAddress(int, PDBProviderElementPoolBytes);
+epicsExportAddress(int, PDBProviderArrayPoolBytes);
+}
@@ -0,0 +1,108 @@
+#ifndef PDBPOOL_H
+#define PDBPOOL_H
+
+#include <map>
+#include <vector>
+
+#include <epicsMutex.h>
+
+#include <pv/pvAccess.h>
+
+#include "pvahelper.h"
+
+#include <pv/qsrv.h>
+
+/**
+ * Process-wide free-list of MonitorElements for each Structure type, used by all
+ * QSRV monitors, so that many monitors created and destroyed at once (eg. clients reconnecting)
+ * re-use elements instead of creating new PVStructures.
+ *
+ * Holds at most PDBProviderElementPoolBytes (estimated) of free elements.
+ * Array values of free elements are released.
+ */
+struct QSRV_API PDBElementPool : public BaseElementPool
+{
+    static PDBElementPool& instance();
+
+    // counters for refshow
+    static size_t num_hits,   // get() of a free element
+                  num_misses, // get() of a new element
+                  num_free;   // elements currently free
+
+    PDBElementPool();
+    virtual ~PDBElementPool();
+
+    virtual epics::pvAccess::MonitorElementPtr get(const epics::pvData::StructureConstPtr& type) OVERRIDE FINAL;
+    virtual void put(const epics::pvAccess::MonitorElementPtr& elem) OVERRIDE FINAL;
+
+    //! estimated bytes used by a free element
+    static size_t cost(const epics::pvData::PVStructure& value);
+
+    //! print statistics to stdout
+    void show(int lvl);
+
+private:
+    epicsMutex lock;
+    typedef std::vector<epics::pvAccess::MonitorElementPtr> elements_t;
+    typedef std::map<epics::pvData::StructureConstPtr, elements_t> free_t;
+    // guarded by lock
+    free_t free;
+    size_t nbytes;
+};
+
+/**
+ * Process-wide pool of array value buffers, in size classes with
+ * four classes for each power of two.  A buffer returns to the pool
+ * when the last shared_vector referencing it is released.
+ *
+ * Holds at most PDBProviderArrayPoolBytes of free buffers.
+ * Small arrays, and arrays of strings, are allocated normally.
+ */
+struct QSRV_API PDBArrayPool
+{
+    //! arrays of fewer bytes are not pooled
+    enum {minPooled = 4096};
+
+    static PDBArrayPool& instance();
+
+    // counter for refshow.  buffers whose last reference was released
+    static size_t num_released;
+
+    PDBArrayPool();
+    ~PDBArrayPool();
+
+    //! like ScalarTypeFunc::allocArray()
+    epics::pvData::shared_vector<void> alloc(epics::pvData::ScalarType type, size_t count);
+
+    //! size of the class holding a buffer of nbytes
+    static size_t classSize(size_t nbytes);
+
+    //! print statistics to stdout
+    void show(int lvl);
+
+    struct Releaser;
+    friend struct Releaser;
+private:
+    void release(void *buf, size_t csize);
+
+    struct class_t {
+        std::vector<void*> free;
+        size_t hits, misses, inuse;
+        class_t() :hits(0u), misses(0u), inuse(0u) {}
+    };
+    typedef std::map<size_t, class_t> classes_t;
+
+    epicsMutex lock;
+    // guarded by lock
+    classes_t classes;
+    size_t nbytes; // of free buffers
+};
+
+extern "C" {
+    // Budget (bytes) for the free MonitorElements kept by PDBElementPool
+    QSRV_API extern int PDBProviderElementPoolBytes;
+    // Budget (bytes) for the free buffers kept by PDBArrayPool
+    QSRV_API extern int PDBProviderArrayPoolBytes;
+}
+
+#endif // PDBPOOL_H
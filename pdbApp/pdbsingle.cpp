@@ -9,6 +9,7 @@
 #include <dbNotify.h>
 #include <osiSock.h>
 #include <epicsAtomic.h>
+#include <epicsStdio.h>
 
 #include <pv/epicsException.h>
 #include <pv/pvAccess.h>
@@ -17,6 +18,7 @@
 
 #include "helper.h"
 #include "pdbsingle.h"
+#include "pdbpool.h"
 #include "pdb.h"
 
 namespace pvd = epics::pvData;
@@ -47,6 +49,7 @@ void pdb_single_event(void *user_arg, struct dbChannel *chan,
                 // dbGet() into self->complete
                 self->pvif->put(self->scratch, evt->dbe_mask, pfl);
             }
+            self->snapshot.invalidate();
 
             if(evt->dbe_mask&DBE_PROPERTY)
                 self->hadevent_PROPERTY = true;
@@ -195,6 +198,27 @@ void PDBSinglePV::finalizeMonitor()
     }
 }
 
+void PDBSinglePV::show(int lvl)
+{
+    std::vector<BaseMonitor::QueueStats> queues;
+    {
+        Guard G(lock);
+        queues.reserve(interested.size());
+        FOREACH(interested_t::const_iterator, it, end, interested) {
+            queues.push_back(BaseMonitor::QueueStats());
+            (*it)->getStats(queues.back());
+        }
+    }
+
+    printf("  Monitors:%zu\n", queues.size());
+
+    for(size_t i=0; i<queues.size(); i++) {
+        const BaseMonitor::QueueStats& Q = queues[i];
+        printf("  Monitor queueSize:%zu allocated:%zu high-water:%zu filled:%zu outstanding:%zu\n",
+               Q.nbuffers, Q.nallocated, Q.nhighwater, Q.nfilled, Q.noutstanding);
+    }
+}
+
 PDBSingleChannel::PDBSingleChannel(const PDBSinglePV::shared_pointer& pv,
                                    const pva::ChannelRequester::shared_pointer& req)
     :BaseChannel(dbChannelName(pv->chan), pv->provider, req, pv->fielddesc)
@@ -242,7 +266,7 @@ PDBSingleChannel::createMonitor(
     ret->weakself = ret;
     assert(!!pv->complete);
     guard_t G(pv->lock);
-    ret->connect(G, pv->complete);
+    ret->connect(G, pv->complete, PDBProviderSnapshotMonitors ? &pv->snapshot : NULL, &PDBElementPool::instance());
     return ret;
 }
 
@@ -440,7 +464,7 @@ void PDBSinglePut::get()
 PDBSingleMonitor::PDBSingleMonitor(const PDBSinglePV::shared_pointer& pv,
                  const requester_t::shared_pointer& requester,
                  const pvd::PVStructure::shared_pointer& pvReq)
-    :BaseMonitor(pv->lock, requester, pvReq)
+    :BaseMonitor(pv->lock, requester, pvReq, PDBProviderMaxQueueSize>0 ? PDBProviderMaxQueueSize : 0)
     ,pv(pv)
 {
     epics::atomic::increment(num_instances);
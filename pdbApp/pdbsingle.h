@@ -44,6 +44,7 @@ struct QSRV_API PDBSinglePV : public PDBPV
     p2p::auto_ptr<PVIF> pvif;
 
     epics::pvData::PVStructurePtr complete; // complete copy from subscription
+    BaseSnapshot snapshot; // of complete, shared by monitors when PDBProviderSnapshotMonitors
 
     typedef std::set<PDBSingleMonitor*> interested_t;
     bool interested_iterating;
@@ -71,6 +72,8 @@ struct QSRV_API PDBSinglePV : public PDBPV
     void addMonitor(PDBSingleMonitor*);
     void removeMonitor(PDBSingleMonitor*);
     void finalizeMonitor();
+
+    virtual void show(int lvl) OVERRIDE;
 };
 
 struct PDBSingleChannel : public BaseChannel,
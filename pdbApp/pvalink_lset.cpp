@@ -7,6 +7,7 @@
 #include <pv/current_function.h>
 
 #include "pvalink.h"
+#include "pdbpool.h"
 
 
 namespace {
@@ -426,7 +427,7 @@ long pvaPutValue(DBLINK *plink, short dbrType,
             self->put_scratch = pvd::static_shared_vector_cast<const void>(pvd::freeze(sval));
 
         } else {
-            pvd::shared_vector<void> val(pvd::ScalarTypeFunc::allocArray(stype, size_t(nRequest)));
+            pvd::shared_vector<void> val(PDBArrayPool::instance().alloc(stype, size_t(nRequest)));
 
             assert(size_t(dbValueSize(dbrType)*nRequest) == val.size());
 
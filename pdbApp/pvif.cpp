@@ -24,6 +24,7 @@
 
 #include "sb.h"
 #include "pvif.h"
+#include "pdbpool.h"
 
 #include <epicsExport.h>
 
@@ -506,7 +507,7 @@ void putValue(dbChannel *chan, pvd::PVScalarArray* value, db_field_log *pfl)
 
     if(dbr!=DBR_STRING) {
 
-        pvd::shared_vector<void> buf(pvd::ScalarTypeFunc::allocArray(etype, nReq)); // TODO: pool?
+        pvd::shared_vector<void> buf(PDBArrayPool::instance().alloc(etype, nReq));
 
         long status = dbChannelGet(chan, dbr, buf.data(), NULL, &nReq, pfl);
         if(status)
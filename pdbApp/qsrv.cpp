@@ -23,6 +23,7 @@
 #include "pvif.h"
 #include "pdb.h"
 #include "pdbsingle.h"
+#include "pdbpool.h"
 #ifdef USE_MULTILOCK
 #  include "pdbgroup.h"
 #endif
@@ -44,6 +45,9 @@ void QSRVRegistrar_counters()
     epics::registerRefCounter("PDBGroupMonitor", &PDBGroupMonitor::num_instances);
 #endif // USE_MULTILOCK
     epics::registerRefCounter("PDBProvider", &PDBProvider::num_instances);
+    epics::registerRefCounter("PDBElementPool::hits", &PDBElementPool::num_hits);
+    epics::registerRefCounter("PDBElementPool::misses", &PDBElementPool::num_misses);
+    epics::registerRefCounter("PDBElementPool::free", &PDBElementPool::num_free);
 }
 
 namespace {
@@ -60,10 +64,15 @@ void dbgl(int lvl, const char *pattern)
         if(!prov)
             throw std::runtime_error("No Provider (PVA server not running?)");
 
+        // groups, and all PVs (single or group) with open channels
         PDBProvider::persist_pv_map_t pvs;
         {
             epicsGuard<epicsMutex> G(prov->transient_pv_map.mutex());
             pvs = prov->persist_pv_map; // copy map
+
+            PDBProvider::transient_pv_map_t::lock_vector_type transient(prov->transient_pv_map.lock_vector());
+            for(size_t i=0; i<transient.size(); i++)
+                pvs.insert(transient[i]); // no-op for groups already copied
         }
 
         for(PDBProvider::persist_pv_map_t::const_iterator it(pvs.begin()), end(pvs.end());
@@ -83,11 +92,18 @@ void dbgl(int lvl, const char *pattern)
     }
 }
 
+void pdbpool(int lvl)
+{
+    PDBElementPool::instance().show(lvl);
+    PDBArrayPool::instance().show(lvl);
+}
+
 void QSRVRegistrar()
 {
     QSRVRegistrar_counters();
     pva::ChannelProviderRegistry::servers()->addSingleton<PDBProvider>("QSRV");
     epics::iocshRegister<int, const char*, &dbgl>("dbgl", "level", "pattern");
+    epics::iocshRegister<int, &pdbpool>("pdbpool", "level");
 }
 
 } // namespace
@@ -0,0 +1,186 @@
+/* Cost of filling BaseMonitor queue elements with updates of
+ * NTScalar, NTEnum, and group PVs where only value, alarm, and timeStamp change.
+ *
+ * Prints one line per type:
+ *   <type> full est_bytes <N> ns <T> partial est_bytes <N> ns <T>
+ * with N the estimated bytes, and T the time, per update.
+ *
+ * "full" copies the complete structure into each element, "partial" is
+ * BaseMonitor which copies only those fields changed since the element was last filled.
+ * Array values are shared, not copied, so are not counted.
+ * Bytes are estimated from the fields copied (see copySize()), not measured.
+ */
+#include <iostream>
+#include <string>
+
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+#include <pv/pvAccess.h>
+#include <pv/standardField.h>
+
+#include "pvahelper.h"
+
+namespace pvd = epics::pvData;
+namespace pva = epics::pvAccess;
+
+namespace {
+
+const size_t nupdates = 1000000u;
+
+struct Requester : public pva::MonitorRequester
+{
+    POINTER_DEFINITIONS(Requester);
+    size_t nevents;
+    Requester() :nevents(0u) {}
+    virtual ~Requester() {}
+    virtual std::string getRequesterName() { return "benchcopy"; }
+    virtual void monitorConnect(pvd::Status const & status,
+                                pva::MonitorPtr const & monitor,
+                                pvd::StructureConstPtr const & structure) {}
+    virtual void monitorEvent(pva::MonitorPtr const & monitor)
+    {
+        pva::MonitorElementPtr elem;
+        while(!!(elem=monitor->poll())) {
+            nevents++;
+            monitor->release(elem);
+        }
+    }
+    virtual void unlisten(pva::MonitorPtr const & monitor) {}
+};
+
+struct Monitor : public BaseMonitor
+{
+    POINTER_DEFINITIONS(Monitor);
+    Monitor(epicsMutex& lock, const requester_t::shared_pointer& req)
+        :BaseMonitor(lock, req, pvd::PVStructurePtr())
+    {}
+    virtual ~Monitor() {}
+};
+
+// estimate of bytes copied by copyUnchecked(from, mask).  Sum of the sizes of scalar
+// values and the lengths of strings.  Does not count string allocation, or PVField overheads.
+size_t copySize(const pvd::PVField& fld, const pvd::BitSet& mask, bool all)
+{
+    all |= mask.get(fld.getFieldOffset());
+    switch(fld.getField()->getType()) {
+    case pvd::structure: {
+        const pvd::PVFieldPtrArray& children(static_cast<const pvd::PVStructure&>(fld).getPVFields());
+        size_t ret = 0u;
+        for(size_t i=0; i<children.size(); i++)
+            ret += copySize(*children[i], mask, all);
+        return ret;
+    }
+    case pvd::scalar:
+        if(!all)
+            return 0u;
+        else if(static_cast<const pvd::PVScalar&>(fld).getScalar()->getScalarType()==pvd::pvString)
+            return static_cast<const pvd::PVString&>(fld).get().size();
+        else
+            return pvd::ScalarTypeFunc::elementSize(static_cast<const pvd::PVScalar&>(fld).getScalar()->getScalarType());
+    default:
+        return 0u; // arrays are shared
+    }
+}
+
+// mark value, alarm, and timeStamp of an NT
+void markNT(const pvd::PVStructurePtr& nt, pvd::BitSet& mask)
+{
+    mask.set(nt->getSubFieldT("value")->getFieldOffset());
+    mask.set(nt->getSubFieldT("alarm")->getFieldOffset());
+    mask.set(nt->getSubFieldT("timeStamp")->getFieldOffset());
+}
+
+// reference, a complete copy for each update
+double bench_full(const pvd::PVStructurePtr& complete, const pvd::BitSet& mask)
+{
+    pvd::PVStructurePtr elem(pvd::getPVDataCreate()->createPVStructure(complete->getStructure()));
+    pvd::BitSet changed;
+    epicsTime start(epicsTime::getCurrent());
+    for(size_t i=0; i<nupdates; i++) {
+        elem->copyUnchecked(*complete);
+        changed = mask;
+    }
+    return (epicsTime::getCurrent() - start)*1e9/nupdates;
+}
+
+double bench_partial(const pvd::PVStructurePtr& complete, const pvd::BitSet& mask)
+{
+    epicsMutex lock;
+    Requester::shared_pointer req(new Requester);
+    Monitor::shared_pointer mon(new Monitor(lock, req));
+    mon->weakself = mon;
+    {
+        BaseMonitor::guard_t G(lock);
+        mon->connect(G, complete);
+    }
+    pva::MonitorPtr(mon)->start(); // initial complete update
+    mon->requestUpdate();
+
+    epicsTime start(epicsTime::getCurrent());
+    for(size_t i=0; i<nupdates; i++) {
+        BaseMonitor::guard_t G(lock);
+        mon->post(G, mask);
+    }
+    double dT = epicsTime::getCurrent() - start;
+
+    mon->destroy();
+    if(req->nevents!=nupdates+1u)
+        std::cerr<<"missed "<<(nupdates+1u-req->nevents)<<" updates\n";
+    return dT*1e9/nupdates;
+}
+
+void bench(const char *name, const pvd::PVStructurePtr& complete, const pvd::BitSet& mask)
+{
+    pvd::BitSet all;
+    all.set(0);
+    double full = bench_full(complete, mask),
+           partial = bench_partial(complete, mask);
+    std::cout<<name
+             <<" full est_bytes "<<copySize(*complete, all, false)<<" ns "<<full
+             <<" partial est_bytes "<<copySize(*complete, mask, false)<<" ns "<<partial
+             <<"\n";
+}
+
+pvd::StructureConstPtr scalarType()
+{
+    return pvd::getStandardField()->scalar(pvd::pvDouble, "alarm,timeStamp,display,control,valueAlarm");
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    pvd::PVDataCreatePtr create(pvd::getPVDataCreate());
+    {
+        pvd::PVStructurePtr value(create->createPVStructure(scalarType()));
+        value->getSubFieldT<pvd::PVString>("display.description")->put("A description of moderate length");
+        value->getSubFieldT<pvd::PVString>("display.units")->put("mm");
+        pvd::BitSet mask;
+        markNT(value, mask);
+        bench("NTScalar", value, mask);
+    }
+    {
+        pvd::PVStructurePtr value(create->createPVStructure(pvd::getStandardField()->enumerated("alarm,timeStamp")));
+        pvd::PVStringArray::svector choices(2);
+        choices[0] = "Off";
+        choices[1] = "On";
+        value->getSubFieldT<pvd::PVStringArray>("value.choices")->replace(pvd::freeze(choices));
+        pvd::BitSet mask;
+        mask.set(value->getSubFieldT("value.index")->getFieldOffset());
+        mask.set(value->getSubFieldT("alarm")->getFieldOffset());
+        mask.set(value->getSubFieldT("timeStamp")->getFieldOffset());
+        bench("NTEnum", value, mask);
+    }
+    {
+        // group of two records, of which one changes
+        pvd::PVStructurePtr value(create->createPVStructure(pvd::getFieldCreate()->createFieldBuilder()
+                                                            ->add("a", scalarType())
+                                                            ->add("b", scalarType())
+                                                            ->createStructure()));
+        pvd::BitSet mask;
+        markNT(value->getSubFieldT<pvd::PVStructure>("a"), mask);
+        bench("group", value, mask);
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+/* Compare the cost of iterating a weak_set with lock_vector() and snapshot().
+ *
+ * Prints one line per set size:
+ *   <# members> lock_vector <ns per iteration> snapshot <ns per iteration>
+ */
+#include <iostream>
+#include <vector>
+
+#include <epicsTime.h>
+
+#include "weakset.h"
+
+namespace {
+
+typedef weak_set<int> set_type;
+
+// total # of members visited for each set size
+const size_t nvisits = 10000000u;
+
+double bench_lock_vector(const set_type& set, size_t loops)
+{
+    size_t sum = 0u;
+    epicsTime start(epicsTime::getCurrent());
+    for(size_t i=0; i<loops; i++) {
+        set_type::vector_type V(set.lock_vector());
+        for(size_t j=0; j<V.size(); j++)
+            sum += *V[j];
+    }
+    double dT = epicsTime::getCurrent() - start;
+    if(sum==0u) std::cerr<<"oops\n"; // use result
+    return dT*1e9/loops;
+}
+
+double bench_snapshot(const set_type& set, size_t loops)
+{
+    size_t sum = 0u;
+    epicsTime start(epicsTime::getCurrent());
+    for(size_t i=0; i<loops; i++) {
+        set_type::snapshot_pointer S(set.snapshot());
+        for(size_t j=0; j<S->size(); j++) {
+            set_type::value_pointer P((*S)[j].lock());
+            if(P)
+                sum += *P;
+        }
+    }
+    double dT = epicsTime::getCurrent() - start;
+    if(sum==0u) std::cerr<<"oops\n"; // use result
+    return dT*1e9/loops;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const size_t sizes[] = {1u, 10u, 100u, 1000u};
+
+    for(size_t n=0; n<sizeof(sizes)/sizeof(sizes[0]); n++) {
+        set_type set;
+        std::vector<set_type::value_pointer> members(sizes[n]);
+        for(size_t i=0; i<members.size(); i++) {
+            members[i].reset(new int(1));
+            set.insert(members[i]);
+        }
+
+        size_t loops = nvisits/sizes[n];
+        double tvec = bench_lock_vector(set, loops);
+        double tsnap = bench_snapshot(set, loops);
+
+        std::cout<<sizes[n]<<" lock_vector "<<tvec<<" snapshot "<<tsnap<<"\n";
+    }
+
+    return 0;
+}
@@ -5,13 +5,16 @@
 
 #include <dbStaticLib.h>
 #include <epicsTypes.h>
+#include <epicsAtomic.h>
 #include <pv/valueBuilder.h>
 #include <pv/pvData.h>
 
 
 #include "pvif.h"
+#include "pdbpool.h"
 
 namespace pvd = epics::pvData;
+namespace pva = epics::pvAccess;
 
 namespace {
 template<pvd::ScalarType ENUM, typename DBF, typename E>
@@ -226,11 +229,62 @@ void testDBR2PVD_array()
     }
 }
 
+void testArrayPool()
+{
+    testDiag("testArrayPool()");
+
+    testEqual(PDBArrayPool::classSize(4096u), 4096u);
+    testEqual(PDBArrayPool::classSize(4097u), 5120u);
+    testEqual(PDBArrayPool::classSize(1u<<20), 1u<<20);
+    testEqual(PDBArrayPool::classSize((1u<<20)+1u), (1u<<20)+(1u<<18));
+
+    PDBArrayPool& pool = PDBArrayPool::instance();
+    const void *first;
+    {
+        pvd::shared_vector<void> buf(pool.alloc(pvd::pvDouble, 1000u));
+        testEqual(buf.size(), 8000u);
+        testEqual(buf.original_type(), pvd::pvDouble);
+        first = buf.data();
+    }
+    {
+        pvd::shared_vector<void> buf(pool.alloc(pvd::pvDouble, 1000u));
+        testOk(buf.data()==first, "buffer re-used");
+    }
+
+    // conversion into a pooled buffer
+    pvd::PVStructure::shared_pointer top(pvd::getPVDataCreate()->createPVStructure(pvd::getFieldCreate()->createFieldBuilder()
+                                                                                   ->addArray("value", pvd::pvInt)
+                                                                                   ->createStructure()));
+    pvd::PVStringArray::const_svector choices;
+    pvd::BitSet changed;
+
+    pvd::shared_vector<pvd::uint32> buf(2000u);
+    for(size_t i=0; i<buf.size(); i++)
+        buf[i] = i;
+    copyDBF2PVD(pvd::static_shared_vector_cast<const void>(pvd::freeze(buf)),
+                top->getSubFieldT("value"), changed, choices);
+
+    pvd::PVIntArray::const_svector arr(top->getSubFieldT<pvd::PVIntArray>("value")->view());
+    testEqual(arr.size(), 2000u);
+    testEqual(arr[1999], 1999);
+    arr.clear();
+
+    testDiag("a pooled element does not keep its array buffer");
+    size_t released = epicsAtomicGetSizeT(&PDBArrayPool::num_released);
+    {
+        pva::MonitorElementPtr elem(new pva::MonitorElement(top));
+        top.reset();
+        PDBElementPool::instance().put(elem);
+    }
+    testOk(epicsAtomicGetSizeT(&PDBArrayPool::num_released)==released+1u,
+           "buffer released %zu -> %zu", released, epicsAtomicGetSizeT(&PDBArrayPool::num_released));
+}
+
 }
 
 MAIN(testdbf_copy)
 {
-    testPlan(53);
+    testPlan(63);
     try{
         testPVD2DBR_scalar<pvd::pvDouble, double>(DBF_DOUBLE, 42.2, 42.2);
         testPVD2DBR_scalar<pvd::pvDouble, pvd::uint16>(DBF_USHORT, 42.2, 42u);
@@ -264,6 +318,8 @@ MAIN(testdbf_copy)
         testDBR2PVD_enum<std::string>("two", 2);
 
         testDBR2PVD_array();
+
+        testArrayPool();
     }catch(std::exception& e){
         testFail("Unexpected exception: %s", e.what());
     }
@@ -1,4 +1,6 @@
 
+#include <vector>
+
 #include <testMain.h>
 
 #include <iocsh.h>
@@ -13,6 +15,7 @@
 #include "pvif.h"
 #include "pdb.h"
 #include "pdbsingle.h"
+#include "pdbpool.h"
 #ifdef USE_MULTILOCK
 #  include "pdbgroup.h"
 #endif
@@ -173,6 +176,98 @@ void testSingleMonitor(pvac::ClientProvider& client)
     testOk1(!mon.poll());
 }
 
+void testSnapshotMonitor(pvac::ClientProvider& client)
+{
+    testDiag("test single monitors sharing snapshots");
+
+    PDBProviderSnapshotMonitors = 1;
+
+    testdbPutFieldOk("rec1", DBR_DOUBLE, 2.0);
+
+    pvac::ClientChannel chan(client.connect("rec1"));
+    pvac::MonitorSync mon1(chan.monitor()),
+                      mon2(chan.monitor());
+
+    testOk1(mon1.wait(3.0) && mon1.poll());
+    testOk1(mon2.wait(3.0) && mon2.poll());
+    testOk1(mon1.changed.get(0) && mon2.changed.get(0));
+    testFieldEqual<pvd::PVDouble>(mon1.root, "value", 2.0);
+    testFieldEqual<pvd::PVDouble>(mon2.root, "value", 2.0);
+
+    testdbPutFieldOk("rec1", DBR_DOUBLE, 12.0);
+
+    testOk1(mon1.wait(3.0) && mon1.poll());
+    testOk1(mon2.wait(3.0) && mon2.poll());
+    testOk1(mon1.changed.get(mon1.root->getSubFieldT("value")->getFieldOffset()));
+    testFieldEqual<pvd::PVDouble>(mon1.root, "value", 12.0);
+    testFieldEqual<pvd::PVDouble>(mon2.root, "value", 12.0);
+
+    testOk1(!mon1.poll());
+    testOk1(!mon2.poll());
+
+    PDBProviderSnapshotMonitors = 0;
+}
+
+void testQueueSize(pvac::ClientProvider& client)
+{
+    testDiag("test monitor with queueSize=4");
+
+    pvd::PVStructurePtr pvr(pvd::getPVDataCreate()->createPVStructure(pvd::getFieldCreate()->createFieldBuilder()
+                                ->addNestedStructure("record")
+                                    ->addNestedStructure("_options")
+                                        ->add("queueSize", pvd::pvUInt)
+                                        ->endNested()
+                                    ->endNested()
+                                ->createStructure()));
+    pvr->getSubFieldT<pvd::PVUInt>("record._options.queueSize")->put(4);
+
+    testdbPutFieldOk("rec1", DBR_DOUBLE, 20.0);
+
+    pvac::MonitorSync mon(client.connect("rec1").monitor(pvr));
+
+    testOk1(mon.wait(3.0) && mon.poll());
+    testFieldEqual<pvd::PVDouble>(mon.root, "value", 20.0);
+
+    // one element held by mon, three free.  So none squashed
+    testdbPutFieldOk("rec1", DBR_DOUBLE, 21.0);
+    testdbPutFieldOk("rec1", DBR_DOUBLE, 22.0);
+    testdbPutFieldOk("rec1", DBR_DOUBLE, 23.0);
+
+    std::vector<double> values;
+    while(values.empty() || values.back()!=23.0) {
+        if(!mon.poll() && !(mon.wait(3.0) && mon.poll()))
+            break;
+        values.push_back(mon.root->getSubFieldT<pvd::PVDouble>("value")->get());
+    }
+
+    testEqual(values.size(), 3u);
+    testOk(values.size()==3u && values[0]==21.0 && values[1]==22.0, "no updates squashed");
+    testOk1(mon.overrun.isEmpty());
+}
+
+void testElementPool(pvac::ClientProvider& client)
+{
+    testDiag("test re-use of monitor queue elements");
+
+    size_t hits = epics::atomic::get(PDBElementPool::num_hits);
+    {
+        pvac::MonitorSync mon(client.connect("rec1").monitor());
+        testOk1(mon.wait(3.0) && mon.poll());
+
+        // leave one update in the queue
+        testdbPutFieldOk("rec1", DBR_DOUBLE, 30.0);
+        testOk1(mon.wait(3.0));
+    }
+    // un-polled elements returned on destroy()
+    testOk1(epics::atomic::get(PDBElementPool::num_free)>0u);
+    {
+        pvac::MonitorSync mon(client.connect("rec1").monitor());
+        testOk1(mon.wait(3.0) && mon.poll());
+        testFieldEqual<pvd::PVDouble>(mon.root, "value", 30.0);
+    }
+    testOk1(epics::atomic::get(PDBElementPool::num_hits)>hits);
+}
+
 void testGroupMonitor(pvac::ClientProvider& client)
 {
     testDiag("test group monitor");
@@ -299,7 +394,7 @@ void p2pTestIoc_registerRecordDeviceDriver(struct dbBase *);
 
 MAIN(testpdb)
 {
-    testPlan(93);
+    testPlan(123);
     try{
         QSRVRegistrar_counters();
         epics::RefSnapshot ref_before;
@@ -331,6 +426,9 @@ MAIN(testpdb)
             testGroupPut(client);
 
             testSingleMonitor(client);
+            testSnapshotMonitor(client);
+            testQueueSize(client);
+            testElementPool(client);
             testGroupMonitor(client);
             testGroupMonitorTriggers(client);
 
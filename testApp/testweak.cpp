@@ -197,11 +197,35 @@ void testWeakIterate()
     }
 }
 
+static
+void testWeakSnapshot()
+{
+    typedef weak_set<int> set_type;
+    set_type::value_pointer A(new int(42)), B(new int(43));
+    set_type set;
+
+    testDiag("Test weak_set snapshot");
+
+    set.insert(A);
+    set.insert(B);
+
+    set_type::snapshot_pointer S1(set.snapshot()), S2(set.snapshot());
+    testOk1(S1==S2); // not rebuilt w/o change
+    testOk1(S1->size()==2);
+
+    A.reset(); // implicitly removes from set
+
+    set_type::snapshot_pointer S3(set.snapshot());
+    testOk1(S3!=S1);
+    testOk1(S3->size()==1 && *(*S3)[0].lock()==43);
+    testOk1(S1->size()==2); // old snapshot unchanged
+}
+
 } // namespace
 
 MAIN(testweak)
 {
-    testPlan(37);
+    testPlan(42);
     testWeakSet1();
     testWeakSet2();
     testWeakSetInvalid();
@@ -209,5 +233,6 @@ MAIN(testweak)
     testWeakMap2();
     testWeakLock();
     testWeakIterate();
+    testWeakSnapshot();
     return testDone();
 }